@@ -0,0 +1,248 @@
+/**
+ * Concurrency benchmark of a TécnicoFS engine.
+ *
+ * Built twice from this file: against fs/ (per-inode rwlocks) as
+ * bench/bench_fs and against fs2/ (one global mutex) as bench/bench_fs2, so
+ * both run exactly the same workload (see "make bench").
+ *
+ * For every operation mix and thread count, each thread runs a fixed number
+ * of operations picked at random (with the same seeds for both engines):
+ *   - read: open one of the shared files, read it and close it
+ *   - write: open the thread's own file truncating it, write it and close it
+ *   - create: create a new file, close it and unlink it
+ * and the throughput and the latency percentiles of all the operations are
+ * printed, one line per run.
+ *
+ * Usage: bench [operations per thread] [maximum thread count]
+ */
+#ifdef BENCH_FS2
+#include "fs2/operations.h"
+#else
+#include "fs/operations.h"
+#endif
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef BENCH_FS2
+#define BENCH_ENGINE "fs2"
+#else
+#define BENCH_ENGINE "fs"
+#endif
+
+// files read by every thread
+#define SHARED_FILES (8)
+#define FILE_SIZE (512)
+
+typedef struct {
+    char const *name;
+    unsigned read_pct;
+    unsigned write_pct; // the rest are creates
+} bench_mix_t;
+
+static bench_mix_t const mixes[] = {
+    {"read", 90, 10},
+    {"mixed", 50, 40},
+    {"write", 10, 90},
+    {"create", 20, 20},
+};
+
+typedef struct {
+    size_t id;
+    size_t ops;
+    bench_mix_t const *mix;
+    uint64_t *latencies; // ns, one per operation
+    size_t errors;
+} bench_thread_t;
+
+static uint64_t bench_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static uint32_t bench_random(uint32_t *state) {
+    // xorshift32
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static int bench_read(uint32_t *seed) {
+    char path[16];
+    char buffer[FILE_SIZE];
+    snprintf(path, sizeof(path), "/s%u", bench_random(seed) % SHARED_FILES);
+
+    int fd = tfs_open(path, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t read = tfs_read(fd, buffer, sizeof(buffer));
+    tfs_close(fd);
+
+    return read == FILE_SIZE ? 0 : -1;
+}
+
+static int bench_write(size_t id) {
+    char path[16];
+    char buffer[FILE_SIZE];
+    snprintf(path, sizeof(path), "/w%zu", id);
+    memset(buffer, 'a' + (int)(id % 26), sizeof(buffer));
+
+    int fd = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t written = tfs_write(fd, buffer, sizeof(buffer));
+    tfs_close(fd);
+
+    return written == FILE_SIZE ? 0 : -1;
+}
+
+static int bench_create(size_t id) {
+    char path[16];
+    snprintf(path, sizeof(path), "/c%zu", id);
+
+    int fd = tfs_open(path, TFS_O_CREAT);
+    if (fd == -1) {
+        return -1;
+    }
+    tfs_close(fd);
+
+    return tfs_unlink(path);
+}
+
+static void *bench_thread(void *arg) {
+    bench_thread_t *thread = arg;
+    uint32_t seed = (uint32_t)thread->id * 2654435761U + 1;
+
+    for (size_t i = 0; i < thread->ops; i++) {
+        unsigned pick = bench_random(&seed) % 100;
+
+        uint64_t start = bench_now();
+        int ret;
+        if (pick < thread->mix->read_pct) {
+            ret = bench_read(&seed);
+        } else if (pick < thread->mix->read_pct + thread->mix->write_pct) {
+            ret = bench_write(thread->id);
+        } else {
+            ret = bench_create(thread->id);
+        }
+        thread->latencies[i] = bench_now() - start;
+
+        if (ret == -1) {
+            thread->errors++;
+        }
+    }
+
+    return NULL;
+}
+
+static int compare_latencies(void const *a, void const *b) {
+    uint64_t x = *(uint64_t const *)a;
+    uint64_t y = *(uint64_t const *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_us(uint64_t const *sorted, size_t count,
+                            double fraction) {
+    size_t rank = (size_t)((double)(count - 1) * fraction);
+    return (double)sorted[rank] / 1000.0;
+}
+
+/**
+ * Run a mix with a number of threads on a fresh file system.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int bench_run(bench_mix_t const *mix, size_t thread_count,
+                     size_t ops) {
+    if (tfs_init(NULL) != 0) {
+        return -1;
+    }
+
+    char contents[FILE_SIZE];
+    memset(contents, 's', sizeof(contents));
+    for (unsigned i = 0; i < SHARED_FILES; i++) {
+        char path[16];
+        snprintf(path, sizeof(path), "/s%u", i);
+        int fd = tfs_open(path, TFS_O_CREAT);
+        if (fd == -1 || tfs_write(fd, contents, sizeof(contents)) == -1) {
+            return -1;
+        }
+        tfs_close(fd);
+    }
+
+    pthread_t *tids = malloc(thread_count * sizeof(pthread_t));
+    bench_thread_t *threads = malloc(thread_count * sizeof(bench_thread_t));
+    uint64_t *latencies = malloc(thread_count * ops * sizeof(uint64_t));
+    if (!tids || !threads || !latencies) {
+        return -1;
+    }
+
+    uint64_t start = bench_now();
+    for (size_t i = 0; i < thread_count; i++) {
+        threads[i].id = i;
+        threads[i].ops = ops;
+        threads[i].mix = mix;
+        threads[i].latencies = latencies + i * ops;
+        threads[i].errors = 0;
+        if (pthread_create(&tids[i], NULL, bench_thread, &threads[i]) != 0) {
+            return -1;
+        }
+    }
+
+    size_t errors = 0;
+    for (size_t i = 0; i < thread_count; i++) {
+        pthread_join(tids[i], NULL);
+        errors += threads[i].errors;
+    }
+    uint64_t elapsed = bench_now() - start;
+
+    size_t total = thread_count * ops;
+    qsort(latencies, total, sizeof(uint64_t), compare_latencies);
+
+    printf("%-6s %-7s %7zu %12.0f %9.1f %9.1f %9.1f %7zu\n", BENCH_ENGINE,
+           mix->name, thread_count, (double)total * 1e9 / (double)elapsed,
+           percentile_us(latencies, total, 0.5),
+           percentile_us(latencies, total, 0.99),
+           percentile_us(latencies, total, 0.999), errors);
+    fflush(stdout);
+
+    free(tids);
+    free(threads);
+    free(latencies);
+
+    return tfs_destroy();
+}
+
+int main(int argc, char **argv) {
+    size_t ops = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000;
+    size_t max_threads = argc > 2 ? strtoul(argv[2], NULL, 10) : 8;
+    if (ops == 0 || max_threads == 0) {
+        fprintf(stderr, "usage: %s [ops per thread] [max threads]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%-6s %-7s %7s %12s %9s %9s %9s %7s\n", "engine", "mix", "threads",
+           "ops/s", "p50_us", "p99_us", "p99.9_us", "errors");
+
+    for (size_t m = 0; m < sizeof(mixes) / sizeof(mixes[0]); m++) {
+        for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+            if (bench_run(&mixes[m], threads, ops) != 0) {
+                fprintf(stderr, "%s: %s with %zu threads failed\n",
+                        BENCH_ENGINE, mixes[m].name, threads);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
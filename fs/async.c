@@ -0,0 +1,431 @@
+/**
+ * Asynchronous submission/completion interface (see tfs_submit).
+ *
+ * Each storage thread owns a FIFO of pending operations. Operations are routed
+ * to a thread by file handle (or path name), which keeps the operations on a
+ * file in order and lets a thread merge runs of reads or writes to the same
+ * file handle into a single call.
+ */
+#include "async.h"
+#include "config.h"
+#include "operations.h"
+#include "state.h"
+#include "utils.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Submitted operation (node of a worker's queue).
+ */
+typedef struct async_op {
+    tfs_op_t op;
+    tfs_ring_t *ring;
+    struct async_op *next;
+} async_op_t;
+
+/**
+ * Storage thread and its queue of pending operations.
+ */
+typedef struct {
+    async_op_t *head;
+    async_op_t *tail;
+    bool running;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    tfs_ctx_t *ctx; // FS instance the operations run on
+} async_worker_t;
+
+/**
+ * Storage threads of an FS instance.
+ */
+struct async_pool {
+    async_worker_t *workers;
+    size_t workers_count;
+};
+
+/**
+ * Completion ring (circular buffer of completions).
+ */
+struct tfs_ring {
+    tfs_completion_t *completions;
+    size_t entries;
+    size_t head;      // oldest completion not yet reaped
+    size_t ready;     // completions not yet reaped
+    size_t in_flight; // operations submitted and not yet reaped
+    async_pool_t *pool;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+/**
+ * Add a completion to a ring (it always has room, as entries are reserved on
+ * submission).
+ */
+static void ring_post(tfs_ring_t *ring, unsigned long user_data,
+                      ssize_t result) {
+    mutex_lock(&ring->lock);
+    size_t tail = (ring->head + ring->ready) % ring->entries;
+    ring->completions[tail].user_data = user_data;
+    ring->completions[tail].result = result;
+    ring->ready++;
+    cond_broadcast(&ring->cond);
+    mutex_unlock(&ring->lock);
+}
+
+/**
+ * Deliver the result of an operation to its ring.
+ */
+static void async_complete(async_op_t *node, ssize_t result) {
+    ring_post(node->ring, node->op.user_data, result);
+    free(node);
+}
+
+/**
+ * Run a single operation synchronously.
+ */
+static ssize_t async_run(tfs_ctx_t *ctx, tfs_op_t const *op) {
+    switch (op->op) {
+    case TFS_OP_OPEN:
+        return tfs_ctx_open(ctx, op->name, op->mode);
+    case TFS_OP_CLOSE:
+        return tfs_ctx_close(ctx, op->fhandle);
+    case TFS_OP_READ:
+        return tfs_ctx_read(ctx, op->fhandle, op->buffer, op->len);
+    case TFS_OP_WRITE:
+        return tfs_ctx_write(ctx, op->fhandle, op->buffer, op->len);
+    case TFS_OP_UNLINK:
+        return tfs_ctx_unlink(ctx, op->name);
+    default:
+        return -1;
+    }
+}
+
+/**
+ * Determine if an operation can be merged into a run starting with another.
+ */
+static bool async_coalescable(tfs_op_t const *first, tfs_op_t const *op,
+                              size_t run_len) {
+    return (first->op == TFS_OP_READ || first->op == TFS_OP_WRITE) &&
+           op->op == first->op && op->fhandle == first->fhandle &&
+           run_len <= ASYNC_COALESCE_MAX &&
+           op->len <= ASYNC_COALESCE_MAX - run_len;
+}
+
+/**
+ * Run a list of reads (or writes) to the same file handle as a single call,
+ * splitting the result between them as if they had run one after the other.
+ */
+static void async_run_coalesced(tfs_ctx_t *ctx, async_op_t *run,
+                                size_t run_len) {
+    char *buffer = malloc(run_len);
+    if (buffer == NULL) {
+        // run them one by one
+        while (run != NULL) {
+            async_op_t *next = run->next;
+            async_complete(run, async_run(ctx, &run->op));
+            run = next;
+        }
+        return;
+    }
+
+    bool is_write = run->op.op == TFS_OP_WRITE;
+    int fhandle = run->op.fhandle;
+
+    ssize_t done;
+    if (is_write) {
+        size_t offset = 0;
+        for (async_op_t *node = run; node != NULL; node = node->next) {
+            memcpy(buffer + offset, node->op.buffer, node->op.len);
+            offset += node->op.len;
+        }
+        done = tfs_ctx_write(ctx, fhandle, buffer, run_len);
+    } else {
+        done = tfs_ctx_read(ctx, fhandle, buffer, run_len);
+    }
+
+    size_t offset = 0;
+    while (run != NULL) {
+        async_op_t *next = run->next;
+        ssize_t result = -1;
+        if (done != -1) {
+            size_t part = (size_t)done > offset ? (size_t)done - offset : 0;
+            if (part > run->op.len) {
+                part = run->op.len;
+            }
+            if (!is_write) {
+                memcpy(run->op.buffer, buffer + offset, part);
+            }
+            offset += part;
+            result = (ssize_t)part;
+        }
+        async_complete(run, result);
+        run = next;
+    }
+
+    free(buffer);
+}
+
+/**
+ * Storage thread: run the operations of its queue until the interface is shut
+ * down and the queue is empty.
+ */
+static void *async_worker_main(void *arg) {
+    async_worker_t *worker = arg;
+
+    mutex_lock(&worker->lock);
+    while (true) {
+        while (worker->head == NULL && worker->running) {
+            cond_wait(&worker->cond, &worker->lock);
+        }
+        if (worker->head == NULL) {
+            break; // shut down
+        }
+
+        // take the first operation and the ones that can be merged into it
+        async_op_t *run = worker->head;
+        async_op_t *last = run;
+        size_t run_len = run->op.len;
+        while (last->next != NULL &&
+               async_coalescable(&run->op, &last->next->op, run_len)) {
+            last = last->next;
+            run_len += last->op.len;
+        }
+        worker->head = last->next;
+        if (worker->head == NULL) {
+            worker->tail = NULL;
+        }
+        last->next = NULL;
+        mutex_unlock(&worker->lock);
+
+        if (run->next == NULL) {
+            async_complete(run, async_run(worker->ctx, &run->op));
+        } else {
+            async_run_coalesced(worker->ctx, run, run_len);
+        }
+
+        mutex_lock(&worker->lock);
+    }
+    mutex_unlock(&worker->lock);
+
+    return NULL;
+}
+
+/**
+ * Start the storage threads of an FS instance.
+ *
+ * Input:
+ *   - ctx: the instance
+ *   - worker_count: number of threads (0 disables the interface)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int async_init(tfs_ctx_t *ctx, size_t worker_count) {
+    state_set_async_pool(ctx, NULL);
+    if (worker_count == 0) {
+        return 0;
+    }
+
+    async_pool_t *pool = malloc(sizeof(async_pool_t));
+    if (pool == NULL) {
+        return -1;
+    }
+    pool->workers = malloc(worker_count * sizeof(async_worker_t));
+    if (pool->workers == NULL) {
+        free(pool);
+        return -1;
+    }
+    pool->workers_count = 0;
+    state_set_async_pool(ctx, pool);
+
+    for (size_t i = 0; i < worker_count; i++) {
+        async_worker_t *worker = &pool->workers[i];
+        worker->head = NULL;
+        worker->tail = NULL;
+        worker->running = true;
+        worker->ctx = ctx;
+        mutex_init(&worker->lock);
+        cond_init(&worker->cond);
+
+        if (pthread_create(&worker->thread, NULL, async_worker_main, worker) !=
+            0) {
+            mutex_destroy(&worker->lock);
+            cond_destroy(&worker->cond);
+            async_destroy(ctx);
+            return -1;
+        }
+        pool->workers_count++;
+    }
+
+    return 0;
+}
+
+/**
+ * Stop the storage threads of an FS instance, once they have run every
+ * submitted operation.
+ */
+void async_destroy(tfs_ctx_t *ctx) {
+    async_pool_t *pool = state_async_pool(ctx);
+    if (pool == NULL) {
+        return;
+    }
+
+    async_worker_t *workers = pool->workers;
+    for (size_t i = 0; i < pool->workers_count; i++) {
+        mutex_lock(&workers[i].lock);
+        workers[i].running = false;
+        cond_signal(&workers[i].cond);
+        mutex_unlock(&workers[i].lock);
+    }
+
+    for (size_t i = 0; i < pool->workers_count; i++) {
+        pthread_join(workers[i].thread, NULL);
+        mutex_destroy(&workers[i].lock);
+        cond_destroy(&workers[i].cond);
+    }
+
+    free(workers);
+    free(pool);
+    state_set_async_pool(ctx, NULL);
+}
+
+/**
+ * Storage thread an operation must run on.
+ */
+static async_worker_t *async_route(async_pool_t *pool, tfs_op_t const *op) {
+    size_t key;
+    if (op->op == TFS_OP_OPEN || op->op == TFS_OP_UNLINK) {
+        key = 5381; // djb2 hash of the path name
+        for (char const *c = op->name; c != NULL && *c != '\0'; c++) {
+            key = key * 33 + (unsigned char)*c;
+        }
+    } else {
+        key = (size_t)op->fhandle;
+    }
+
+    return &pool->workers[key % pool->workers_count];
+}
+
+tfs_ring_t *tfs_ctx_ring_create(tfs_ctx_t *ctx, size_t entries) {
+    async_pool_t *pool = state_async_pool(state_ctx_get(ctx));
+    if (pool == NULL || entries == 0) {
+        return NULL;
+    }
+
+    tfs_ring_t *ring = malloc(sizeof(tfs_ring_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+
+    ring->completions = malloc(entries * sizeof(tfs_completion_t));
+    if (ring->completions == NULL) {
+        free(ring);
+        return NULL;
+    }
+
+    ring->entries = entries;
+    ring->head = 0;
+    ring->ready = 0;
+    ring->in_flight = 0;
+    ring->pool = pool;
+    mutex_init(&ring->lock);
+    cond_init(&ring->cond);
+
+    return ring;
+}
+
+tfs_ring_t *tfs_ring_create(size_t entries) {
+    return tfs_ctx_ring_create(state_ctx_default(), entries);
+}
+
+void tfs_ring_destroy(tfs_ring_t *ring) {
+    if (ring == NULL) {
+        return;
+    }
+
+    // completions still to come would be delivered to freed memory
+    mutex_lock(&ring->lock);
+    while (ring->ready < ring->in_flight) {
+        cond_wait(&ring->cond, &ring->lock);
+    }
+    mutex_unlock(&ring->lock);
+
+    mutex_destroy(&ring->lock);
+    cond_destroy(&ring->cond);
+    free(ring->completions);
+    free(ring);
+}
+
+ssize_t tfs_submit(tfs_ring_t *ring, tfs_op_t const *ops, size_t count) {
+    if (ring == NULL || (ops == NULL && count > 0)) {
+        return -1;
+    }
+
+    // reserve completion entries
+    mutex_lock(&ring->lock);
+    if (count > ring->entries - ring->in_flight) {
+        count = ring->entries - ring->in_flight;
+    }
+    ring->in_flight += count;
+    mutex_unlock(&ring->lock);
+
+    for (size_t i = 0; i < count; i++) {
+        async_op_t *node = malloc(sizeof(async_op_t));
+        if (node == NULL) {
+            ring_post(ring, ops[i].user_data, -1); // fails right away
+            continue;
+        }
+
+        node->op = ops[i];
+        node->ring = ring;
+        node->next = NULL;
+
+        async_worker_t *worker = async_route(ring->pool, &node->op);
+        mutex_lock(&worker->lock);
+        if (worker->tail == NULL) {
+            worker->head = node;
+        } else {
+            worker->tail->next = node;
+        }
+        worker->tail = node;
+        cond_signal(&worker->cond);
+        mutex_unlock(&worker->lock);
+    }
+
+    return (ssize_t)count;
+}
+
+ssize_t tfs_reap(tfs_ring_t *ring, tfs_completion_t *completions, size_t max,
+                 size_t min_complete) {
+    if (ring == NULL || (completions == NULL && max > 0)) {
+        return -1;
+    }
+
+    mutex_lock(&ring->lock);
+
+    if (min_complete > ring->in_flight) {
+        min_complete = ring->in_flight;
+    }
+    if (min_complete > max) {
+        min_complete = max;
+    }
+    while (ring->ready < min_complete) {
+        cond_wait(&ring->cond, &ring->lock);
+    }
+
+    size_t reaped = 0;
+    while (reaped < max && ring->ready > 0) {
+        completions[reaped++] = ring->completions[ring->head];
+        ring->head = (ring->head + 1) % ring->entries;
+        ring->ready--;
+        ring->in_flight--;
+    }
+
+    mutex_unlock(&ring->lock);
+
+    return (ssize_t)reaped;
+}
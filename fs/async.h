@@ -0,0 +1,13 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include "operations.h"
+#include <stddef.h>
+
+// storage threads of an FS instance
+typedef struct async_pool async_pool_t;
+
+int async_init(tfs_ctx_t *ctx, size_t worker_count);
+void async_destroy(tfs_ctx_t *ctx);
+
+#endif // ASYNC_H
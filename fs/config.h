@@ -8,4 +8,42 @@
 
 #define DELAY (5000)
 
+// Bytes of file content (or symlink target) that can be kept inside an inode
+#define INODE_INLINE_SIZE (64)
+
+// Data block slots per inode (files span at most this many blocks)
+#define INODE_DIRECT_BLOCKS (64)
+
+// Byte ranges of a file that can be locked at once (see range_lock.h)
+#define RANGE_LOCK_SLOTS (8)
+
+// Period (in ms) at which a range lock shared by several processes checks that
+// the ranges it waits for are not held by a process that died
+#define RANGE_LOCK_CHECK_MS (50)
+
+// Decompressed blocks kept in memory for reads of compressed files
+#define COMPRESS_CACHE_ENTRIES (16)
+
+// Locks protecting the data block checksums (block number modulo this)
+#define CHECKSUM_STRIPES (64)
+
+// Checksums timed for the checksum_ns statistic (one in this many, per
+// stripe), as reading the clock costs about as much as a block's checksum
+#define CHECKSUM_TIME_SAMPLE (64)
+
+// Data blocks verified by each run of the background scrub
+#define SCRUB_BATCH (64)
+
+// Data blocks waiting for the read-ahead thread (more requests are dropped)
+#define READAHEAD_QUEUE (64)
+
+// Bytes a TFS_O_BUFFERED handle gathers before writing them to its file
+#define WRITE_BUFFER_SIZE (4096)
+
+// Age (in ms) at which data buffered by a handle is flushed by its next write
+#define WRITE_BUFFER_AGE_MS (10)
+
+// Largest read or write the asynchronous interface coalesces operations into
+#define ASYNC_COALESCE_MAX (64 * 1024)
+
 #endif // CONFIG_H
@@ -0,0 +1,186 @@
+/**
+ * CRC32C (Castagnoli) checksums.
+ *
+ * On x86-64 CPUs with SSE4.2 and PCLMULQDQ, the crc32 instruction is run over
+ * three interleaved streams (hiding its latency) whose CRCs are then merged
+ * with carry-less multiplications. Elsewhere a portable slicing-by-8 table
+ * implementation is used. crc32c_init picks the implementation and must be
+ * called before the first checksum.
+ */
+#include "crc32c.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CRC32C_X86 (1)
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+// reflected Castagnoli polynomial
+#define CRC32C_POLY (0x82F63B78U)
+
+// bytes of each of the three interleaved streams of the hardware kernel
+#define CRC32C_STREAM (128)
+
+static uint32_t crc32c_table[8][256];
+
+typedef uint32_t (*crc32c_fn)(uint32_t crc, unsigned char const *buffer,
+                              size_t len);
+
+/**
+ * Multiply two polynomials modulo the CRC polynomial (reflected, bit 31 is
+ * x^0).
+ */
+static uint32_t crc32c_multmod(uint32_t a, uint32_t b) {
+    uint32_t product = 0;
+    for (uint32_t m = 1U << 31; m != 0; m >>= 1) {
+        if (a & m) {
+            product ^= b;
+        }
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+
+    return product;
+}
+
+/**
+ * x^n modulo the CRC polynomial (reflected).
+ */
+static uint32_t crc32c_xpow(size_t n) {
+    uint32_t result = 1U << 31; // x^0
+    uint32_t square = 1U << 30; // x^1, then x^2, x^4, ...
+    while (n != 0) {
+        if (n & 1) {
+            result = crc32c_multmod(square, result);
+        }
+        square = crc32c_multmod(square, square);
+        n >>= 1;
+    }
+
+    return result;
+}
+
+static uint32_t crc32c_sw(uint32_t crc, unsigned char const *buffer,
+                          size_t len) {
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, buffer, sizeof(word));
+        word ^= crc; // little endian: crc covers the first four bytes
+
+        crc = crc32c_table[7][word & 0xFF] ^
+              crc32c_table[6][(word >> 8) & 0xFF] ^
+              crc32c_table[5][(word >> 16) & 0xFF] ^
+              crc32c_table[4][(word >> 24) & 0xFF] ^
+              crc32c_table[3][(word >> 32) & 0xFF] ^
+              crc32c_table[2][(word >> 40) & 0xFF] ^
+              crc32c_table[1][(word >> 48) & 0xFF] ^
+              crc32c_table[0][word >> 56];
+        buffer += 8;
+        len -= 8;
+    }
+
+    while (len-- > 0) {
+        crc = crc32c_table[0][(crc ^ *buffer++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+#ifdef CRC32C_X86
+// x^(8 * CRC32C_STREAM * k - 33): shifts a stream's CRC past k streams
+static uint32_t crc32c_shift1;
+static uint32_t crc32c_shift2;
+
+__attribute__((target("sse4.2,pclmul"))) static uint32_t
+crc32c_shift(uint32_t crc, uint32_t constant) {
+    __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int)crc),
+                                           _mm_cvtsi32_si128((int)constant), 0);
+    return (uint32_t)_mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(product));
+}
+
+__attribute__((target("sse4.2,pclmul"))) static uint32_t
+crc32c_hw(uint32_t crc, unsigned char const *buffer, size_t len) {
+    uint64_t crc0 = crc;
+
+    while (len >= 3 * CRC32C_STREAM) {
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+        for (size_t i = 0; i < CRC32C_STREAM; i += 8) {
+            uint64_t word0, word1, word2;
+            memcpy(&word0, buffer + i, sizeof(uint64_t));
+            memcpy(&word1, buffer + CRC32C_STREAM + i, sizeof(uint64_t));
+            memcpy(&word2, buffer + 2 * CRC32C_STREAM + i, sizeof(uint64_t));
+            crc0 = _mm_crc32_u64(crc0, word0);
+            crc1 = _mm_crc32_u64(crc1, word1);
+            crc2 = _mm_crc32_u64(crc2, word2);
+        }
+
+        crc0 = crc32c_shift((uint32_t)crc0, crc32c_shift2) ^
+               crc32c_shift((uint32_t)crc1, crc32c_shift1) ^ crc2;
+        buffer += 3 * CRC32C_STREAM;
+        len -= 3 * CRC32C_STREAM;
+    }
+
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, buffer, sizeof(word));
+        crc0 = _mm_crc32_u64(crc0, word);
+        buffer += 8;
+        len -= 8;
+    }
+
+    uint32_t crc32 = (uint32_t)crc0;
+    while (len-- > 0) {
+        crc32 = _mm_crc32_u8(crc32, *buffer++);
+    }
+
+    return crc32;
+}
+#endif
+
+static crc32c_fn crc32c_impl = crc32c_sw;
+
+/**
+ * Build the lookup tables and pick the fastest implementation for this CPU.
+ */
+void crc32c_init(void) {
+    for (uint32_t byte = 0; byte < 256; byte++) {
+        uint32_t crc = byte;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[0][byte] = crc;
+    }
+
+    for (size_t byte = 0; byte < 256; byte++) {
+        for (size_t k = 1; k < 8; k++) {
+            uint32_t prev = crc32c_table[k - 1][byte];
+            crc32c_table[k][byte] = crc32c_table[0][prev & 0xFF] ^ (prev >> 8);
+        }
+    }
+
+#ifdef CRC32C_X86
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul")) {
+        crc32c_shift1 = crc32c_xpow(8 * CRC32C_STREAM - 33);
+        crc32c_shift2 = crc32c_xpow(8 * 2 * CRC32C_STREAM - 33);
+        crc32c_impl = crc32c_hw;
+    }
+#else
+    (void)crc32c_xpow;
+#endif
+}
+
+/**
+ * Extend a CRC32C with more data (crc is 0 for the first piece).
+ */
+uint32_t crc32c(uint32_t crc, void const *buffer, size_t len) {
+    return ~crc32c_impl(~crc, buffer, len);
+}
+
+/**
+ * Same as crc32c, always using the table implementation.
+ */
+uint32_t crc32c_portable(uint32_t crc, void const *buffer, size_t len) {
+    return ~crc32c_sw(~crc, buffer, len);
+}
@@ -0,0 +1,11 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+void crc32c_init(void);
+uint32_t crc32c(uint32_t crc, void const *buffer, size_t len);
+uint32_t crc32c_portable(uint32_t crc, void const *buffer, size_t len);
+
+#endif // CRC32C_H
@@ -0,0 +1,243 @@
+/**
+ * Small LZ77 codec (in the spirit of LZ4) used to compress file blocks.
+ *
+ * The compressed stream is a list of sequences:
+ *
+ *   [ token | extra literal length | literals | offset | extra match length ]
+ *
+ * The high nibble of the token is the literal count and the low nibble is the
+ * match length minus LZ_MIN_MATCH. A nibble of 15 is followed by extra length
+ * bytes (each 255 means "add and continue"). The offset is 16-bit little
+ * endian. The last sequence only carries literals: the stream ends right after
+ * them.
+ */
+#include "lz.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define LZ_MIN_MATCH (4)
+#define LZ_MAX_OFFSET (0xFFFF)
+#define LZ_HASH_BITS (12)
+#define LZ_NIBBLE_MAX (15)
+
+static uint32_t lz_read32(uint8_t const *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static size_t lz_hash(uint32_t sequence) {
+    return (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * Append a length that did not fit in its token nibble.
+ */
+static bool lz_put_length(uint8_t *out, size_t capacity, size_t *op,
+                          size_t length) {
+    while (length >= 255) {
+        if (*op >= capacity) {
+            return false;
+        }
+        out[(*op)++] = 255;
+        length -= 255;
+    }
+
+    if (*op >= capacity) {
+        return false;
+    }
+    out[(*op)++] = (uint8_t)length;
+
+    return true;
+}
+
+/**
+ * Append a sequence (match_len == 0 for the final, literals only, one).
+ */
+static bool lz_emit(uint8_t *out, size_t capacity, size_t *op,
+                    uint8_t const *literals, size_t literal_len, size_t offset,
+                    size_t match_len) {
+    size_t lit_nibble =
+        literal_len < LZ_NIBBLE_MAX ? literal_len : LZ_NIBBLE_MAX;
+    size_t match_nibble = 0;
+    if (match_len > 0) {
+        match_nibble = match_len - LZ_MIN_MATCH < LZ_NIBBLE_MAX
+                           ? match_len - LZ_MIN_MATCH
+                           : LZ_NIBBLE_MAX;
+    }
+
+    if (*op >= capacity) {
+        return false;
+    }
+    out[(*op)++] = (uint8_t)((lit_nibble << 4) | match_nibble);
+
+    if (lit_nibble == LZ_NIBBLE_MAX &&
+        !lz_put_length(out, capacity, op, literal_len - LZ_NIBBLE_MAX)) {
+        return false;
+    }
+
+    if (capacity - *op < literal_len) {
+        return false;
+    }
+    memcpy(out + *op, literals, literal_len);
+    *op += literal_len;
+
+    if (match_len == 0) {
+        return true;
+    }
+
+    if (capacity - *op < 2) {
+        return false;
+    }
+    out[(*op)++] = (uint8_t)(offset & 0xFF);
+    out[(*op)++] = (uint8_t)(offset >> 8);
+
+    if (match_nibble == LZ_NIBBLE_MAX &&
+        !lz_put_length(out, capacity, op,
+                       match_len - LZ_MIN_MATCH - LZ_NIBBLE_MAX)) {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Compress a buffer.
+ *
+ * Input:
+ *   - src: data to compress
+ *   - len: length of the data
+ *   - dst: destination buffer
+ *   - capacity: size of the destination buffer
+ *
+ * Returns the compressed length, or 0 if it would not fit in capacity bytes.
+ */
+size_t lz_compress(void const *src, size_t len, void *dst, size_t capacity) {
+    uint8_t const *in = src;
+    uint8_t *out = dst;
+    // last position (plus one, 0 meaning none) where each hash was seen
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    size_t ip = 0;
+    size_t anchor = 0;
+    size_t op = 0;
+
+    while (ip + LZ_MIN_MATCH <= len) {
+        uint32_t sequence = lz_read32(in + ip);
+        size_t hash = lz_hash(sequence);
+        size_t candidate = table[hash];
+        table[hash] = (uint32_t)(ip + 1);
+
+        if (candidate == 0 || ip - (candidate - 1) > LZ_MAX_OFFSET ||
+            lz_read32(in + candidate - 1) != sequence) {
+            ip++;
+            continue;
+        }
+
+        size_t ref = candidate - 1;
+        size_t match_len = LZ_MIN_MATCH;
+        while (ip + match_len < len &&
+               in[ref + match_len] == in[ip + match_len]) {
+            match_len++;
+        }
+
+        if (!lz_emit(out, capacity, &op, in + anchor, ip - anchor, ip - ref,
+                     match_len)) {
+            return 0;
+        }
+
+        ip += match_len;
+        anchor = ip;
+    }
+
+    if (!lz_emit(out, capacity, &op, in + anchor, len - anchor, 0, 0)) {
+        return 0;
+    }
+
+    return op;
+}
+
+/**
+ * Read a length that did not fit in its token nibble.
+ */
+static bool lz_get_length(uint8_t const *in, size_t len, size_t *ip,
+                          size_t *length) {
+    uint8_t byte;
+    do {
+        if (*ip >= len) {
+            return false;
+        }
+        byte = in[(*ip)++];
+        *length += byte;
+    } while (byte == 255);
+
+    return true;
+}
+
+/**
+ * Decompress a buffer produced by lz_compress.
+ *
+ * Input:
+ *   - src: compressed data
+ *   - len: length of the compressed data
+ *   - dst: destination buffer
+ *   - capacity: size of the destination buffer
+ *
+ * Returns the decompressed length, or 0 if the data is corrupted or does not
+ * fit in capacity bytes.
+ */
+size_t lz_decompress(void const *src, size_t len, void *dst, size_t capacity) {
+    uint8_t const *in = src;
+    uint8_t *out = dst;
+    size_t ip = 0;
+    size_t op = 0;
+
+    while (ip < len) {
+        uint8_t token = in[ip++];
+
+        size_t literal_len = (size_t)(token >> 4);
+        if (literal_len == LZ_NIBBLE_MAX &&
+            !lz_get_length(in, len, &ip, &literal_len)) {
+            return 0;
+        }
+
+        if (len - ip < literal_len || capacity - op < literal_len) {
+            return 0;
+        }
+        memcpy(out + op, in + ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+
+        if (ip == len) {
+            break; // final sequence
+        }
+
+        if (len - ip < 2) {
+            return 0;
+        }
+        size_t offset = (size_t)in[ip] | ((size_t)in[ip + 1] << 8);
+        ip += 2;
+
+        size_t match_len = (size_t)(token & LZ_NIBBLE_MAX);
+        if (match_len == LZ_NIBBLE_MAX &&
+            !lz_get_length(in, len, &ip, &match_len)) {
+            return 0;
+        }
+        match_len += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > op || capacity - op < match_len) {
+            return 0;
+        }
+
+        // byte by byte, matches may overlap the bytes they produce
+        for (size_t i = 0; i < match_len; i++) {
+            out[op + i] = out[op - offset + i];
+        }
+        op += match_len;
+    }
+
+    return op;
+}
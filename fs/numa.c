@@ -0,0 +1,163 @@
+/**
+ * NUMA placement helpers for the TFS state regions.
+ *
+ * Talks to the kernel directly (getcpu(2) and mbind(2)) instead of linking
+ * against libnuma. Every placement call is best-effort: on kernels built
+ * without NUMA support the calls fail and memory simply keeps the default
+ * first-touch policy.
+ */
+#define _GNU_SOURCE
+
+#include "numa.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// mbind(2) policies and flags (<numaif.h> is only shipped with libnuma)
+#define NUMA_MPOL_PREFERRED (1)
+#define NUMA_MPOL_INTERLEAVE (3)
+#define NUMA_MPOL_MF_MOVE (1 << 1)
+
+// nodes representable in a single-word node mask
+#define NUMA_MAX_NODES (64)
+
+/**
+ * Number of NUMA nodes of the host (1 if unknown).
+ *
+ * Parses /sys/devices/system/node/online, which holds a list of node ranges
+ * such as "0" or "0-1,3".
+ */
+size_t numa_node_count(void) {
+    FILE *online = fopen("/sys/devices/system/node/online", "r");
+    if (online == NULL) {
+        return 1;
+    }
+
+    size_t count = 1;
+    unsigned int first, last;
+    while (fscanf(online, "%u", &first) == 1) {
+        last = first;
+
+        int c = fgetc(online);
+        if (c == '-') {
+            if (fscanf(online, "%u", &last) != 1) {
+                break;
+            }
+            c = fgetc(online);
+        }
+
+        if (last + 1 > count) {
+            count = last + 1;
+        }
+
+        if (c != ',') {
+            break;
+        }
+    }
+
+    fclose(online);
+
+    return count > NUMA_MAX_NODES ? NUMA_MAX_NODES : count;
+}
+
+/**
+ * Node of the CPU the calling thread is running on (0 if unknown).
+ */
+int numa_current_node(void) {
+#ifdef SYS_getcpu
+    unsigned int cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) {
+        return (int)node;
+    }
+#endif
+
+    return 0;
+}
+
+/**
+ * Allocate a page aligned, zero filled region that placement policies can be
+ * applied to. No page is touched, so nothing is placed (or even backed by
+ * memory) yet.
+ *
+ * Returns NULL on failure.
+ */
+void *numa_region_alloc(size_t size) {
+    void *region = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    return region == MAP_FAILED ? NULL : region;
+}
+
+/**
+ * Release a region obtained from numa_region_alloc.
+ */
+void numa_region_free(void *region, size_t size) {
+    if (region != NULL) {
+        munmap(region, size);
+    }
+}
+
+/**
+ * Apply a memory policy to the pages of [region, region + size).
+ *
+ * The range is widened/narrowed to page boundaries by rounding both ends up,
+ * so contiguous calls over adjacent sub ranges partition the pages without
+ * overlap.
+ */
+static int numa_mbind(void *region, size_t size, int mode,
+                      unsigned long nodemask) {
+#ifdef SYS_mbind
+    uintptr_t mask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+    uintptr_t start = ((uintptr_t)region + mask) & ~mask;
+    uintptr_t end = ((uintptr_t)region + size + mask) & ~mask;
+    if (end <= start) {
+        return 0; // smaller than a page, nothing to place
+    }
+
+    if (syscall(SYS_mbind, start, end - start, mode, &nodemask,
+                NUMA_MAX_NODES + 1, NUMA_MPOL_MF_MOVE) != 0) {
+        return -1;
+    }
+
+    return 0;
+#else
+    (void)region;
+    (void)size;
+    (void)mode;
+    (void)nodemask;
+    return -1;
+#endif
+}
+
+/**
+ * Stripe the pages of a region round-robin across the first node_count nodes.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int numa_interleave(void *region, size_t size, size_t node_count) {
+    if (node_count == 0 || node_count > NUMA_MAX_NODES) {
+        return -1;
+    }
+
+    unsigned long nodemask =
+        node_count == NUMA_MAX_NODES ? ~0UL : (1UL << node_count) - 1;
+
+    return numa_mbind(region, size, NUMA_MPOL_INTERLEAVE, nodemask);
+}
+
+/**
+ * Prefer a given node for the pages of a region (pages already faulted in
+ * elsewhere are migrated).
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int numa_place(void *region, size_t size, size_t node) {
+    if (node >= NUMA_MAX_NODES) {
+        return -1;
+    }
+
+    return numa_mbind(region, size, NUMA_MPOL_PREFERRED, 1UL << node);
+}
@@ -0,0 +1,15 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stddef.h>
+
+size_t numa_node_count(void);
+int numa_current_node(void);
+
+void *numa_region_alloc(size_t size);
+void numa_region_free(void *region, size_t size);
+
+int numa_interleave(void *region, size_t size, size_t node_count);
+int numa_place(void *region, size_t size, size_t node);
+
+#endif // NUMA_H
@@ -1,29 +1,69 @@
 #include "operations.h"
+#include "async.h"
 #include "config.h"
 #include "state.h"
+#include "stats.h"
 #include "utils.h"
 #include <fcntl.h>
+#include <limits.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "betterassert.h"
 
-#define BLOCK_SIZE state_block_size()
+#define BLOCK_SIZE state_block_size(ctx)
 
 tfs_params tfs_default_params() {
+#ifdef TFS_STATIC_PARAMS
+    tfs_params params = {
+        .max_inode_count = TFS_STATIC_MAX_INODE_COUNT,
+        .max_block_count = TFS_STATIC_MAX_BLOCK_COUNT,
+        .max_open_files_count = TFS_STATIC_MAX_OPEN_FILES_COUNT,
+        .max_inode_reserve = 0,
+        .max_block_reserve = 0,
+        .block_size = TFS_STATIC_BLOCK_SIZE,
+        .max_file_blocks = TFS_STATIC_MAX_FILE_BLOCKS,
+        .numa_mode = TFS_NUMA_NONE,
+        .inline_threshold = 0,
+        .dedup = false,
+        .checksums = false,
+        .scrub_interval_ms = 0,
+        .readahead_blocks = 0,
+        .spill_path = NULL,
+        .spill_block_count = 0,
+        .shm_name = NULL,
+        .async_workers = 0,
+    };
+#else
     tfs_params params = {
         .max_inode_count = 64,
         .max_block_count = 1024,
         .max_open_files_count = 16,
+        .max_inode_reserve = 0,
+        .max_block_reserve = 0,
         .block_size = 1024,
+        .max_file_blocks = 1,
+        .numa_mode = TFS_NUMA_NONE,
+        .inline_threshold = 0,
+        .dedup = false,
+        .checksums = false,
+        .scrub_interval_ms = 0,
+        .readahead_blocks = 0,
+        .spill_path = NULL,
+        .spill_block_count = 0,
+        .shm_name = NULL,
+        .async_workers = 0,
     };
+#endif
     return params;
 }
 
-int tfs_init(tfs_params const *params_ptr) {
+static int do_init(tfs_ctx_t *ctx, tfs_params const *params_ptr) {
     tfs_params params;
     if (params_ptr != NULL) {
         params = *params_ptr;
@@ -31,27 +71,97 @@ int tfs_init(tfs_params const *params_ptr) {
         params = tfs_default_params();
     }
 
-    if (state_init(params) != 0) {
+    if (state_init(ctx, params) != 0) {
         return -1;
     }
 
     // create root inode
-    int root = inode_create(T_DIRECTORY);
+    int root = inode_create(ctx, T_DIRECTORY);
     if (root != ROOT_DIR_INUM) {
+        state_destroy(ctx);
+        return -1;
+    }
+
+    if (async_init(ctx, params.async_workers) != 0) {
+        state_destroy(ctx);
         return -1;
     }
 
     return 0;
 }
 
-int tfs_destroy() {
-    if (state_destroy() != 0) {
+static int do_destroy(tfs_ctx_t *ctx) {
+    async_destroy(ctx);
+
+    if (state_destroy(ctx) != 0) {
         return -1;
     }
 
     return 0;
 }
 
+int tfs_stats_dump(FILE *out) {
+    if (out == NULL) {
+        return -1;
+    }
+
+    return stats_dump(out);
+}
+
+int tfs_ctx_grow(tfs_ctx_t *ctx, tfs_params const *params) {
+    if (params == NULL) {
+        return -1;
+    }
+
+    return state_grow(state_ctx_get(ctx), params->max_inode_count,
+                      params->max_block_count);
+}
+
+size_t tfs_ctx_numa_stats(tfs_ctx_t *ctx, tfs_numa_node_stats_t *stats,
+                          size_t max_nodes) {
+    return state_numa_stats(state_ctx_get(ctx), stats, max_nodes);
+}
+
+int tfs_ctx_compress_stats(tfs_ctx_t *ctx, tfs_compress_stats_t *stats) {
+    if (stats == NULL) {
+        return -1;
+    }
+
+    return state_compress_stats(state_ctx_get(ctx), stats);
+}
+
+int tfs_ctx_dedup_stats(tfs_ctx_t *ctx, tfs_dedup_stats_t *stats) {
+    if (stats == NULL) {
+        return -1;
+    }
+
+    return state_dedup_stats(state_ctx_get(ctx), stats);
+}
+
+int tfs_ctx_checksum_stats(tfs_ctx_t *ctx, tfs_checksum_stats_t *stats) {
+    if (stats == NULL) {
+        return -1;
+    }
+
+    return state_checksum_stats(state_ctx_get(ctx), stats);
+}
+
+int tfs_ctx_readahead_stats(tfs_ctx_t *ctx, tfs_readahead_stats_t *stats) {
+    if (stats == NULL) {
+        return -1;
+    }
+
+    return state_readahead_stats(state_ctx_get(ctx), stats);
+}
+
+int tfs_ctx_spill_stats(tfs_ctx_t *ctx, tfs_spill_stats_t *stats) {
+    if (stats == NULL) {
+        return -1;
+    }
+
+    return state_spill_stats(state_ctx_get(ctx), stats);
+}
+
 static bool valid_pathname(char const *name) {
     return name != NULL && strlen(name) > 1 && name[0] == '/';
 }
@@ -67,7 +177,7 @@ static bool valid_pathname(char const *name) {
  *   - root_inode: the root directory inode
  * Returns the inumber of the file, -1 if unsuccessful.
  */
-static int tfs_lookup(char const *name, inode_t *root_inode) {
+static int tfs_lookup(tfs_ctx_t *ctx, char const *name, inode_t *root_inode) {
     if (!valid_pathname(name)) {
         return -1;
     }
@@ -80,54 +190,66 @@ static int tfs_lookup(char const *name, inode_t *root_inode) {
     // skip the initial '/' character
     name++;
 
-    return find_in_dir(root_inode, name);
+    return find_in_dir(ctx, root_inode, name);
 }
 
-int tfs_open(char const *name, tfs_file_mode_t mode) {
+static int do_open(tfs_ctx_t *ctx, char const *name, tfs_file_mode_t mode) {
     // Checks if the path name is valid
     if (!valid_pathname(name)) {
         return -1;
     }
 
-    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    // instances attached to another one's state can only read it
+    if (mode != 0 && state_read_only(ctx)) {
+        return -1;
+    }
+
+    inode_t *root_dir_inode = inode_get(ctx, ROOT_DIR_INUM);
     if (root_dir_inode == NULL) {
         return -1;
     }
 
-    pthread_rwlock_t *root_dir_rwl = inode_rwl_get(ROOT_DIR_INUM);
+    pthread_rwlock_t *root_dir_rwl = inode_rwl_get(ctx, ROOT_DIR_INUM);
     // lock root dir to avoid changes mid write (creation of duplicate files)
     rwl_wrlock(root_dir_rwl);
 
-    int inum = tfs_lookup(name, root_dir_inode);
+    int inum = tfs_lookup(ctx, name, root_dir_inode);
     size_t offset;
 
     if (inum >= 0) {
-        // file already created, let go of root dir lock
-        rwl_unlock(root_dir_rwl);
-        // The file already exists
-        inode_t *inode = inode_get(inum);
+        // The file already exists (the root dir stays locked until the handle
+        // is in the open file table, so that it is not unlinked in between)
+        inode_t *inode = inode_get(ctx, inum);
         ALWAYS_ASSERT(inode != NULL,
                       "tfs_open: directory files must have an inode");
 
-        pthread_rwlock_t *inode_rwl = inode_rwl_get(inum);
         // lock inode
-        rwl_wrlock(inode_rwl);
+        int slot = lock_inode(ctx, inum, true);
 
         if (inode->i_node_type == T_LINK) {
             // symlinks don't support O_CREATE flags
             if (mode & TFS_O_CREAT) {
-                rwl_unlock(inode_rwl);
+                unlock_inode(ctx, inum, slot);
+                rwl_unlock(root_dir_rwl);
                 return -1;
             }
 
             // get pathname of file pointed to by this symlink
-            void *block = data_block_get(inode->i_data_block);
+            char const *target =
+                inode->i_inline ? inode->i_inline_data
+                                : data_block_get(ctx, inode->i_data_blocks[0]);
+            if (target == NULL) {
+                unlock_inode(ctx, inum, slot);
+                rwl_unlock(root_dir_rwl);
+                return -1; // corrupted
+            }
             char buffer[MAX_FILE_NAME];
-            memcpy(buffer, block, strlen((char *)block) + 1);
+            memcpy(buffer, target, strlen(target) + 1);
 
-            // unlock inode after data being read
-            rwl_unlock(inode_rwl);
-            int fd = tfs_open(buffer, mode);
+            // unlock inode and root dir after data being read
+            unlock_inode(ctx, inum, slot);
+            rwl_unlock(root_dir_rwl);
+            int fd = do_open(ctx, buffer, mode);
             // if dangled link
             if (fd == -1) {
                 return -1;
@@ -138,10 +260,11 @@ int tfs_open(char const *name, tfs_file_mode_t mode) {
 
         // Truncate (if requested)
         if (mode & TFS_O_TRUNC) {
-            if (inode->i_size > 0) {
-                data_block_free(inode->i_data_block);
-                inode->i_size = 0;
-            }
+            inode_free_blocks(ctx, inode);
+        }
+        // Compression can only be turned on while there is nothing stored
+        if ((mode & TFS_O_COMPRESS) && inode->i_size == 0) {
+            inode->i_compressed = true;
         }
         // Determine initial offset
         if (mode & TFS_O_APPEND) {
@@ -149,23 +272,26 @@ int tfs_open(char const *name, tfs_file_mode_t mode) {
         } else {
             offset = 0;
         }
-        rwl_unlock(inode_rwl);
+        unlock_inode(ctx, inum, slot);
     } else if (mode & TFS_O_CREAT) {
         // The file does not exist; the mode specified that it should be created
         // Create inode
-        inum = inode_create(T_FILE);
+        inum = inode_create(ctx, T_FILE);
         if (inum == -1) {
             rwl_unlock(root_dir_rwl);
             return -1; // no space in inode table
         }
 
+        if (mode & TFS_O_COMPRESS) {
+            inode_get(ctx, inum)->i_compressed = true;
+        }
+
         // Add entry in the root directory
-        if (add_dir_entry(root_dir_inode, name + 1, inum) == -1) {
-            inode_delete(inum);
+        if (add_dir_entry(ctx, root_dir_inode, name + 1, inum) == -1) {
+            inode_delete(ctx, inum);
             rwl_unlock(root_dir_rwl);
             return -1; // no space in directory
         }
-        rwl_unlock(root_dir_rwl);
         offset = 0;
     } else {
         rwl_unlock(root_dir_rwl);
@@ -174,41 +300,53 @@ int tfs_open(char const *name, tfs_file_mode_t mode) {
 
     // Finally, add entry to the open file table and return the corresponding
     // handle
-    return add_to_open_file_table(inum, offset);
+    int fhandle = add_to_open_file_table(ctx, inum, offset,
+                                         (mode & TFS_O_APPEND) != 0,
+                                         (mode & TFS_O_BUFFERED) != 0);
+    rwl_unlock(root_dir_rwl);
+    return fhandle;
 
     // Note: for simplification, if file was created with TFS_O_CREAT and there
     // is an error adding an entry to the open file table, the file is not
     // opened but it remains created
 }
 
-int tfs_sym_link(char const *target, char const *link_name) {
+int tfs_ctx_open(tfs_ctx_t *ctx, char const *name, tfs_file_mode_t mode) {
+    STATS_START(start);
+    int result = do_open(state_ctx_get(ctx), name, mode);
+    STATS_STOP(STATS_OPEN, start);
+    return result;
+}
+
+static int do_sym_link(tfs_ctx_t *ctx, char const *target,
+                       char const *link_name) {
     // check if link_name is valid
-    if (!valid_pathname(link_name)) {
+    if (!valid_pathname(link_name) || state_read_only(ctx)) {
         return -1;
     }
 
     // root directory inode
-    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
-    pthread_rwlock_t *root_lock = inode_rwl_get(ROOT_DIR_INUM);
+    inode_t *root_dir_inode = inode_get(ctx, ROOT_DIR_INUM);
+    pthread_rwlock_t *root_lock = inode_rwl_get(ctx, ROOT_DIR_INUM);
 
     // lock root inode to deny changes to dir mid operation
     rwl_wrlock(root_lock);
 
     // check if target exists
-    int target_inumber = tfs_lookup(target, root_dir_inode);
+    int target_inumber = tfs_lookup(ctx, target, root_dir_inode);
     if (target_inumber == -1) {
         rwl_unlock(root_lock);
         return -1;
     }
 
     // check if a file with link_name already exists
-    if (tfs_lookup(link_name, root_dir_inode) != -1) {
+    if (tfs_lookup(ctx, link_name, root_dir_inode) != -1) {
         rwl_unlock(root_lock);
         return -1;
     }
 
     // create a link type inode
-    int new_inum = inode_create(T_LINK);
+    int new_inum = inode_create(ctx, T_LINK);
     // no space in inode table
     if (new_inum == -1) {
         rwl_unlock(root_lock);
@@ -216,27 +354,37 @@ int tfs_sym_link(char const *target, char const *link_name) {
     }
 
     // get created inode
-    inode_t *new_inode = inode_get(new_inum);
-    // allocate new block
-    int new_bnum = data_block_alloc();
-    // if no free blocks
-    if (new_bnum == -1) {
-        inode_delete(new_inum);
-        rwl_unlock(root_lock);
-        return -1;
-    }
+    inode_t *new_inode = inode_get(ctx, new_inum);
+    size_t target_len = strlen(target) + 1;
+
+    if (inode_fits_inline(ctx, new_inode, target_len)) {
+        // short targets are kept in the inode, no data block needed
+        memcpy(new_inode->i_inline_data, target, target_len);
+        new_inode->i_inline = true;
+    } else {
+        // allocate new block
+        int new_bnum = data_block_alloc(ctx);
+        // if no free blocks
+        if (new_bnum == -1) {
+            inode_delete(ctx, new_inum);
+            rwl_unlock(root_lock);
+            return -1;
+        }
 
-    // get block pointer
-    void *block = data_block_get(new_bnum);
-    // copy target path into block
-    memcpy(block, target, strlen(target) + 1);
+        // get block pointer
+        void *block = data_block_get_mut(ctx, new_bnum, true);
+        // copy target path into block
+        memcpy(block, target, target_len);
+        data_block_put_mut(ctx, new_bnum);
 
-    // associate created block to link's inode
-    new_inode->i_data_block = new_bnum;
+        // associate created block to link's inode
+        new_inode->i_data_blocks[0] = new_bnum;
+    }
+    new_inode->i_size = target_len;
 
     // add entry to dir and undo operations if no entries left on dir
-    if (add_dir_entry(root_dir_inode, link_name + 1, new_inum) == -1) {
-        inode_delete(new_inum);
+    if (add_dir_entry(ctx, root_dir_inode, link_name + 1, new_inum) == -1) {
+        inode_delete(ctx, new_inum);
         rwl_unlock(root_lock);
         return -1;
     }
@@ -245,20 +393,28 @@ int tfs_sym_link(char const *target, char const *link_name) {
     return 0;
 }
 
-int tfs_link(char const *target, char const *link_name) {
+int tfs_ctx_sym_link(tfs_ctx_t *ctx, char const *target,
+                     char const *link_name) {
+    STATS_START(start);
+    int result = do_sym_link(state_ctx_get(ctx), target, link_name);
+    STATS_STOP(STATS_SYM_LINK, start);
+    return result;
+}
+
+static int do_link(tfs_ctx_t *ctx, char const *target, char const *link_name) {
     // check if link_name is valid
-    if (!valid_pathname(link_name)) {
+    if (!valid_pathname(link_name) || state_read_only(ctx)) {
         return -1;
     }
 
     // root directory inode
-    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
-    pthread_rwlock_t *root_lock = inode_rwl_get(ROOT_DIR_INUM);
+    inode_t *root_dir_inode = inode_get(ctx, ROOT_DIR_INUM);
+    pthread_rwlock_t *root_lock = inode_rwl_get(ctx, ROOT_DIR_INUM);
 
     // lock root inode to deny changes to dir mid operation
     rwl_wrlock(root_lock);
 
-    int target_inumber = tfs_lookup(target, root_dir_inode);
+    int target_inumber = tfs_lookup(ctx, target, root_dir_inode);
     // target doesn't exist
     if (target_inumber == -1) {
         rwl_unlock(root_lock);
@@ -266,13 +422,13 @@ int tfs_link(char const *target, char const *link_name) {
     }
 
     // check if a file with link_name already exists
-    if (tfs_lookup(link_name, root_dir_inode) != -1) {
+    if (tfs_lookup(ctx, link_name, root_dir_inode) != -1) {
         rwl_unlock(root_lock);
         return -1;
     }
 
-    inode_t *target_inode = inode_get(target_inumber);
-    pthread_rwlock_t *target_inode_lock = inode_rwl_get(target_inumber);
+    inode_t *target_inode = inode_get(ctx, target_inumber);
+    pthread_rwlock_t *target_inode_lock = inode_rwl_get(ctx, target_inumber);
 
     // lock target file inode
     rwl_wrlock(target_inode_lock);
@@ -285,7 +441,8 @@ int tfs_link(char const *target, char const *link_name) {
     }
 
     // add link to dir entry and returns error value if no entries left on dir
-    if (add_dir_entry(root_dir_inode, link_name + 1, target_inumber) == -1) {
+    if (add_dir_entry(ctx, root_dir_inode, link_name + 1,
+                      target_inumber) == -1) {
         rwl_unlock(target_inode_lock);
         rwl_unlock(root_lock);
         return -1;
@@ -300,215 +457,1312 @@ int tfs_link(char const *target, char const *link_name) {
     return 0;
 }
 
-int tfs_close(int fhandle) {
-    // Get the open file table entry
-    open_file_entry_t *file = get_open_file_entry(fhandle);
-    // If the file is not open, return an error
-    if (file == NULL) {
+int tfs_ctx_link(tfs_ctx_t *ctx, char const *target, char const *link_name) {
+    STATS_START(start);
+    int result = do_link(state_ctx_get(ctx), target, link_name);
+    STATS_STOP(STATS_LINK, start);
+    return result;
+}
+
+static int do_clone_file(tfs_ctx_t *ctx, char const *source, char const *dest) {
+    if (!valid_pathname(dest) || state_read_only(ctx)) {
         return -1;
     }
-    // If the file is open, remove it from the open file table
-    remove_from_open_file_table(fhandle);
 
-    return 0;
-}
+    inode_t *root_dir_inode = inode_get(ctx, ROOT_DIR_INUM);
+    pthread_rwlock_t *root_lock = inode_rwl_get(ctx, ROOT_DIR_INUM);
 
-ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
-    // Get the open file table entry
-    open_file_entry_t *file = get_open_file_entry(fhandle);
-    // If the file is not open, return an error
-    if (file == NULL) {
+    // lock root inode to deny changes to dir mid operation
+    rwl_wrlock(root_lock);
+
+    int source_inumber = tfs_lookup(ctx, source, root_dir_inode);
+    if (source_inumber == -1 || tfs_lookup(ctx, dest, root_dir_inode) != -1) {
+        rwl_unlock(root_lock);
         return -1;
     }
 
-    // lock open file entry
-    mutex_lock(&file->lock);
+    inode_t *source_inode = inode_get(ctx, source_inumber);
+    pthread_rwlock_t *source_lock = inode_rwl_get(ctx, source_inumber);
 
-    //  From the open file table entry, we get the inode
-    inode_t *inode = inode_get(file->of_inumber);
-    // in this implementation we cannot close opened files
-    // // ALWAYS_ASSERT(inode != NULL, "tfs_write: inode of open file deleted");
+    // no write can be halfway through the source while it is cloned
+    rwl_wrlock(source_lock);
+    if (source_inode->i_node_type != T_FILE) {
+        rwl_unlock(source_lock);
+        rwl_unlock(root_lock);
+        return -1;
+    }
 
-    // lock inode to avoid changes mid write
-    pthread_rwlock_t *inode_lock = inode_rwl_get(file->of_inumber);
-    rwl_wrlock(inode_lock);
+    int dest_inumber = inode_create(ctx, T_FILE);
+    if (dest_inumber == -1) {
+        rwl_unlock(source_lock);
+        rwl_unlock(root_lock);
+        return -1; // no space in inode table
+    }
 
-    // Determine how many bytes to write
-    size_t block_size = state_block_size();
-    if (to_write + file->of_offset > block_size) {
-        to_write = block_size - file->of_offset;
+    // the clone is only reachable once it has all of its blocks
+    if (inode_clone(ctx, source_inode, inode_get(ctx, dest_inumber)) == -1 ||
+        add_dir_entry(ctx, root_dir_inode, dest + 1, dest_inumber) == -1) {
+        inode_delete(ctx, dest_inumber);
+        rwl_unlock(source_lock);
+        rwl_unlock(root_lock);
+        return -1;
     }
 
-    if (to_write > 0) {
-        if (inode->i_size == 0) {
-            // If empty file, allocate new block
-            int bnum = data_block_alloc();
-            if (bnum == -1) {
-                rwl_unlock(inode_lock);
-                mutex_unlock(&file->lock);
-                return -1; // no space
-            }
+    rwl_unlock(source_lock);
+    rwl_unlock(root_lock);
+
+    return 0;
+}
+
+int tfs_ctx_clone_file(tfs_ctx_t *ctx, char const *source, char const *dest) {
+    STATS_START(start);
+    int result = do_clone_file(state_ctx_get(ctx), source, dest);
+    STATS_STOP(STATS_CLONE_FILE, start);
+    return result;
+}
+
+/**
+ * Write to the data blocks of a file, allocating the blocks that are written
+ * to for the first time (skipped blocks are left unallocated, as holes).
+ *
+ * In compressed files, a block is compressed once its last byte is written,
+ * and decompressed again if it is written to afterwards. Likewise, with
+ * deduplication on, full blocks are shared with blocks of the same contents,
+ * and copied again before being modified.
+ *
+ * Must be called with the inode's lock held for writing, or held for reading
+ * with the blocks written to locked for writing (see write_range).
+ *
+ * Returns the number of bytes written, which is lower than len if the data
+ * blocks ran out.
+ */
+static size_t write_blocks(tfs_ctx_t *ctx, inode_t *inode, size_t offset,
+                           void const *buffer, size_t len) {
+    size_t block_size = state_block_size(ctx);
+    size_t written = 0;
+
+    while (written < len) {
+        size_t index = (offset + written) / block_size;
+        size_t block_offset = (offset + written) % block_size;
+        size_t chunk = block_size - block_offset;
+        if (chunk > len - written) {
+            chunk = len - written;
+        }
+
+        int resident = inode_block_resident(ctx, inode, index);
+        if (resident == -1 && inode->i_data_blocks[index] != -1) {
+            break; // could not be brought back from the spill file
+        }
+        if (resident == -1 && inode_block_alloc(ctx, inode, index) == -1) {
+            break; // no space
+        }
+
+        if (inode->i_zlengths[index] != 0 &&
+            inode_block_decompress(ctx, inode, index) == -1) {
+            break; // no space
+        }
 
-            inode->i_data_block = bnum;
+        if (inode_block_unshare(ctx, inode, index) == -1) {
+            break; // no space
         }
 
-        void *block = data_block_get(inode->i_data_block);
-        // if data block delete befored acquiring lock
+        // unless it is overwritten, the block is verified before changing it
+        int block_number = inode->i_data_blocks[index];
+        char *block = data_block_get_mut(ctx, block_number,
+                                         chunk == block_size);
         if (block == NULL) {
-            rwl_unlock(inode_lock);
-            mutex_unlock(&file->lock);
-            return -1;
+            break; // corrupted
+        }
+        memcpy(block + block_offset, (char const *)buffer + written, chunk);
+        data_block_put_mut(ctx, block_number);
+        written += chunk;
+
+        if (block_offset + chunk == block_size) {
+            // block is full, left as is if it does not compress (or is unique)
+            if (inode->i_compressed) {
+                inode_block_compress(ctx, inode, index);
+            } else {
+                inode_block_dedup(ctx, inode, index);
+            }
         }
+    }
 
-        // Perform the actual write
-        memcpy(block + file->of_offset, buffer, to_write);
+    return written;
+}
 
-        // The offset associated with the file handle is incremented accordingly
-        file->of_offset += to_write;
-        if (file->of_offset > inode->i_size) {
-            inode->i_size = file->of_offset;
+/**
+ * Read from the data blocks of a file, holes read as zeros.
+ *
+ * Must be called with the inode's lock held for writing, or held for reading
+ * with the blocks read locked (for reading, at least).
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int read_blocks(tfs_ctx_t *ctx, inode_t *inode, size_t offset,
+                       void *buffer, size_t len) {
+    size_t block_size = state_block_size(ctx);
+    size_t done = 0;
+
+    while (done < len) {
+        size_t index = (offset + done) / block_size;
+        size_t block_offset = (offset + done) % block_size;
+        size_t chunk = block_size - block_offset;
+        if (chunk > len - done) {
+            chunk = len - done;
+        }
+
+        if (inode->i_data_blocks[index] == -1) {
+            memset((char *)buffer + done, 0, chunk);
+        } else if (inode->i_zlengths[index] != 0) {
+            if (inode_block_read(ctx, inode, index, block_offset,
+                                 (char *)buffer + done, chunk) == -1) {
+                return -1;
+            }
+        } else {
+            char *block =
+                data_block_get(ctx, inode_block_resident(ctx, inode, index));
+            // block was deleted before acquiring the inode lock, or could not
+            // be brought back from the spill file
+            if (block == NULL) {
+                return -1;
+            }
+            memcpy((char *)buffer + done, block + block_offset, chunk);
         }
+        done += chunk;
     }
 
-    rwl_unlock(inode_lock);
-    mutex_unlock(&file->lock);
+    return 0;
+}
 
-    return (ssize_t)to_write;
+/**
+ * Lock the byte range of the blocks a read or write of a file touches.
+ *
+ * Returns the slot of the range, to release it with.
+ */
+static int lock_blocks(tfs_ctx_t *ctx, range_lock_t *ranges, size_t offset,
+                       size_t len, bool writer) {
+    size_t block_size = state_block_size(ctx);
+    size_t start = offset / block_size * block_size;
+    size_t end = (offset + len + block_size - 1) / block_size * block_size;
+
+    return range_lock_acquire(ranges, start, end, writer);
 }
 
-ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
-    // Get the open file table entry
-    open_file_entry_t *file = get_open_file_entry(fhandle);
-    // If the file is not open, return an error
-    if (file == NULL) {
+/**
+ * Write to the data blocks of a file locking only the blocks written to, so
+ * that writes to disjoint parts of the file run in parallel.
+ *
+ * Files kept in their inode (or that would be) and compressed files, whose
+ * blocks are packed together, are left to the exclusive path of do_write.
+ *
+ * Must be called with the inode's lock held for reading.
+ *
+ * Returns the number of bytes written (0 if there was no space), or -1 if the
+ * inode's lock must be held for writing instead.
+ */
+static ssize_t write_range(tfs_ctx_t *ctx, inode_t *inode, range_lock_t *ranges,
+                           size_t offset, void const *buffer, size_t len) {
+    size_t size = __atomic_load_n(&inode->i_size, __ATOMIC_ACQUIRE);
+    if (inode->i_inline || inode->i_compressed ||
+        (size == 0 && inode_fits_inline(ctx, inode, offset + len))) {
         return -1;
     }
 
-    // lock open file entry
-    mutex_lock(&file->lock);
+    int slot = lock_blocks(ctx, ranges, offset, len, true);
+    size_t written = write_blocks(ctx, inode, offset, buffer, len);
 
-    // cannot delete open file in this implementation
-    // // ALWAYS_ASSERT(inode != NULL, "tfs_read: inode of open file deleted");
+    // other writers may be growing the file too, the size only goes up
+    size_t end = offset + written;
+    while (written > 0 && end > size &&
+           !__atomic_compare_exchange_n(&inode->i_size, &size, end, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+    }
+    range_lock_release(ranges, slot);
 
-    // From the open file table entry, we get the inode
-    inode_t *inode = inode_get(file->of_inumber);
-    // lock inode to avoid changes mid read
-    pthread_rwlock_t *inode_lock = inode_rwl_get(file->of_inumber);
-    rwl_rdlock(inode_lock);
+    return (ssize_t)written;
+}
 
-    // Determine how many bytes to read
-    size_t to_read = inode->i_size - file->of_offset;
-    if (to_read > len) {
-        to_read = len;
+/**
+ * Append to the data blocks of a file without its handle's lock, so appends
+ * to the same file (through the same handle or not) run in parallel.
+ *
+ * Space is reserved past the end of the file with an atomic compare-and-swap
+ * on i_reserved, and the data copied in locking only the blocks written to.
+ * The size is then moved past the append, once every append reserved before
+ * it is in too, so readers (which stop at the size) never see a partial one.
+ *
+ * Falls back to the exclusive path of do_write in the same cases as
+ * write_range.
+ *
+ * Must be called with the inode's lock held for reading.
+ *
+ * Returns the number of bytes appended (0 if there was no space), or -1 if the
+ * inode's lock must be held for writing instead. The end of the append is
+ * stored in end.
+ */
+static ssize_t append_range(tfs_ctx_t *ctx, inode_t *inode,
+                            range_lock_t *ranges, void const *buffer,
+                            size_t len, size_t *end) {
+    size_t size = __atomic_load_n(&inode->i_size, __ATOMIC_ACQUIRE);
+    if (inode->i_inline || inode->i_compressed ||
+        (size == 0 && inode_fits_inline(ctx, inode, len))) {
+        return -1;
     }
 
-    if (to_read > 0) {
-        void *block = data_block_get(inode->i_data_block);
-        // block was deleted before acquiring the inode lock
-        if (block == NULL) {
-            rwl_unlock(inode_lock);
-            mutex_unlock(&file->lock);
-            return -1;
+    // writes through other handles may have grown the file past the space
+    // handed out to appends
+    size_t max_size = state_max_file_size(ctx);
+    size_t reserved = __atomic_load_n(&inode->i_reserved, __ATOMIC_RELAXED);
+    size_t start;
+    size_t stop;
+    do {
+        start = reserved > size ? reserved : size;
+        if (start >= max_size) {
+            *end = start;
+            return 0; // the file is full
         }
-
-        // Perform the actual read
-        memcpy(buffer, block + file->of_offset, to_read);
-        // The offset associated with the file handle is incremented accordingly
-        file->of_offset += to_read;
+        stop = start + (len < max_size - start ? len : max_size - start);
+        size = __atomic_load_n(&inode->i_size, __ATOMIC_ACQUIRE);
+    } while (!__atomic_compare_exchange_n(&inode->i_reserved, &reserved, stop,
+                                          true, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED));
+
+    int slot = lock_blocks(ctx, ranges, start, stop - start, true);
+    size_t written = write_blocks(ctx, inode, start, buffer, stop - start);
+    range_lock_release(ranges, slot);
+
+    // hand back the space that was not written to, unless a later append has
+    // already reserved past it (which leaves it as a hole)
+    size_t expected = stop;
+    if (written < stop - start &&
+        __atomic_compare_exchange_n(&inode->i_reserved, &expected,
+                                    start + written, false, __ATOMIC_RELAXED,
+                                    __ATOMIC_RELAXED)) {
+        stop = start + written;
     }
 
-    rwl_unlock(inode_lock);
-    mutex_unlock(&file->lock);
+    // publish in reservation order, the earlier appends are still being
+    // copied while the size is behind this one
+    size = __atomic_load_n(&inode->i_size, __ATOMIC_ACQUIRE);
+    while (size < start) {
+        sched_yield();
+        size = __atomic_load_n(&inode->i_size, __ATOMIC_ACQUIRE);
+    }
+    while (stop > size &&
+           !__atomic_compare_exchange_n(&inode->i_size, &size, stop, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+    }
 
-    return (ssize_t)to_read;
+    *end = start + written;
+    return (ssize_t)written;
 }
 
-int tfs_unlink(char const *target) {
-    // root directory inode
-    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
-    pthread_rwlock_t *root_lock = inode_rwl_get(ROOT_DIR_INUM);
+/**
+ * Number of bytes of a write at an offset that fit in a file.
+ */
+static size_t write_len(tfs_ctx_t *ctx, size_t offset, size_t len) {
+    size_t max_size = state_max_file_size(ctx);
+    if (offset >= max_size) {
+        return 0;
+    }
 
-    // lock root directory to avoid changes mid operation
-    rwl_wrlock(root_lock);
+    return len < max_size - offset ? len : max_size - offset;
+}
 
-    int target_inum = tfs_lookup(target, root_dir_inode);
-    // target doesn't exist or has invalid name
-    if (target_inum == -1) {
-        rwl_unlock(root_lock);
-        return -1;
+/**
+ * Write to an open file, at its offset (or at its end, in append mode).
+ *
+ * Returns the number of bytes written, or -1 in case of error.
+ */
+static ssize_t file_write(tfs_ctx_t *ctx, open_file_entry_t *file,
+                          void const *buffer, size_t to_write) {
+    //  From the open file table entry, we get the inode
+    inode_t *inode = inode_get(ctx, file->of_inumber);
+    // in this implementation we cannot close opened files
+    // // ALWAYS_ASSERT(inode != NULL, "tfs_write: inode of open file deleted");
+    pthread_rwlock_t *inode_lock = inode_rwl_get(ctx, file->of_inumber);
+    range_lock_t *ranges = inode_range_lock_get(ctx, file->of_inumber);
+
+    if (file->of_append && to_write > 0) {
+        // appends do not depend on the handle's offset, nor take its lock
+        size_t end;
+        rwl_rdlock(inode_lock);
+        ssize_t appended = append_range(ctx, inode, ranges, buffer, to_write,
+                                        &end);
+        rwl_unlock(inode_lock);
+
+        if (appended != -1) {
+            __atomic_store_n(&file->of_offset, end, __ATOMIC_RELAXED);
+            if (appended == 0 && end < state_max_file_size(ctx)) {
+                return -1; // no space
+            }
+            return appended;
+        }
     }
 
-    // get target's inode
-    inode_t *target_inode = inode_get(target_inum);
+    // lock open file entry
+    mutex_lock(&file->lock);
 
-    // if file is opened, do not allow unlink
-    // symlinks are never in the open file table
-    if ((target_inode->i_node_type != T_LINK) &&
-        (is_in_open_file_table(target_inum))) {
-        rwl_unlock(root_lock);
-        return -1;
+    size_t len = write_len(ctx, file->of_offset, to_write);
+    if (!file->of_append && len > 0) {
+        // most writes only need the blocks they touch
+        rwl_rdlock(inode_lock);
+        ssize_t written =
+            write_range(ctx, inode, ranges, file->of_offset, buffer, len);
+        rwl_unlock(inode_lock);
+
+        if (written != -1) {
+            file->of_offset += (size_t)written;
+            mutex_unlock(&file->lock);
+            return written == 0 ? -1 : written; // no space
+        }
     }
 
-    // remove target entry in directory
-    if (clear_dir_entry(root_dir_inode, target + 1) == -1) {
-        rwl_unlock(root_lock);
-        return -1;
+    // lock inode to avoid changes mid write
+    int slot = lock_inode(ctx, file->of_inumber, true);
+
+    if (file->of_append) {
+        file->of_offset = inode->i_size; // no append is in progress
     }
 
-    // lock file's inode
-    pthread_rwlock_t *target_rwl = inode_rwl_get(target_inum);
-    rwl_wrlock(target_rwl);
-    // if no more links, free inode
-    if (target_inode->i_links_count == 1) {
-        // if other thread deleted this inode
-        if (inode_delete(target_inum) == -1) {
-            rwl_unlock(root_lock);
-            return -1;
+    // Determine how many bytes to write
+    to_write = write_len(ctx, file->of_offset, to_write);
+
+    if (to_write > 0) {
+        size_t end = file->of_offset + to_write;
+
+        if (inode->i_size == 0 && inode_fits_inline(ctx, inode, end)) {
+            // Tiny files are kept in the inode until they outgrow it
+            memset(inode->i_inline_data, 0, INODE_INLINE_SIZE);
+            inode->i_inline = true;
+        } else if (inode->i_inline && !inode_fits_inline(ctx, inode, end)) {
+            // Inline file grew too big, move its contents to a data block
+            if (inode_promote_inline(ctx, inode) == -1) {
+                unlock_inode(ctx, file->of_inumber, slot);
+                mutex_unlock(&file->lock);
+                return -1; // no space
+            }
+        }
+
+        // Perform the actual write
+        if (inode->i_inline) {
+            memcpy(inode->i_inline_data + file->of_offset, buffer, to_write);
+        } else {
+            to_write = write_blocks(ctx, inode, file->of_offset, buffer,
+                                    to_write);
+            if (to_write == 0) {
+                unlock_inode(ctx, file->of_inumber, slot);
+                mutex_unlock(&file->lock);
+                return -1; // no space
+            }
+        }
+
+        // The offset associated with the file handle is incremented accordingly
+        file->of_offset += to_write;
+        if (file->of_offset > inode->i_size) {
+            inode->i_size = file->of_offset;
         }
-    } else {
-        target_inode->i_links_count--;
     }
 
-    rwl_unlock(target_rwl);
-    rwl_unlock(root_lock);
-    return 0;
+    unlock_inode(ctx, file->of_inumber, slot);
+    mutex_unlock(&file->lock);
+
+    return (ssize_t)to_write;
 }
 
-int tfs_copy_from_external_fs(char const *source_path, char const *dest_path) {
+/**
+ * Write the buffered writes of a TFS_O_BUFFERED handle to its file.
+ *
+ * Must be called with the handle's buffer lock held.
+ *
+ * Returns 0 if successful, -1 otherwise (the buffered writes are dropped).
+ */
+static int buffer_flush(tfs_ctx_t *ctx, open_file_entry_t *file) {
+    size_t len = file->of_wbuf_len;
+    if (len == 0) {
+        return 0;
+    }
+
+    file->of_wbuf_len = 0;
+    return file_write(ctx, file, file->of_wbuf, len) == (ssize_t)len ? 0 : -1;
+}
+
+static uint64_t buffer_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * Write through the buffer of a TFS_O_BUFFERED handle: the data is copied to
+ * the buffer, which is written to the file once it fills up or its oldest data
+ * is WRITE_BUFFER_AGE_MS old. Writes larger than the buffer go straight to the
+ * file (after what is buffered).
+ *
+ * Must be called with the handle's buffer lock held.
+ *
+ * Returns the number of bytes written (or buffered), or -1 if writing the
+ * buffer to the file failed.
+ */
+static ssize_t buffer_write(tfs_ctx_t *ctx, open_file_entry_t *file,
+                            void const *buffer, size_t len) {
+    if (file->of_wbuf_len + len > WRITE_BUFFER_SIZE &&
+        buffer_flush(ctx, file) == -1) {
+        return -1;
+    }
+
+    if (file->of_wbuf == NULL) {
+        file->of_wbuf = malloc(WRITE_BUFFER_SIZE);
+    }
+    if (len > WRITE_BUFFER_SIZE || file->of_wbuf == NULL) {
+        return file_write(ctx, file, buffer, len);
+    }
+
+    uint64_t now = buffer_clock();
+    if (file->of_wbuf_len == 0) {
+        file->of_wbuf_since = now;
+    }
+    memcpy(file->of_wbuf + file->of_wbuf_len, buffer, len);
+    file->of_wbuf_len += len;
+
+    if ((file->of_wbuf_len == WRITE_BUFFER_SIZE ||
+         now - file->of_wbuf_since >= WRITE_BUFFER_AGE_MS * 1000000) &&
+        buffer_flush(ctx, file) == -1) {
+        return -1;
+    }
+
+    return (ssize_t)len;
+}
+
+static ssize_t do_write(tfs_ctx_t *ctx, int fhandle, void const *buffer,
+                        size_t to_write) {
+    // Get the open file table entry
+    open_file_entry_t *file = get_open_file_entry(ctx, fhandle);
+    // If the file is not open (or the FS can only be read), return an error
+    if (file == NULL || state_read_only(ctx)) {
+        return -1;
+    }
+
+    if (!file->of_buffered) {
+        return file_write(ctx, file, buffer, to_write);
+    }
+
+    mutex_lock(&file->of_wbuf_lock);
+    ssize_t result = buffer_write(ctx, file, buffer, to_write);
+    mutex_unlock(&file->of_wbuf_lock);
+
+    return result;
+}
+
+/**
+ * Write what a handle has buffered to its file, so that the operations that
+ * follow through it see it.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int handle_flush(tfs_ctx_t *ctx, open_file_entry_t *file) {
+    if (!file->of_buffered) {
+        return 0;
+    }
+
+    mutex_lock(&file->of_wbuf_lock);
+    int result = buffer_flush(ctx, file);
+    mutex_unlock(&file->of_wbuf_lock);
+
+    return result;
+}
+
+static int do_flush(tfs_ctx_t *ctx, int fhandle) {
+    open_file_entry_t *file = get_open_file_entry(ctx, fhandle);
+    if (file == NULL) {
+        return -1;
+    }
+
+    return handle_flush(ctx, file);
+}
+
+int tfs_ctx_flush(tfs_ctx_t *ctx, int fhandle) {
+    STATS_START(start);
+    int result = do_flush(state_ctx_get(ctx), fhandle);
+    STATS_STOP(STATS_FLUSH, start);
+    return result;
+}
+
+static int do_close(tfs_ctx_t *ctx, int fhandle) {
+    // Get the open file table entry
+    open_file_entry_t *file = get_open_file_entry(ctx, fhandle);
+    // If the file is not open, return an error
+    if (file == NULL) {
+        return -1;
+    }
+
+    // Write what is still buffered, then drop the buffer
+    int result = 0;
+    if (file->of_buffered) {
+        mutex_lock(&file->of_wbuf_lock);
+        result = buffer_flush(ctx, file);
+        free(file->of_wbuf);
+        file->of_wbuf = NULL;
+        mutex_unlock(&file->of_wbuf_lock);
+    }
+
+    // If the file is open, remove it from the open file table
+    remove_from_open_file_table(ctx, fhandle);
+
+    return result;
+}
+
+int tfs_ctx_close(tfs_ctx_t *ctx, int fhandle) {
+    STATS_START(start);
+    int result = do_close(state_ctx_get(ctx), fhandle);
+    STATS_STOP(STATS_CLOSE, start);
+    return result;
+}
+
+ssize_t tfs_ctx_write(tfs_ctx_t *ctx, int fhandle, void const *buffer,
+                      size_t to_write) {
+    STATS_START(start);
+    ssize_t result = do_write(state_ctx_get(ctx), fhandle, buffer, to_write);
+    STATS_STOP(STATS_WRITE, start);
+    return result;
+}
+
+/**
+ * Read ahead of the sequential reads through a handle: after a read that
+ * starts where the previous one ended, the blocks that follow it are queued
+ * for the read-ahead thread. The window starts at one block and doubles with
+ * every sequential read (up to readahead_blocks), any other read closes it.
+ *
+ * Must be called with the handle's lock and the inode's lock (for reading, at
+ * least) held, after reading len bytes at offset of a file of a given size.
+ */
+static void read_ahead(tfs_ctx_t *ctx, open_file_entry_t *file,
+                       inode_t const *inode, range_lock_t *ranges,
+                       size_t offset, size_t len, size_t size) {
+    size_t max_window = state_readahead_blocks(ctx);
+    if (max_window == 0) {
+        return;
+    }
+
+    bool sequential = offset == file->of_ra_next;
+    file->of_ra_next = offset + len;
+    if (!sequential) {
+        file->of_ra_window = 0;
+        return;
+    }
+    file->of_ra_window = file->of_ra_window == 0 ? 1 : file->of_ra_window * 2;
+    if (file->of_ra_window > max_window) {
+        file->of_ra_window = max_window;
+    }
+
+    // from the block the next read starts in (read again if this one ended
+    // in the middle of it), without going past the end of the file
+    size_t block_size = state_block_size(ctx);
+    size_t first = (offset + len) / block_size;
+    size_t last = (size + block_size - 1) / block_size;
+    if (last > first + file->of_ra_window) {
+        last = first + file->of_ra_window;
+    }
+    if (first >= last) {
+        return;
+    }
+
+    int slot = range_lock_acquire(ranges, first * block_size,
+                                  last * block_size, false);
+    for (size_t index = first; index < last; index++) {
+        // holes are skipped, compressed chunks have their own cache
+        if (inode->i_zlengths[index] == 0) {
+            data_block_prefetch(ctx, inode->i_data_blocks[index]);
+        }
+    }
+    range_lock_release(ranges, slot);
+}
+
+static ssize_t do_read(tfs_ctx_t *ctx, int fhandle, void *buffer, size_t len) {
+    // Get the open file table entry
+    open_file_entry_t *file = get_open_file_entry(ctx, fhandle);
+    // If the file is not open, return an error
+    if (file == NULL || handle_flush(ctx, file) == -1) {
+        return -1;
+    }
+
+    // lock open file entry
+    mutex_lock(&file->lock);
+
+    // cannot delete open file in this implementation
+    // // ALWAYS_ASSERT(inode != NULL, "tfs_read: inode of open file deleted");
+
+    // From the open file table entry, we get the inode
+    inode_t *inode = inode_get(ctx, file->of_inumber);
+    // lock inode to avoid changes mid read
+    int inode_slot = lock_inode(ctx, file->of_inumber, false);
+
+    // Determine how many bytes to read (the offset may be past the end), the
+    // file may be growing with writes that only hold the blocks they touch
+    size_t size = __atomic_load_n(&inode->i_size, __ATOMIC_ACQUIRE);
+    size_t to_read = 0;
+    if (file->of_offset < size) {
+        to_read = size - file->of_offset;
+    }
+    if (to_read > len) {
+        to_read = len;
+    }
+
+    if (to_read > 0) {
+        // Perform the actual read
+        if (inode->i_inline) {
+            memcpy(buffer, inode->i_inline_data + file->of_offset, to_read);
+        } else {
+            // no write to the blocks read is seen halfway
+            range_lock_t *ranges = inode_range_lock_get(ctx, file->of_inumber);
+            int slot = lock_blocks(ctx, ranges, file->of_offset, to_read,
+                                   false);
+            int result = read_blocks(ctx, inode, file->of_offset, buffer,
+                                     to_read);
+            range_lock_release(ranges, slot);
+            if (result == -1) {
+                unlock_inode(ctx, file->of_inumber, inode_slot);
+                mutex_unlock(&file->lock);
+                return -1;
+            }
+
+            read_ahead(ctx, file, inode, ranges, file->of_offset, to_read,
+                       size);
+        }
+
+        // The offset associated with the file handle is incremented accordingly
+        file->of_offset += to_read;
+    }
+
+    unlock_inode(ctx, file->of_inumber, inode_slot);
+    mutex_unlock(&file->lock);
+
+    return (ssize_t)to_read;
+}
+
+ssize_t tfs_ctx_read(tfs_ctx_t *ctx, int fhandle, void *buffer, size_t len) {
+    STATS_START(start);
+    ssize_t result = do_read(state_ctx_get(ctx), fhandle, buffer, len);
+    STATS_STOP(STATS_READ, start);
+    return result;
+}
+
+/**
+ * Find the first offset, at or after a given one, that is backed by a data
+ * block (data) or is not (hole). The end of the file counts as a hole.
+ *
+ * Returns the offset found, or -1 if offset is not inside the file or there is
+ * no data after it.
+ */
+static off_t seek_data_or_hole(tfs_ctx_t *ctx, inode_t const *inode,
+                               size_t offset, bool data) {
+    if (offset >= inode->i_size) {
+        return -1;
+    }
+
+    if (inode->i_inline) {
+        return data ? (off_t)offset : (off_t)inode->i_size;
+    }
+
+    size_t block_size = state_block_size(ctx);
+    for (size_t pos = offset; pos < inode->i_size;
+         pos = (pos / block_size + 1) * block_size) {
+        bool allocated = inode->i_data_blocks[pos / block_size] != -1;
+        if (allocated == data) {
+            return (off_t)pos;
+        }
+    }
+
+    return data ? -1 : (off_t)inode->i_size;
+}
+
+/**
+ * Position a given offset away from a base (the handle's offset or the file's
+ * size).
+ *
+ * Returns the position, or -1 if it is negative or does not fit in an off_t.
+ */
+static off_t seek_from(size_t base, off_t offset) {
+    off_t max = (off_t)(((uint64_t)1 << (sizeof(off_t) * CHAR_BIT - 1)) - 1);
+    if ((uint64_t)base > (uint64_t)max ||
+        (offset > 0 && offset > max - (off_t)base)) {
+        return -1;
+    }
+
+    off_t position = (off_t)base + offset;
+    return position >= 0 ? position : -1;
+}
+
+static off_t do_lseek(tfs_ctx_t *ctx, int fhandle, off_t offset,
+                      tfs_seek_whence_t whence) {
+    // Get the open file table entry
+    open_file_entry_t *file = get_open_file_entry(ctx, fhandle);
+    // If the file is not open, return an error
+    if (file == NULL || handle_flush(ctx, file) == -1) {
+        return -1;
+    }
+
+    // lock open file entry
+    mutex_lock(&file->lock);
+
+    // lock inode (and the whole file, to wait for ongoing writes) to get a
+    // consistent size and block map
+    inode_t *inode = inode_get(ctx, file->of_inumber);
+    range_lock_t *ranges = inode_range_lock_get(ctx, file->of_inumber);
+    int inode_slot = lock_inode(ctx, file->of_inumber, false);
+    int slot = range_lock_acquire(ranges, 0, SIZE_MAX, false);
+
+    off_t position = -1;
+    switch (whence) {
+    case TFS_SEEK_SET:
+        position = offset;
+        break;
+    case TFS_SEEK_CUR:
+        position = seek_from(file->of_offset, offset);
+        break;
+    case TFS_SEEK_END:
+        position = seek_from(inode->i_size, offset);
+        break;
+    case TFS_SEEK_DATA:
+        if (offset >= 0) {
+            position = seek_data_or_hole(ctx, inode, (size_t)offset, true);
+        }
+        break;
+    case TFS_SEEK_HOLE:
+        if (offset >= 0) {
+            position = seek_data_or_hole(ctx, inode, (size_t)offset, false);
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (position >= 0) {
+        file->of_offset = (size_t)position;
+    } else {
+        position = -1;
+    }
+
+    range_lock_release(ranges, slot);
+    unlock_inode(ctx, file->of_inumber, inode_slot);
+    mutex_unlock(&file->lock);
+
+    return position;
+}
+
+off_t tfs_ctx_lseek(tfs_ctx_t *ctx, int fhandle, off_t offset,
+                    tfs_seek_whence_t whence) {
+    STATS_START(start);
+    off_t result = do_lseek(state_ctx_get(ctx), fhandle, offset, whence);
+    STATS_STOP(STATS_LSEEK, start);
+    return result;
+}
+
+static int do_unlink(tfs_ctx_t *ctx, char const *target) {
+    if (state_read_only(ctx)) {
+        return -1;
+    }
+
+    // root directory inode
+    inode_t *root_dir_inode = inode_get(ctx, ROOT_DIR_INUM);
+    pthread_rwlock_t *root_lock = inode_rwl_get(ctx, ROOT_DIR_INUM);
+
+    // lock root directory to avoid changes mid operation
+    rwl_wrlock(root_lock);
+
+    int target_inum = tfs_lookup(ctx, target, root_dir_inode);
+    // target doesn't exist or has invalid name
+    if (target_inum == -1) {
+        rwl_unlock(root_lock);
+        return -1;
+    }
+
+    // get target's inode
+    inode_t *target_inode = inode_get(ctx, target_inum);
+
+    // remove target entry in directory
+    if (clear_dir_entry(ctx, root_dir_inode, target + 1) == -1) {
+        rwl_unlock(root_lock);
+        return -1;
+    }
+
+    // lock file's inode
+    pthread_rwlock_t *target_rwl = inode_rwl_get(ctx, target_inum);
+    rwl_wrlock(target_rwl);
+    bool last_link = target_inode->i_links_count == 1;
+    target_inode->i_links_count--;
+    rwl_unlock(target_rwl);
+
+    // if no more links, free inode (once its last handle is closed, if it is
+    // open), which fails if other thread deleted it
+    if (last_link && !inode_orphan(ctx, target_inum) &&
+        inode_delete(ctx, target_inum) == -1) {
+        rwl_unlock(root_lock);
+        return -1;
+    }
+
+    rwl_unlock(root_lock);
+    return 0;
+}
+
+int tfs_ctx_unlink(tfs_ctx_t *ctx, char const *target) {
+    STATS_START(start);
+    int result = do_unlink(state_ctx_get(ctx), target);
+    STATS_STOP(STATS_UNLINK, start);
+    return result;
+}
+
+static int do_stat(tfs_ctx_t *ctx, char const *name, tfs_stat_t *stat) {
+    if (name == NULL || stat == NULL) {
+        return -1;
+    }
+
+    inode_t *root_dir_inode = inode_get(ctx, ROOT_DIR_INUM);
+    if (root_dir_inode == NULL) {
+        return -1;
+    }
+
+    pthread_rwlock_t *root_dir_rwl = inode_rwl_get(ctx, ROOT_DIR_INUM);
+    rwl_rdlock(root_dir_rwl);
+    int inum = ROOT_DIR_INUM;
+    if (strcmp(name, "/") != 0) {
+        inum = tfs_lookup(ctx, name, root_dir_inode);
+        if (inum == -1) {
+            rwl_unlock(root_dir_rwl);
+            return -1;
+        }
+    }
+
+    inode_t *inode = inode_get(ctx, inum);
+    int inode_slot = -1;
+    if (inum != ROOT_DIR_INUM) {
+        // the root dir stays locked until the inode is, so that it is not
+        // unlinked (and its inode reused) in between
+        inode_slot = lock_inode(ctx, inum, false);
+        rwl_unlock(root_dir_rwl);
+    }
+
+    int result = 0;
+
+    switch (inode->i_node_type) {
+    case T_FILE:
+        stat->type = TFS_T_FILE;
+        break;
+    case T_DIRECTORY:
+        stat->type = TFS_T_DIRECTORY;
+        break;
+    case T_LINK:
+        stat->type = TFS_T_LINK;
+        break;
+    default:
+        result = -1;
+        break;
+    }
+
+    if (result == 0) {
+        // wait for ongoing writes, for a consistent size and block count
+        range_lock_t *ranges = inode_range_lock_get(ctx, inum);
+        int slot = range_lock_acquire(ranges, 0, SIZE_MAX, false);
+
+        stat->size = inode->i_size;
+        stat->links = inode->i_links_count;
+        stat->blocks = 0;
+        stat->spilled = 0;
+        if (!inode->i_inline) {
+            for (size_t i = 0; i < INODE_DIRECT_BLOCKS; i++) {
+                if (inode->i_data_blocks[i] >= 0) {
+                    stat->blocks++;
+                } else if (inode->i_data_blocks[i] != -1) {
+                    stat->spilled++; // CHUNK_SPILLED
+                }
+            }
+        }
+
+        range_lock_release(ranges, slot);
+    }
+
+    if (inum == ROOT_DIR_INUM) {
+        rwl_unlock(root_dir_rwl);
+    } else {
+        unlock_inode(ctx, inum, inode_slot);
+    }
+    return result;
+}
+
+int tfs_ctx_stat(tfs_ctx_t *ctx, char const *name, tfs_stat_t *stat) {
+    STATS_START(start);
+    int result = do_stat(state_ctx_get(ctx), name, stat);
+    STATS_STOP(STATS_STAT, start);
+    return result;
+}
+
+/**
+ * Directory listing: a snapshot of the directory entries and a cursor.
+ */
+struct tfs_dir {
+    dir_entry_t *entries;
+    size_t count;
+    size_t position;
+    tfs_dirent_t current;
+};
+
+static tfs_dir_t *do_opendir(tfs_ctx_t *ctx, char const *name) {
+    if (name == NULL || strcmp(name, "/") != 0) {
+        return NULL; // only the root directory exists
+    }
+
+    inode_t *root_dir_inode = inode_get(ctx, ROOT_DIR_INUM);
+    if (root_dir_inode == NULL) {
+        return NULL;
+    }
+
+    tfs_dir_t *dir = malloc(sizeof(tfs_dir_t));
+    if (dir == NULL) {
+        return NULL;
+    }
+
+    pthread_rwlock_t *root_dir_rwl = inode_rwl_get(ctx, ROOT_DIR_INUM);
+    rwl_rdlock(root_dir_rwl);
+    ssize_t count = dir_snapshot(ctx, root_dir_inode, &dir->entries);
+    rwl_unlock(root_dir_rwl);
+
+    if (count == -1) {
+        free(dir);
+        return NULL;
+    }
+
+    dir->count = (size_t)count;
+    dir->position = 0;
+    return dir;
+}
+
+tfs_dir_t *tfs_ctx_opendir(tfs_ctx_t *ctx, char const *name) {
+    STATS_START(start);
+    tfs_dir_t *result = do_opendir(state_ctx_get(ctx), name);
+    STATS_STOP(STATS_OPENDIR, start);
+    return result;
+}
+
+static tfs_dirent_t const *do_readdir(tfs_dir_t *dir) {
+    if (dir == NULL || dir->position == dir->count) {
+        return NULL;
+    }
+
+    dir_entry_t const *entry = &dir->entries[dir->position++];
+    memcpy(dir->current.name, entry->d_name, MAX_FILE_NAME);
+    dir->current.name[MAX_FILE_NAME - 1] = '\0';
+    dir->current.inumber = entry->d_inumber;
+
+    return &dir->current;
+}
+
+tfs_dirent_t const *tfs_readdir(tfs_dir_t *dir) {
+    STATS_START(start);
+    tfs_dirent_t const *result = do_readdir(dir);
+    STATS_STOP(STATS_READDIR, start);
+    return result;
+}
+
+int tfs_closedir(tfs_dir_t *dir) {
+    if (dir == NULL) {
+        return -1;
+    }
+
+    free(dir->entries);
+    free(dir);
+    return 0;
+}
+
+/**
+ * Strip the initial '/' from a batch of path names (invalid names become
+ * empty, which matches no directory entry).
+ *
+ * Returns a newly allocated array, or NULL if out of memory.
+ */
+static char const **batch_sub_names(char const *const *names, size_t count) {
+    char const **sub_names = malloc(count * sizeof(char const *));
+    if (sub_names == NULL) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        sub_names[i] = valid_pathname(names[i]) ? names[i] + 1 : "";
+    }
+
+    return sub_names;
+}
+
+static ssize_t do_create_many(tfs_ctx_t *ctx, char const *const *names,
+                              size_t count, int *results) {
+    if (((names == NULL || results == NULL) && count > 0) ||
+        state_read_only(ctx)) {
+        return -1;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    char const **sub_names = batch_sub_names(names, count);
+    if (sub_names == NULL) {
+        return -1;
+    }
+
+    inode_t *root_dir_inode = inode_get(ctx, ROOT_DIR_INUM);
+    pthread_rwlock_t *root_lock = inode_rwl_get(ctx, ROOT_DIR_INUM);
+
+    rwl_wrlock(root_lock);
+    size_t created =
+        dir_create_many(ctx, root_dir_inode, sub_names, count, results);
+    rwl_unlock(root_lock);
+
+    free(sub_names);
+    return (ssize_t)created;
+}
+
+ssize_t tfs_ctx_create_many(tfs_ctx_t *ctx, char const *const *names,
+                            size_t count, int *results) {
+    STATS_START(start);
+    ssize_t result = do_create_many(state_ctx_get(ctx), names, count, results);
+    STATS_STOP(STATS_CREATE_MANY, start);
+    return result;
+}
+
+static ssize_t do_unlink_many(tfs_ctx_t *ctx, char const *const *names,
+                              size_t count, int *results) {
+    if (((names == NULL || results == NULL) && count > 0) ||
+        state_read_only(ctx)) {
+        return -1;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    char const **sub_names = batch_sub_names(names, count);
+    if (sub_names == NULL) {
+        return -1;
+    }
+
+    inode_t *root_dir_inode = inode_get(ctx, ROOT_DIR_INUM);
+    pthread_rwlock_t *root_lock = inode_rwl_get(ctx, ROOT_DIR_INUM);
+
+    rwl_wrlock(root_lock);
+    size_t removed =
+        dir_unlink_many(ctx, root_dir_inode, sub_names, count, results);
+    rwl_unlock(root_lock);
+
+    free(sub_names);
+    return (ssize_t)removed;
+}
+
+ssize_t tfs_ctx_unlink_many(tfs_ctx_t *ctx, char const *const *names,
+                            size_t count, int *results) {
+    STATS_START(start);
+    ssize_t result = do_unlink_many(state_ctx_get(ctx), names, count, results);
+    STATS_STOP(STATS_UNLINK_MANY, start);
+    return result;
+}
+
+static int do_copy_from_external_fs(tfs_ctx_t *ctx, char const *source_path,
+                                    char const *dest_path) {
     // open source file
     FILE *file = fopen(source_path, "r");
     // problem opening source file
     if (file == NULL) {
         return -1;
     }
-    // buffer with 1025 bytes == block size + 1
-    char buffer[BLOCK_SIZE + 1];
+    // buffer of block size + 1 bytes (the block size is a parameter, so it is
+    // not put on the stack)
+    char *buffer = malloc(BLOCK_SIZE + 1);
+    if (buffer == NULL) {
+        fclose(file);
+        return -1;
+    }
     // read entire block size
     size_t bytes_read = fread(buffer, sizeof(*buffer), BLOCK_SIZE + 1, file);
     // problem reading the file or file size exceeds tfs block limit
     if (bytes_read == -1 || bytes_read > BLOCK_SIZE) {
+        free(buffer);
         fclose(file);
         return -1;
     }
 
     // redirect data to tfs
-    int fd = tfs_open(dest_path, TFS_O_TRUNC | TFS_O_CREAT);
+    int fd = tfs_ctx_open(ctx, dest_path, TFS_O_TRUNC | TFS_O_CREAT);
     // problem opening dest file in tfs
     if (fd == -1) {
+        free(buffer);
+        fclose(file);
         return -1;
     }
     // write to tfs
-    ssize_t bytes_size = tfs_write(fd, buffer, bytes_read);
+    ssize_t bytes_size = tfs_ctx_write(ctx, fd, buffer, bytes_read);
+    free(buffer);
     // problem writing to dest file in tfs
     if (bytes_size == -1) {
-        tfs_close(fd);
+        fclose(file);
+        tfs_ctx_close(ctx, fd);
         return -1;
     }
 
     // operations handled, just signals problems on closing files
-    if (fclose(file) == EOF || tfs_close(fd) == -1) {
+    if (fclose(file) == EOF || tfs_ctx_close(ctx, fd) == -1) {
         return -1;
     }
 
     return 0;
 }
+
+int tfs_ctx_copy_from_external_fs(tfs_ctx_t *ctx, char const *source_path,
+                                  char const *dest_path) {
+    STATS_START(start);
+    int result = do_copy_from_external_fs(state_ctx_get(ctx), source_path,
+                                          dest_path);
+    STATS_STOP(STATS_COPY_EXT, start);
+    return result;
+}
+
+int tfs_init(tfs_params const *params) {
+    return do_init(state_ctx_default(), params);
+}
+
+int tfs_destroy() { return do_destroy(state_ctx_default()); }
+
+tfs_ctx_t *tfs_ctx_init(tfs_params const *params) {
+    tfs_ctx_t *ctx = state_ctx_create();
+    if (ctx == NULL) {
+        return NULL;
+    }
+
+    if (do_init(ctx, params) != 0) {
+        state_ctx_free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+tfs_ctx_t *tfs_ctx_attach(char const *shm_name) {
+    if (shm_name == NULL) {
+        return NULL;
+    }
+
+    tfs_ctx_t *ctx = state_ctx_create();
+    if (ctx == NULL) {
+        return NULL;
+    }
+
+    if (state_attach(ctx, shm_name) != 0) {
+        state_ctx_free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+int tfs_ctx_destroy(tfs_ctx_t *ctx) {
+    if (ctx == NULL) {
+        return -1; // the default instance is destroyed with tfs_destroy
+    }
+
+    int ret = do_destroy(ctx);
+    if (ret == 0) {
+        state_ctx_free(ctx);
+    }
+
+    return ret;
+}
+
+/*
+ * The plain tfs_* functions run their tfs_ctx_* counterpart on the default
+ * instance.
+ */
+
+int tfs_grow(tfs_params const *params) {
+    return tfs_ctx_grow(state_ctx_default(), params);
+}
+
+size_t tfs_numa_stats(tfs_numa_node_stats_t *stats, size_t max_nodes) {
+    return tfs_ctx_numa_stats(state_ctx_default(), stats, max_nodes);
+}
+
+int tfs_compress_stats(tfs_compress_stats_t *stats) {
+    return tfs_ctx_compress_stats(state_ctx_default(), stats);
+}
+
+int tfs_dedup_stats(tfs_dedup_stats_t *stats) {
+    return tfs_ctx_dedup_stats(state_ctx_default(), stats);
+}
+
+int tfs_checksum_stats(tfs_checksum_stats_t *stats) {
+    return tfs_ctx_checksum_stats(state_ctx_default(), stats);
+}
+
+int tfs_readahead_stats(tfs_readahead_stats_t *stats) {
+    return tfs_ctx_readahead_stats(state_ctx_default(), stats);
+}
+
+int tfs_spill_stats(tfs_spill_stats_t *stats) {
+    return tfs_ctx_spill_stats(state_ctx_default(), stats);
+}
+
+int tfs_open(char const *name, tfs_file_mode_t mode) {
+    return tfs_ctx_open(state_ctx_default(), name, mode);
+}
+
+int tfs_sym_link(char const *target, char const *link_name) {
+    return tfs_ctx_sym_link(state_ctx_default(), target, link_name);
+}
+
+int tfs_link(char const *target, char const *link_name) {
+    return tfs_ctx_link(state_ctx_default(), target, link_name);
+}
+
+int tfs_clone_file(char const *source, char const *dest) {
+    return tfs_ctx_clone_file(state_ctx_default(), source, dest);
+}
+
+int tfs_flush(int fhandle) {
+    return tfs_ctx_flush(state_ctx_default(), fhandle);
+}
+
+int tfs_close(int fhandle) {
+    return tfs_ctx_close(state_ctx_default(), fhandle);
+}
+
+ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
+    return tfs_ctx_write(state_ctx_default(), fhandle, buffer, to_write);
+}
+
+off_t tfs_lseek(int fhandle, off_t offset, tfs_seek_whence_t whence) {
+    return tfs_ctx_lseek(state_ctx_default(), fhandle, offset, whence);
+}
+
+ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
+    return tfs_ctx_read(state_ctx_default(), fhandle, buffer, len);
+}
+
+int tfs_unlink(char const *target) {
+    return tfs_ctx_unlink(state_ctx_default(), target);
+}
+
+ssize_t tfs_create_many(char const *const *names, size_t count, int *results) {
+    return tfs_ctx_create_many(state_ctx_default(), names, count, results);
+}
+
+ssize_t tfs_unlink_many(char const *const *names, size_t count, int *results) {
+    return tfs_ctx_unlink_many(state_ctx_default(), names, count, results);
+}
+
+int tfs_stat(char const *name, tfs_stat_t *stat) {
+    return tfs_ctx_stat(state_ctx_default(), name, stat);
+}
+
+tfs_dir_t *tfs_opendir(char const *name) {
+    return tfs_ctx_opendir(state_ctx_default(), name);
+}
+
+int tfs_copy_from_external_fs(char const *source_path, char const *dest_path) {
+    return tfs_ctx_copy_from_external_fs(state_ctx_default(), source_path,
+                                         dest_path);
+}
@@ -2,8 +2,24 @@
 #define OPERATIONS_H
 
 #include "config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <sys/types.h>
 
+/**
+ * TécnicoFS NUMA placement policies for the data region.
+ */
+typedef enum {
+    // plain malloc, pages end up on the node of the first thread touching them
+    TFS_NUMA_NONE = 0,
+    // data region and inode table pages striped round-robin across all nodes
+    TFS_NUMA_INTERLEAVE = 1,
+    // data region split in one stripe per node, blocks are allocated from the
+    // stripe of the node the allocating (writing) thread runs on
+    TFS_NUMA_LOCAL = 2,
+} tfs_numa_mode_t;
+
 /**
  * TécnicoFS parameters.
  */
@@ -12,11 +28,70 @@ typedef struct {
     size_t max_block_count;
     size_t max_open_files_count;
 
+    // counts tfs_grow can later extend max_inode_count and max_block_count up
+    // to, whose address space is reserved by tfs_init (0, or a value not above
+    // the initial count, disables growth; not supported with TFS_NUMA_LOCAL)
+    size_t max_inode_reserve;
+    size_t max_block_reserve;
+
     size_t block_size;
+    // maximum number of data blocks of a file (at most INODE_DIRECT_BLOCKS)
+    size_t max_file_blocks;
+
+    tfs_numa_mode_t numa_mode;
+
+    // regular files of up to this many bytes are stored inside their inode
+    // (0 disables it, at most INODE_INLINE_SIZE); symlink targets are always
+    // inlined when they fit
+    size_t inline_threshold;
+
+    // share data blocks between (and within) files when full blocks with the
+    // same contents are written, copying them again when one is modified
+    bool dedup;
+
+    // keep a CRC32C of every data block, verified whenever the block is read
+    bool checksums;
+    // with checksums on, a background thread verifies SCRUB_BATCH blocks every
+    // this many milliseconds (0 disables it)
+    size_t scrub_interval_ms;
+
+    // blocks a sequential reader is read ahead of by a background thread (0
+    // disables read-ahead): the window starts at one block past each read and
+    // doubles with every sequential read through the handle, up to this
+    size_t readahead_blocks;
+
+    // host file cold file blocks are moved to when the data blocks run out,
+    // and how many blocks it holds (0 disables tiering): a block in it is
+    // brought back to memory when its file is next read or written
+    char const *spill_path;
+    size_t spill_block_count;
+
+    // name of a POSIX shared memory segment (such as "/tfs") the inode table,
+    // the data blocks, their allocation maps and the inode locks are placed
+    // in, so that other processes can read the FS through tfs_ctx_attach
+    // (NULL keeps them private; not supported with NUMA placement, a growth
+    // reserve or a spill file)
+    char const *shm_name;
+
+    // storage threads running the operations submitted with tfs_submit (0
+    // disables the asynchronous interface)
+    size_t async_workers;
 } tfs_params;
 
+/**
+ * Per NUMA node data block allocation statistics.
+ */
+typedef struct {
+    size_t allocs; // blocks allocated from this node since tfs_init
+    size_t in_use; // blocks of this node currently allocated
+    size_t remote; // allocations made by threads running on another node
+} tfs_numa_node_stats_t;
+
 /**
  * Return a sane default set of parameters for tecnicofs.
+ *
+ * In a specialized build (TFS_STATIC_PARAMS), these are the compiled-in limits,
+ * which are the only ones tfs_init accepts.
  */
 tfs_params tfs_default_params();
 
@@ -26,19 +101,164 @@ tfs_params tfs_default_params();
  */
 int tfs_init(tfs_params const *params);
 
+/**
+ * Print the latency histograms of every public operation and of the internal
+ * phases they go through (lock waits, directory scans, inode and block
+ * allocation scans, simulated storage delays), merged across all threads:
+ * count, mean, percentiles and maximum, in microseconds.
+ *
+ * Latencies are only recorded in builds with -DTFS_STATS (make STATS=yes);
+ * otherwise the instrumentation compiles to nothing.
+ *
+ * Input:
+ *   - out: stream to print to
+ *
+ * Returns 0 if successful, -1 otherwise (or if compiled without TFS_STATS).
+ */
+int tfs_stats_dump(FILE *out);
+
+/**
+ * Grow a live tecnicofs: extend the inode table and the data region (and their
+ * allocation maps) to params->max_inode_count inodes and
+ * params->max_block_count blocks. Nothing is moved, so open files and
+ * operations in progress are unaffected. The other parameters are ignored.
+ *
+ * Returns 0 if successful, -1 otherwise (a count is lower than the current
+ * one, or above the reserve set at tfs_init).
+ */
+int tfs_grow(tfs_params const *params);
+
 /**
  * Destroy tecnicofs.
  * Returns 0 if successful, -1 otherwise.
  */
 int tfs_destroy();
 
+/**
+ * Get the per node data block allocation statistics.
+ *
+ * Input:
+ *   - stats: array filled with the statistics of each node
+ *   - max_nodes: length of the stats array
+ *
+ * Returns the number of nodes the data region is spread across (at most
+ * max_nodes entries of stats are filled), or 0 if tecnicofs is not
+ * initialized.
+ */
+size_t tfs_numa_stats(tfs_numa_node_stats_t *stats, size_t max_nodes);
+
+/**
+ * Block compression statistics.
+ *
+ * The compression ratio of the stored data is raw_bytes / compressed_bytes.
+ */
+typedef struct {
+    size_t blocks;           // file blocks currently stored compressed
+    size_t raw_bytes;        // size of those blocks
+    size_t compressed_bytes; // space they take once compressed
+    size_t cache_hits;       // reads of compressed blocks served from memory
+    size_t cache_misses;     // reads that had to decompress a block
+} tfs_compress_stats_t;
+
+/**
+ * Get the block compression statistics.
+ *
+ * Input:
+ *   - stats: filled with the statistics
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_compress_stats(tfs_compress_stats_t *stats);
+
+/**
+ * Block deduplication statistics.
+ */
+typedef struct {
+    size_t indexed_blocks; // distinct full blocks in the content index
+    size_t saved_blocks;   // blocks not allocated thanks to sharing
+    size_t hits;           // full blocks found to be already stored
+    size_t cow_copies;     // shared blocks copied because they were modified
+} tfs_dedup_stats_t;
+
+/**
+ * Get the block deduplication statistics.
+ *
+ * Input:
+ *   - stats: filled with the statistics
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_dedup_stats(tfs_dedup_stats_t *stats);
+
+/**
+ * Data block checksum statistics.
+ */
+typedef struct {
+    size_t verified;      // block reads checked against their checksum
+    size_t updated;       // checksums computed for modified blocks
+    size_t errors;        // reads that found a corrupted block (and failed)
+    size_t scrubbed;      // blocks checked by the background scrub
+    size_t scrub_errors;  // corrupted blocks found by the background scrub
+    uint64_t checksum_ns; // time spent computing checksums (sampled)
+} tfs_checksum_stats_t;
+
+/**
+ * Get the data block checksum statistics.
+ *
+ * Input:
+ *   - stats: filled with the statistics
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_checksum_stats(tfs_checksum_stats_t *stats);
+
+/**
+ * Read-ahead statistics.
+ */
+typedef struct {
+    size_t prefetched; // blocks loaded by the read-ahead thread
+    size_t hits;       // block reads served by a block loaded ahead
+    size_t dropped;    // blocks not read ahead because the queue was full
+} tfs_readahead_stats_t;
+
+/**
+ * Get the read-ahead statistics.
+ *
+ * Input:
+ *   - stats: filled with the statistics
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_readahead_stats(tfs_readahead_stats_t *stats);
+
+/**
+ * Tiered storage statistics.
+ */
+typedef struct {
+    size_t spilled;   // file blocks currently in the spill file
+    size_t evictions; // blocks moved to the spill file to free memory
+    size_t faults;    // blocks brought back from the spill file
+} tfs_spill_stats_t;
+
+/**
+ * Get the tiered storage statistics.
+ *
+ * Input:
+ *   - stats: filled with the statistics
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_spill_stats(tfs_spill_stats_t *stats);
+
 /**
  * TécnicoFS file opening modes.
  */
 typedef enum {
-    TFS_O_CREAT = 0b001,
-    TFS_O_TRUNC = 0b010,
-    TFS_O_APPEND = 0b100,
+    TFS_O_CREAT = 0b0001,
+    TFS_O_TRUNC = 0b0010,
+    TFS_O_APPEND = 0b0100,
+    TFS_O_COMPRESS = 0b1000,
+    TFS_O_BUFFERED = 0b10000,
 } tfs_file_mode_t;
 
 /**
@@ -47,9 +267,20 @@ typedef enum {
  * Input:
  *   - name: absolute path name
  *   - mode: can be a combination (with bitwise or) of the following flags:
- *     - append mode (TFS_O_APPEND)
+ *     - append mode (TFS_O_APPEND): every write goes to the end of the file,
+ *       and appends from several threads (even through the same handle) run
+ *       in parallel, each one seen by readers only once it is whole
  *     - truncate file contents (TFS_O_TRUNC)
  *     - create file if it does not exist (TFS_O_CREAT)
+ *     - compress the file's blocks (TFS_O_COMPRESS), only honored when the
+ *       file is empty (e.g. just created or truncated); blocks are compressed
+ *       as they fill and the file keeps the mode until it is deleted
+ *     - buffer the writes (TFS_O_BUFFERED): writes through the handle are
+ *       gathered in memory and written to the file together, once
+ *       WRITE_BUFFER_SIZE bytes are buffered, once the oldest is
+ *       WRITE_BUFFER_AGE_MS old (checked on each write), and on tfs_flush,
+ *       tfs_close and reads or seeks through the handle; until then, other
+ *       handles do not see them
  *
  * Returns file handle of the opened file if successful, -1 otherwise.
  */
@@ -78,15 +309,44 @@ int tfs_sym_link(char const *target, char const *link_name);
 int tfs_link(char const *target_file, char const *link_name);
 
 /**
- * Close a file.
+ * Create a copy of a file that shares its data blocks (like a reflink):
+ * cloning takes no extra space, and a block is only copied once the source
+ * or the clone modifies it. Writes still buffered in TFS_O_BUFFERED handles
+ * of the source are not part of the clone. Chunks of the source in the spill
+ * file are brought back to be shared, and, like every shared block, are not
+ * moved to the spill file again while they are shared.
  *
  * Input:
- *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - source: absolute path name of the file to clone (not a symlink)
+ *   - dest: absolute path name of the clone, which must not exist yet
  *
  * Returns 0 if successful, -1 otherwise.
  */
+int tfs_clone_file(char const *source, char const *dest);
+
+/**
+ * Close a file (flushing its buffered writes, see TFS_O_BUFFERED).
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *
+ * Returns 0 if successful, -1 otherwise (the handle is closed even if its
+ * buffered writes could not be written).
+ */
 int tfs_close(int fhandle);
 
+/**
+ * Write the buffered writes of a handle opened with TFS_O_BUFFERED to its
+ * file (nothing to do for other handles).
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *
+ * Returns 0 if successful, -1 otherwise (the buffered writes were not all
+ * written, e.g. because the data blocks ran out, and are dropped).
+ */
+int tfs_flush(int fhandle);
+
 /**
  * Write to an open file, starting at the current offset.
  *
@@ -96,10 +356,41 @@ int tfs_close(int fhandle);
  *   - len: length of the buffer contents (in bytes)
  *
  * Returns the number of bytes that were written (can be lower than 'len' if the
- * maximum file size is exceeded), or -1 in case of error.
+ * maximum file size is exceeded or the data blocks run out), or -1 in case of
+ * error. Writes through a TFS_O_BUFFERED handle are only buffered, and report
+ * the errors of the buffered writes they flush.
  */
 ssize_t tfs_write(int fhandle, void const *buffer, size_t len);
 
+/**
+ * TécnicoFS reposition modes (see tfs_lseek).
+ */
+typedef enum {
+    TFS_SEEK_SET, // to the given offset
+    TFS_SEEK_CUR, // to the current offset plus the given offset
+    TFS_SEEK_END, // to the file size plus the given offset
+    TFS_SEEK_DATA, // to the next data at or after the given offset
+    TFS_SEEK_HOLE, // to the next hole at or after the given offset
+} tfs_seek_whence_t;
+
+/**
+ * Reposition the offset of an open file.
+ *
+ * Offsets past the end of the file are allowed: a later write there leaves a
+ * hole, which takes no data blocks and reads as zeros. Holes are tracked with
+ * block granularity, and the end of the file counts as a hole.
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - offset: offset (in bytes), interpreted according to whence
+ *   - whence: reposition mode
+ *
+ * Returns the resulting offset from the beginning of the file, or -1 in case
+ * of error (including a negative resulting offset and, for TFS_SEEK_DATA and
+ * TFS_SEEK_HOLE, an offset outside the file or no data after it).
+ */
+off_t tfs_lseek(int fhandle, off_t offset, tfs_seek_whence_t whence);
+
 /**
  * Read from an open file, starting at the current offset.
  *
@@ -113,9 +404,105 @@ ssize_t tfs_write(int fhandle, void const *buffer, size_t len);
  */
 ssize_t tfs_read(int fhandle, void *buffer, size_t len);
 
+/**
+ * Asynchronous interface.
+ *
+ * Operations are submitted in batches to a ring and run by a pool of storage
+ * threads, and their results are later collected from the same ring. Each
+ * thread can keep as many operations in flight as its ring has entries.
+ *
+ * Operations on the same file handle (or, for open and unlink, the same path
+ * name) run in submission order; consecutive reads or writes to the same file
+ * handle are coalesced into a single call.
+ */
+typedef struct tfs_ring tfs_ring_t;
+
+typedef enum {
+    TFS_OP_OPEN,   // tfs_open(name, mode)
+    TFS_OP_CLOSE,  // tfs_close(fhandle)
+    TFS_OP_READ,   // tfs_read(fhandle, buffer, len)
+    TFS_OP_WRITE,  // tfs_write(fhandle, buffer, len)
+    TFS_OP_UNLINK, // tfs_unlink(name)
+} tfs_op_code_t;
+
+/**
+ * Operation descriptor (the fields used depend on the operation).
+ *
+ * The name and buffer must stay valid until the operation completes.
+ */
+typedef struct {
+    tfs_op_code_t op;
+    char const *name;
+    tfs_file_mode_t mode;
+    int fhandle;
+    void *buffer;
+    size_t len;
+    // opaque value handed back with the completion
+    unsigned long user_data;
+} tfs_op_t;
+
+/**
+ * Completion of an asynchronous operation.
+ */
+typedef struct {
+    unsigned long user_data;
+    // what the synchronous call would have returned
+    ssize_t result;
+} tfs_completion_t;
+
+/**
+ * Create a ring.
+ *
+ * Input:
+ *   - entries: maximum number of operations in flight (submitted but not yet
+ *     reaped) in the ring
+ *
+ * Returns the ring, or NULL in case of error (including the asynchronous
+ * interface being disabled).
+ */
+tfs_ring_t *tfs_ring_create(size_t entries);
+
+/**
+ * Destroy a ring, waiting for the operations still in flight to complete.
+ *
+ * Input:
+ *   - ring: the ring
+ */
+void tfs_ring_destroy(tfs_ring_t *ring);
+
+/**
+ * Submit a batch of operations.
+ *
+ * Input:
+ *   - ring: the ring their completions are delivered to
+ *   - ops: the operations
+ *   - count: number of operations
+ *
+ * Returns the number of operations submitted (lower than count if the ring
+ * fills up), or -1 in case of error.
+ */
+ssize_t tfs_submit(tfs_ring_t *ring, tfs_op_t const *ops, size_t count);
+
+/**
+ * Collect completions.
+ *
+ * Input:
+ *   - ring: the ring
+ *   - completions: destination array
+ *   - max: length of the destination array
+ *   - min_complete: wait until at least this many completions are available
+ *     (or all the operations in flight have completed)
+ *
+ * Returns the number of completions collected, or -1 in case of error.
+ */
+ssize_t tfs_reap(tfs_ring_t *ring, tfs_completion_t *completions, size_t max,
+                 size_t min_complete);
+
 /**
  * Delete a link, or a file if the number of hard links reaches 0, that
- * exists in TécnicoFS.
+ * exists in TécnicoFS. A file that is still open loses its name right away,
+ * but is only deleted once its last handle is closed (until then, its handles
+ * keep reading and writing it).
  *
  * Input:
  *   - target: path name of the target (in TécnicoFS)
@@ -124,6 +511,109 @@ ssize_t tfs_read(int fhandle, void *buffer, size_t len);
  */
 int tfs_unlink(char const *target);
 
+/**
+ * Create several empty files at once.
+ *
+ * All the directory updates and inode allocations are done under a single
+ * acquisition of the directory's lock, in one pass. Names that are invalid,
+ * already exist, or are repeated in the batch are not created.
+ *
+ * Input:
+ *   - names: absolute path names of the files
+ *   - count: number of names
+ *   - results: results[i] is set to 0 if names[i] was created, -1 otherwise
+ *
+ * Returns the number of files created, or -1 in case of error.
+ */
+ssize_t tfs_create_many(char const *const *names, size_t count, int *results);
+
+/**
+ * Unlink several files at once (see tfs_unlink).
+ *
+ * All the directory updates and inode deletions are done under a single
+ * acquisition of the directory's lock, in one pass.
+ *
+ * Input:
+ *   - names: absolute path names of the files
+ *   - count: number of names
+ *   - results: results[i] is set to 0 if names[i] was unlinked, -1 otherwise
+ *
+ * Returns the number of files unlinked, or -1 in case of error.
+ */
+ssize_t tfs_unlink_many(char const *const *names, size_t count, int *results);
+
+/**
+ * File types reported by tfs_stat.
+ */
+typedef enum {
+    TFS_T_FILE = 0,
+    TFS_T_DIRECTORY = 1,
+    TFS_T_LINK = 2,
+} tfs_file_type_t;
+
+/**
+ * File metadata.
+ */
+typedef struct {
+    tfs_file_type_t type;
+    size_t size;    // bytes of content (for symlinks, of the target path name)
+    size_t links;   // hard links to the file
+    size_t blocks;  // data blocks referenced (0 for contents kept in the inode)
+    size_t spilled; // blocks moved to the spill file (not in blocks)
+} tfs_stat_t;
+
+/**
+ * Get the metadata of a file, without opening it. Symbolic links are not
+ * followed (their own metadata is returned).
+ *
+ * Input:
+ *   - name: absolute path name of the file ("/" for the root directory)
+ *   - stat: filled with the metadata
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_stat(char const *name, tfs_stat_t *stat);
+
+/**
+ * Directory listing.
+ *
+ * tfs_opendir takes a snapshot of the directory entries, so the directory is
+ * only locked while it is copied: files can be created and unlinked while the
+ * listing is iterated, which keeps returning the entries as they were when it
+ * was opened.
+ */
+typedef struct tfs_dir tfs_dir_t;
+
+typedef struct {
+    char name[MAX_FILE_NAME];
+    int inumber;
+} tfs_dirent_t;
+
+/**
+ * Open a directory listing.
+ *
+ * Input:
+ *   - name: absolute path name of the directory (only "/" exists)
+ *
+ * Returns the listing, or NULL in case of error.
+ */
+tfs_dir_t *tfs_opendir(char const *name);
+
+/**
+ * Get the next entry of a directory listing.
+ *
+ * Returns the entry (valid until the next call with this listing), or NULL
+ * when every entry has been returned.
+ */
+tfs_dirent_t const *tfs_readdir(tfs_dir_t *dir);
+
+/**
+ * Close a directory listing.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_closedir(tfs_dir_t *dir);
+
 /**
  * Copy the contents of a file that exists in the OS' file system tree
  * (outside TécnicoFS) to the TécnicoFS.
@@ -137,4 +627,88 @@ int tfs_unlink(char const *target);
  */
 int tfs_copy_from_external_fs(char const *source_path, char const *dest_path);
 
+/**
+ * File system instances.
+ *
+ * A process can host several independent instances of TécnicoFS, each with its
+ * own inode table, data region, open file table, locks and background threads.
+ * The tfs_* functions above operate on a default instance (set up by
+ * tfs_init), and each tfs_ctx_* function below behaves like its tfs_*
+ * counterpart on the given instance instead (NULL for the default one).
+ *
+ * File handles only make sense in the instance that returned them. Rings and
+ * directory listings remember their instance, so tfs_submit, tfs_reap,
+ * tfs_ring_destroy, tfs_readdir and tfs_closedir take no instance. The latency
+ * histograms (tfs_stats_dump) are shared by the whole process.
+ */
+typedef struct tfs_ctx tfs_ctx_t;
+
+/**
+ * Create and initialize an instance, optionally with a given configuration.
+ *
+ * Returns the instance if successful, NULL otherwise.
+ */
+tfs_ctx_t *tfs_ctx_init(tfs_params const *params);
+
+/**
+ * Destroy an instance created by tfs_ctx_init (the handle becomes invalid).
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_ctx_destroy(tfs_ctx_t *ctx);
+
+/**
+ * Attach to an instance another process placed in a shared memory segment
+ * (see shm_name in tfs_params), reading its files in place.
+ *
+ * The instance is read-only: files can only be opened with mode 0, and then
+ * read, seeked and listed, while every operation that would modify the FS
+ * fails. Destroying it (with tfs_ctx_destroy) only detaches, which must be
+ * done before the owner destroys its instance. A process killed while reading
+ * does not block the owner's writes to the file for long (see
+ * RANGE_LOCK_CHECK_MS), but one killed while looking a file up (in the
+ * directory's lock, which is not robust) still blocks them.
+ *
+ * Returns the instance if successful, NULL otherwise.
+ */
+tfs_ctx_t *tfs_ctx_attach(char const *shm_name);
+
+int tfs_ctx_grow(tfs_ctx_t *ctx, tfs_params const *params);
+size_t tfs_ctx_numa_stats(tfs_ctx_t *ctx, tfs_numa_node_stats_t *stats,
+                          size_t max_nodes);
+int tfs_ctx_compress_stats(tfs_ctx_t *ctx, tfs_compress_stats_t *stats);
+int tfs_ctx_dedup_stats(tfs_ctx_t *ctx, tfs_dedup_stats_t *stats);
+int tfs_ctx_checksum_stats(tfs_ctx_t *ctx, tfs_checksum_stats_t *stats);
+int tfs_ctx_readahead_stats(tfs_ctx_t *ctx, tfs_readahead_stats_t *stats);
+int tfs_ctx_spill_stats(tfs_ctx_t *ctx, tfs_spill_stats_t *stats);
+
+int tfs_ctx_open(tfs_ctx_t *ctx, char const *name, tfs_file_mode_t mode);
+int tfs_ctx_sym_link(tfs_ctx_t *ctx, char const *target,
+                     char const *link_name);
+int tfs_ctx_link(tfs_ctx_t *ctx, char const *target_file,
+                 char const *link_name);
+int tfs_ctx_clone_file(tfs_ctx_t *ctx, char const *source,
+                       char const *dest);
+int tfs_ctx_close(tfs_ctx_t *ctx, int fhandle);
+int tfs_ctx_flush(tfs_ctx_t *ctx, int fhandle);
+ssize_t tfs_ctx_write(tfs_ctx_t *ctx, int fhandle, void const *buffer,
+                      size_t len);
+off_t tfs_ctx_lseek(tfs_ctx_t *ctx, int fhandle, off_t offset,
+                    tfs_seek_whence_t whence);
+ssize_t tfs_ctx_read(tfs_ctx_t *ctx, int fhandle, void *buffer, size_t len);
+int tfs_ctx_unlink(tfs_ctx_t *ctx, char const *target);
+
+tfs_ring_t *tfs_ctx_ring_create(tfs_ctx_t *ctx, size_t entries);
+
+ssize_t tfs_ctx_create_many(tfs_ctx_t *ctx, char const *const *names,
+                            size_t count, int *results);
+ssize_t tfs_ctx_unlink_many(tfs_ctx_t *ctx, char const *const *names,
+                            size_t count, int *results);
+
+int tfs_ctx_stat(tfs_ctx_t *ctx, char const *name, tfs_stat_t *stat);
+tfs_dir_t *tfs_ctx_opendir(tfs_ctx_t *ctx, char const *name);
+
+int tfs_ctx_copy_from_external_fs(tfs_ctx_t *ctx, char const *source_path,
+                                  char const *dest_path);
+
 #endif // OPERATIONS_H
@@ -0,0 +1,159 @@
+/**
+ * Range locks: lets the reads and writes to disjoint parts of a file run in
+ * parallel.
+ *
+ * The ranges held on a file are kept in a small array, scanned under a mutex
+ * on every acquisition; a thread whose range conflicts with a held one (or
+ * that finds every slot taken) sleeps until some range is released.
+ *
+ * Range locks placed in shared memory are robust: every range records the
+ * process holding it, and a waiter wakes up every RANGE_LOCK_CHECK_MS to drop
+ * the ranges of processes that died without releasing them (their mutex is
+ * robust too, see mutex_init_shared).
+ */
+#include "range_lock.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+static bool ranges_conflict(range_t const *held, size_t start, size_t end,
+                            bool writer) {
+    return held->r_used && start < held->r_end && held->r_start < end &&
+           (writer || held->r_writer);
+}
+
+/**
+ * Release the ranges held by processes that no longer exist. Must be called
+ * with the range lock's mutex held.
+ *
+ * Returns whether any range was released.
+ */
+static bool ranges_recover(range_lock_t *lock) {
+    bool recovered = false;
+    for (size_t i = 0; i < RANGE_LOCK_SLOTS; i++) {
+        range_t *held = &lock->rl_ranges[i];
+        if (held->r_used && kill(held->r_owner, 0) == -1 && errno == ESRCH) {
+            held->r_used = false;
+            recovered = true;
+        }
+    }
+
+    return recovered;
+}
+
+/**
+ * Wait for a range to be released, or (for a shared lock) for the next check
+ * of its holders, which drops those of dead processes. Must be called with the
+ * range lock's mutex held.
+ */
+static void ranges_wait(range_lock_t *lock) {
+    if (!lock->rl_shared) {
+        cond_wait(&lock->rl_cond, &lock->rl_lock);
+        return;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    size_t ns = (size_t)deadline.tv_nsec + RANGE_LOCK_CHECK_MS * 1000000;
+    deadline.tv_sec += (time_t)(ns / 1000000000);
+    deadline.tv_nsec = (long)(ns % 1000000000);
+
+    int ret = cond_timedwait(&lock->rl_cond, &lock->rl_lock, &deadline);
+    if (ret == ETIMEDOUT && ranges_recover(lock)) {
+        cond_broadcast(&lock->rl_cond);
+    }
+}
+
+/**
+ * Initialize a range lock, with no range held.
+ *
+ * Input:
+ *   - lock: the range lock
+ *   - shared: whether it is placed in shared memory, to be taken by several
+ *     processes
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int range_lock_init(range_lock_t *lock, bool shared) {
+    for (size_t i = 0; i < RANGE_LOCK_SLOTS; i++) {
+        lock->rl_ranges[i].r_used = false;
+    }
+    lock->rl_shared = shared;
+
+    if (shared) {
+        mutex_init_shared(&lock->rl_lock);
+        return cond_init_shared(&lock->rl_cond);
+    }
+
+    if (mutex_init(&lock->rl_lock) != 0) {
+        return -1;
+    }
+
+    return cond_init(&lock->rl_cond);
+}
+
+int range_lock_destroy(range_lock_t *lock) {
+    if (mutex_destroy(&lock->rl_lock) != 0) {
+        return -1;
+    }
+
+    return cond_destroy(&lock->rl_cond);
+}
+
+/**
+ * Lock a byte range, waiting until no conflicting range is held.
+ *
+ * Input:
+ *   - lock: the file's range lock
+ *   - start: first byte of the range
+ *   - end: byte after the last one of the range
+ *   - writer: whether the range is locked for writing
+ *
+ * Returns the slot of the range, to release it with.
+ */
+int range_lock_acquire(range_lock_t *lock, size_t start, size_t end,
+                       bool writer) {
+    mutex_lock(&lock->rl_lock);
+
+    while (true) {
+        int free_slot = -1;
+        bool conflict = false;
+        for (int i = 0; i < RANGE_LOCK_SLOTS && !conflict; i++) {
+            range_t const *held = &lock->rl_ranges[i];
+            if (!held->r_used) {
+                if (free_slot == -1) {
+                    free_slot = i;
+                }
+            } else {
+                conflict = ranges_conflict(held, start, end, writer);
+            }
+        }
+
+        if (!conflict && free_slot != -1) {
+            range_t *range = &lock->rl_ranges[free_slot];
+            range->r_start = start;
+            range->r_end = end;
+            range->r_owner = getpid();
+            range->r_writer = writer;
+            range->r_used = true;
+
+            mutex_unlock(&lock->rl_lock);
+            return free_slot;
+        }
+
+        ranges_wait(lock);
+    }
+}
+
+/**
+ * Unlock a range locked with range_lock_acquire.
+ */
+void range_lock_release(range_lock_t *lock, int slot) {
+    mutex_lock(&lock->rl_lock);
+    lock->rl_ranges[slot].r_used = false;
+    cond_broadcast(&lock->rl_cond);
+    mutex_unlock(&lock->rl_lock);
+}
@@ -0,0 +1,39 @@
+#ifndef RANGE_LOCK_H
+#define RANGE_LOCK_H
+
+#include "config.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * Byte range [start, end) held by a thread (of process r_owner).
+ */
+typedef struct {
+    size_t r_start;
+    size_t r_end;
+    pid_t r_owner;
+    bool r_writer;
+    bool r_used;
+} range_t;
+
+/**
+ * Reader-writer lock over the byte ranges of a file: ranges that overlap
+ * exclude each other unless both are held for reading.
+ */
+typedef struct {
+    pthread_mutex_t rl_lock;
+    pthread_cond_t rl_cond;
+    bool rl_shared;
+    range_t rl_ranges[RANGE_LOCK_SLOTS];
+} range_lock_t;
+
+int range_lock_init(range_lock_t *lock, bool shared);
+int range_lock_destroy(range_lock_t *lock);
+int range_lock_acquire(range_lock_t *lock, size_t start, size_t end,
+                       bool writer);
+void range_lock_release(range_lock_t *lock, int slot);
+
+#endif // RANGE_LOCK_H
@@ -1,58 +1,402 @@
+#define _GNU_SOURCE // SCHED_IDLE
+
 #include "state.h"
 #include "betterassert.h"
+#include "crc32c.h"
+#include "lz.h"
+#include "numa.h"
+#include "stats.h"
 #include "utils.h"
 
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
-/*
- * Persistent FS state
- * (in reality, it should be maintained in secondary memory;
- * for simplicity, this project maintains it in primary memory).
- */
-static tfs_params fs_params;
-
-// Inode table
-static inode_t *inode_table;
-static pthread_rwlock_t *inode_rwl;
-static allocation_state_t *freeinode_ts;
-static pthread_rwlock_t inode_table_rwl;
-
-// Data blocks
-static char *fs_data; // # blocks * block size
-static allocation_state_t *free_blocks;
-static pthread_rwlock_t free_blocks_rwl;
+// Block checksums, protected by the lock of the stripe each block belongs to
+// (a block without a valid checksum is being modified, or was never written)
+typedef struct {
+    pthread_mutex_t cs_lock;
+    tfs_checksum_stats_t cs_stats;
+    size_t cs_computed; // checksums computed, to pick the ones timed
+} checksum_stripe_t;
+
+// Start of a shared memory segment holding the state of an instance (see
+// shm_state_init), followed by the arrays at the recorded offsets
+typedef struct {
+    uint64_t sh_magic; // SHM_MAGIC once the owner finished initializing
+    size_t sh_size;
+    tfs_params sh_params;
+    size_t sh_inode_table;
+    size_t sh_inode_rwl;
+    size_t sh_inode_ranges;
+    size_t sh_freeinode_ts;
+    size_t sh_fs_data;
+    size_t sh_free_blocks;
+    size_t sh_block_refs;
+    size_t sh_inode_opens;
+} shm_header_t;
+
+#define SHM_MAGIC (0x54465353484d3031) // "TFSSHM01"
+
+// Decompressed copies of compressed blocks, indexed by their location
+typedef struct {
+    bool zc_valid;
+    int zc_block;
+    size_t zc_offset;
+    char *zc_data;
+    pthread_mutex_t zc_lock;
+} compress_cache_entry_t;
 
-/*
- * Volatile FS state
+/**
+ * File system instance (see tfs_ctx_init): every instance has its own tables,
+ * data region, locks and background threads.
  */
-static open_file_entry_t *open_file_table;
-static allocation_state_t *free_open_file_entries;
-static pthread_rwlock_t open_file_table_rwl;
+struct tfs_ctx {
+    /*
+     * Persistent FS state
+     * (in reality, it should be maintained in secondary memory;
+     * for simplicity, this project maintains it in primary memory).
+     */
+    tfs_params fs_params;
+    // inodes and data blocks the arrays below have address space reserved for
+    // (0 if the FS cannot grow)
+    size_t inode_reserve;
+    size_t block_reserve;
+
+    // Inode table
+    inode_t *inode_table;
+    pthread_rwlock_t *inode_rwl;
+    // byte range locks of each inode, taken under its lock held for reading
+    range_lock_t *inode_ranges;
+    allocation_state_t *freeinode_ts;
+    pthread_rwlock_t inode_table_rwl;
+
+    // Data blocks
+    char *fs_data; // # blocks * block size
+    allocation_state_t *free_blocks;
+    // references to each taken block (a block can hold the compressed chunks
+    // of several file blocks), protected by free_blocks_rwl
+    unsigned int *block_refs;
+    pthread_rwlock_t free_blocks_rwl;
+
+    // Content index of full blocks (deduplication), protected by
+    // free_blocks_rwl: indexed blocks are chained from the bucket of their hash
+    uint64_t *block_hashes;
+    bool *block_indexed;
+    int *dedup_buckets;
+    size_t dedup_bucket_count; // fixed at init, the FS can grow
+    int *dedup_next;
+    tfs_dedup_stats_t dedup_stats;
+
+    // Block checksums
+    uint32_t *block_crcs;
+    bool *block_crc_valid;
+    checksum_stripe_t checksum_stripes[CHECKSUM_STRIPES];
+
+    // Background scrub of the block checksums
+    pthread_t scrub_thread;
+    bool scrub_running; // protected by scrub_lock
+    pthread_mutex_t scrub_lock;
+    pthread_cond_t scrub_cond;
+
+    // Read-ahead: the state of each data block (a block_warmth_t) and the
+    // blocks queued for the read-ahead thread, which makes their (simulated)
+    // storage access before they are read
+    char *block_warmth;
+    int readahead_queue[READAHEAD_QUEUE];
+    size_t readahead_head;
+    size_t readahead_count;
+    bool readahead_running; // protected by readahead_lock, with the queue
+    pthread_t readahead_thread;
+    pthread_mutex_t readahead_lock;
+    pthread_cond_t readahead_cond;
+    tfs_readahead_stats_t readahead_stats; // hits are updated atomically
+
+    // Tiered storage: when the data blocks run out, cold file blocks are moved
+    // to slots of the spill file. They are picked by a clock sweep over the
+    // chunks of the files, in which blocks referenced since the hand last
+    // passed them get a second chance. Protected by spill_lock (but for the
+    // reference bits, which are updated atomically).
+    int spill_fd; // -1 if tiering is disabled
+    size_t *spill_free_slots;
+    size_t spill_free_count;
+    bool *block_referenced;
+    size_t spill_hand_inode;
+    size_t spill_hand_index;
+    tfs_spill_stats_t spill_stats;
+    pthread_mutex_t spill_lock;
+
+    // Shared memory segment the inode table, the data blocks, their
+    // allocation maps and the inode locks live in (NULL if private), and
+    // whether this instance only attached to it (see state_attach)
+    shm_header_t *shm;
+    char *shm_name;
+    bool shm_attached;
+    // handles the attached instances have on each inode of the segment
+    // (updated atomically), which keep it from being deleted when unlinked
+    unsigned int *inode_opens;
+
+    // NUMA placement (statistics protected by free_blocks_rwl)
+    size_t numa_nodes;
+    size_t numa_stripe; // data blocks per node stripe (TFS_NUMA_LOCAL)
+    tfs_numa_node_stats_t *numa_stats;
+
+    // Compressed blocks
+    compress_cache_entry_t compress_cache[COMPRESS_CACHE_ENTRIES];
+    char *compress_cache_data;
+    tfs_compress_stats_t compress_stats;
+    pthread_mutex_t compress_stats_lock;
+
+    // Storage threads of the asynchronous interface
+    async_pool_t *async_pool;
+
+    /*
+     * Volatile FS state
+     */
+    open_file_entry_t *open_file_table;
+    allocation_state_t *free_open_file_entries;
+    pthread_rwlock_t open_file_table_rwl;
+    // unlinked files that are still open, deleted when their last handle is
+    // closed (protected by open_file_table_rwl); each one has at least one
+    // handle, so there are never more than MAX_OPEN_FILES (nor, with a
+    // shared memory segment, where handles of attached instances count too,
+    // more than INODE_TABLE_SIZE)
+    int *orphans;
+    size_t orphan_count;
+};
+
+// the instance behind the plain tfs_* functions
+static tfs_ctx_t default_ctx;
 
 // Convenience macros
-#define INODE_TABLE_SIZE (fs_params.max_inode_count)
-#define DATA_BLOCKS (fs_params.max_block_count)
-#define MAX_OPEN_FILES (fs_params.max_open_files_count)
-#define BLOCK_SIZE (fs_params.block_size)
+#ifdef TFS_STATIC_PARAMS
+// limits baked in at compile time, so that they can be constant-folded
+#define INODE_TABLE_SIZE ((size_t)TFS_STATIC_MAX_INODE_COUNT)
+#define DATA_BLOCKS ((size_t)TFS_STATIC_MAX_BLOCK_COUNT)
+#define MAX_OPEN_FILES ((size_t)TFS_STATIC_MAX_OPEN_FILES_COUNT)
+#define BLOCK_SIZE ((size_t)TFS_STATIC_BLOCK_SIZE)
+#define MAX_FILE_BLOCKS ((size_t)TFS_STATIC_MAX_FILE_BLOCKS)
+#else
+// these two grow while the FS is live (state_grow), which publishes the new
+// entries with a release store
+#define INODE_TABLE_SIZE                                                       \
+    (__atomic_load_n(&ctx->fs_params.max_inode_count, __ATOMIC_ACQUIRE))
+#define DATA_BLOCKS                                                            \
+    (__atomic_load_n(&ctx->fs_params.max_block_count, __ATOMIC_ACQUIRE))
+#define MAX_OPEN_FILES (ctx->fs_params.max_open_files_count)
+#define BLOCK_SIZE (ctx->fs_params.block_size)
+#define MAX_FILE_BLOCKS (ctx->fs_params.max_file_blocks)
+#endif
 #define MAX_DIR_ENTRIES (BLOCK_SIZE / sizeof(dir_entry_t))
 
-static inline bool valid_inumber(int inumber) {
+static inline bool valid_inumber(tfs_ctx_t *ctx, int inumber) {
+    (void)ctx; // the limits are compiled in with TFS_STATIC_PARAMS
     return inumber >= 0 && inumber < INODE_TABLE_SIZE;
 }
 
-static inline bool valid_block_number(int block_number) {
+static inline bool valid_block_number(tfs_ctx_t *ctx, int block_number) {
+    (void)ctx; // the limits are compiled in with TFS_STATIC_PARAMS
     return block_number >= 0 && block_number < DATA_BLOCKS;
 }
 
-static inline bool valid_file_handle(int file_handle) {
+static inline bool valid_file_handle(tfs_ctx_t *ctx, int file_handle) {
+    (void)ctx; // the limits are compiled in with TFS_STATIC_PARAMS
     return file_handle >= 0 && file_handle < MAX_OPEN_FILES;
 }
 
-size_t state_block_size(void) { return BLOCK_SIZE; }
+#ifndef TFS_STATIC_PARAMS
+size_t state_block_size(tfs_ctx_t *ctx) { return BLOCK_SIZE; }
+
+size_t state_max_file_size(tfs_ctx_t *ctx) {
+    return MAX_FILE_BLOCKS * BLOCK_SIZE;
+}
+#endif
+
+/**
+ * Allocate a new FS instance (to be initialized with state_init or
+ * state_attach).
+ *
+ * Returns the instance, or NULL in case of error.
+ */
+tfs_ctx_t *state_ctx_create(void) { return calloc(1, sizeof(tfs_ctx_t)); }
+
+/**
+ * Release an instance allocated by state_ctx_create, once destroyed.
+ */
+void state_ctx_free(tfs_ctx_t *instance) { free(instance); }
+
+/**
+ * Instance the plain tfs_* functions operate on.
+ */
+tfs_ctx_t *state_ctx_default(void) { return &default_ctx; }
+
+/**
+ * Instance a tfs_ctx_* function operates on, given its argument (NULL stands
+ * for the default one).
+ */
+tfs_ctx_t *state_ctx_get(tfs_ctx_t *instance) {
+    return instance != NULL ? instance : &default_ctx;
+}
+
+async_pool_t *state_async_pool(tfs_ctx_t *ctx) { return ctx->async_pool; }
+
+void state_set_async_pool(tfs_ctx_t *ctx, async_pool_t *pool) {
+    ctx->async_pool = pool;
+}
+
+/**
+ * NUMA node whose memory holds a given data block.
+ *
+ * In interleave mode the kernel stripes the pages of an anonymous mapping
+ * round-robin by their absolute page index (not by their offset in the
+ * region), so the node is derived from the address of the page the block
+ * starts in.
+ */
+static size_t block_node(tfs_ctx_t *ctx, size_t block_number) {
+    uintptr_t address;
+    switch (ctx->fs_params.numa_mode) {
+    case TFS_NUMA_LOCAL:
+        return block_number / ctx->numa_stripe;
+    case TFS_NUMA_INTERLEAVE:
+        address = (uintptr_t)&ctx->fs_data[block_number * BLOCK_SIZE];
+        return address / (uintptr_t)sysconf(_SC_PAGESIZE) % ctx->numa_nodes;
+    case TFS_NUMA_NONE:
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Allocate an array of count elements. If the FS can grow (reserve is not 0),
+ * address space for reserve elements is mapped instead, which is only backed
+ * by memory once touched, so that the array never has to move.
+ *
+ * Returns NULL on failure.
+ */
+static void *array_alloc(size_t count, size_t reserve, size_t size) {
+    if (reserve > 0) {
+        return numa_region_alloc(reserve * size);
+    }
+
+    return malloc(count * size);
+}
+
+/**
+ * Release an array obtained from array_alloc.
+ */
+static void array_free(void *array, size_t reserve, size_t size) {
+    if (reserve > 0) {
+        numa_region_free(array, reserve * size);
+    } else {
+        free(array);
+    }
+}
+
+static void numa_state_destroy(tfs_ctx_t *ctx);
+
+/**
+ * Allocate the data region and apply the configured NUMA placement to it (and
+ * to the inode table), before any page is touched.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int numa_state_init(tfs_ctx_t *ctx) {
+    ctx->numa_nodes = 1;
+    ctx->numa_stripe = DATA_BLOCKS;
+
+    // room for the whole reserve, placed up front
+    size_t inodes =
+        ctx->inode_reserve > 0 ? ctx->inode_reserve : INODE_TABLE_SIZE;
+    size_t blocks =
+        ctx->block_reserve > 0 ? ctx->block_reserve : DATA_BLOCKS;
+
+    if (ctx->shm != NULL) {
+        // already placed in the shared memory segment
+    } else if (ctx->fs_params.numa_mode == TFS_NUMA_NONE) {
+        ctx->inode_table =
+            array_alloc(INODE_TABLE_SIZE, ctx->inode_reserve, sizeof(inode_t));
+        ctx->fs_data = array_alloc(DATA_BLOCKS, ctx->block_reserve, BLOCK_SIZE);
+    } else {
+        ctx->numa_nodes = numa_node_count();
+        ctx->numa_stripe =
+            (DATA_BLOCKS + ctx->numa_nodes - 1) / ctx->numa_nodes;
+
+        ctx->inode_table = numa_region_alloc(inodes * sizeof(inode_t));
+        ctx->fs_data = numa_region_alloc(blocks * BLOCK_SIZE);
+    }
+
+    ctx->numa_stats = calloc(ctx->numa_nodes, sizeof(tfs_numa_node_stats_t));
+    if (!ctx->inode_table || !ctx->fs_data || !ctx->numa_stats) {
+        numa_state_destroy(ctx);
+        return -1;
+    }
+
+    // placement is best-effort, kernels without NUMA support refuse it and
+    // the default first-touch policy applies
+    switch (ctx->fs_params.numa_mode) {
+    case TFS_NUMA_INTERLEAVE:
+        numa_interleave(ctx->inode_table, inodes * sizeof(inode_t),
+                        ctx->numa_nodes);
+        numa_interleave(ctx->fs_data, blocks * BLOCK_SIZE, ctx->numa_nodes);
+        break;
+    case TFS_NUMA_LOCAL:
+        numa_interleave(ctx->inode_table, inodes * sizeof(inode_t),
+                        ctx->numa_nodes);
+        for (size_t node = 0; node < ctx->numa_nodes; node++) {
+            size_t first = node * ctx->numa_stripe;
+            if (first >= DATA_BLOCKS) {
+                break;
+            }
+            size_t count = DATA_BLOCKS - first < ctx->numa_stripe
+                               ? DATA_BLOCKS - first
+                               : ctx->numa_stripe;
+
+            numa_place(ctx->fs_data + first * BLOCK_SIZE, count * BLOCK_SIZE,
+                       node);
+        }
+        break;
+    case TFS_NUMA_NONE:
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+/**
+ * Release the regions allocated by numa_state_init (those it got, if it
+ * failed).
+ */
+static void numa_state_destroy(tfs_ctx_t *ctx) {
+    if (ctx->shm != NULL) {
+        // unmapped with the shared memory segment
+    } else if (ctx->fs_params.numa_mode == TFS_NUMA_NONE) {
+        array_free(ctx->inode_table, ctx->inode_reserve, sizeof(inode_t));
+        array_free(ctx->fs_data, ctx->block_reserve, BLOCK_SIZE);
+    } else {
+        size_t inodes =
+            ctx->inode_reserve > 0 ? ctx->inode_reserve : INODE_TABLE_SIZE;
+        size_t blocks =
+            ctx->block_reserve > 0 ? ctx->block_reserve : DATA_BLOCKS;
+
+        numa_region_free(ctx->inode_table, inodes * sizeof(inode_t));
+        numa_region_free(ctx->fs_data, blocks * BLOCK_SIZE);
+    }
+
+    ctx->inode_table = NULL;
+    ctx->fs_data = NULL;
+    free(ctx->numa_stats);
+    ctx->numa_stats = NULL;
+}
 
 /**
  * Do nothing, while preventing the compiler from performing any optimizations.
@@ -80,462 +424,3109 @@ static void touch_all_memory(void) { __asm volatile("" : : : "memory"); }
  * latencies as if such data structures were really stored in secondary memory.
  */
 static void insert_delay(void) {
+    STATS_START(start);
     for (int i = 0; i < DELAY; i++) {
         touch_all_memory();
     }
+    STATS_STOP(STATS_DELAY, start);
+}
+
+static inline checksum_stripe_t *checksum_stripe(tfs_ctx_t *ctx,
+                                                 size_t block_number) {
+    return &ctx->checksum_stripes[block_number % CHECKSUM_STRIPES];
 }
 
 /**
- * Initialize FS state.
+ * Compute the checksum of a block, accounting the time it takes (measured
+ * for one in CHECKSUM_TIME_SAMPLE of them, and scaled).
  *
- * Input:
- *   - params: TécnicoFS parameters
+ * Must be called with the block's stripe lock held.
+ */
+static uint32_t block_checksum(tfs_ctx_t *ctx, size_t block_number,
+                               checksum_stripe_t *stripe) {
+    if (stripe->cs_computed++ % CHECKSUM_TIME_SAMPLE != 0) {
+        return crc32c(0, &ctx->fs_data[block_number * BLOCK_SIZE],
+                      BLOCK_SIZE);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint32_t crc =
+        crc32c(0, &ctx->fs_data[block_number * BLOCK_SIZE], BLOCK_SIZE);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    stripe->cs_stats.checksum_ns +=
+        CHECKSUM_TIME_SAMPLE *
+        (uint64_t)((end.tv_sec - start.tv_sec) * 1000000000L +
+                   (end.tv_nsec - start.tv_nsec));
+
+    return crc;
+}
+
+/**
+ * Recompute the checksum of a block after it was modified.
+ */
+static void block_checksum_update(tfs_ctx_t *ctx, size_t block_number) {
+    if (!ctx->fs_params.checksums) {
+        return;
+    }
+
+    checksum_stripe_t *stripe = checksum_stripe(ctx, block_number);
+    mutex_lock(&stripe->cs_lock);
+    ctx->block_crcs[block_number] =
+        block_checksum(ctx, block_number, stripe);
+    ctx->block_crc_valid[block_number] = true;
+    stripe->cs_stats.updated++;
+    mutex_unlock(&stripe->cs_lock);
+}
+
+/**
+ * Forget the checksum of a block that is about to be modified (or was freed).
+ */
+static void block_checksum_invalidate(tfs_ctx_t *ctx, size_t block_number) {
+    if (!ctx->fs_params.checksums) {
+        return;
+    }
+
+    checksum_stripe_t *stripe = checksum_stripe(ctx, block_number);
+    mutex_lock(&stripe->cs_lock);
+    ctx->block_crc_valid[block_number] = false;
+    mutex_unlock(&stripe->cs_lock);
+}
+
+/**
+ * Check the contents of a block against its checksum.
+ *
+ * Returns false if the block is corrupted.
+ */
+static bool block_checksum_verify(tfs_ctx_t *ctx, size_t block_number) {
+    if (!ctx->fs_params.checksums) {
+        return true;
+    }
+
+    checksum_stripe_t *stripe = checksum_stripe(ctx, block_number);
+    mutex_lock(&stripe->cs_lock);
+
+    bool intact = true;
+    if (ctx->block_crc_valid[block_number]) {
+        intact = block_checksum(ctx, block_number, stripe) ==
+                 ctx->block_crcs[block_number];
+        stripe->cs_stats.verified++;
+        if (!intact) {
+            stripe->cs_stats.errors++;
+        }
+    }
+
+    mutex_unlock(&stripe->cs_lock);
+
+    return intact;
+}
+
+/**
+ * Verify a block for the background scrub, unless its stripe is in use.
+ */
+static void scrub_block(tfs_ctx_t *ctx, size_t block_number) {
+    checksum_stripe_t *stripe = checksum_stripe(ctx, block_number);
+    if (pthread_mutex_trylock(&stripe->cs_lock) != 0) {
+        return; // not idle, it will be verified by its readers anyway
+    }
+
+    if (ctx->block_crc_valid[block_number]) {
+        stripe->cs_stats.scrubbed++;
+        if (block_checksum(ctx, block_number, stripe) !=
+            ctx->block_crcs[block_number]) {
+            stripe->cs_stats.scrub_errors++;
+        }
+    }
+
+    mutex_unlock(&stripe->cs_lock);
+}
+
+/**
+ * Background scrub: every scrub_interval_ms, verify the next SCRUB_BATCH data
+ * blocks, running only when the CPU would otherwise be idle.
+ */
+static void *scrub_main(void *arg) {
+    tfs_ctx_t *ctx = arg;
+
+    struct sched_param param = {.sched_priority = 0};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+
+    size_t next = 0;
+    mutex_lock(&ctx->scrub_lock);
+    while (ctx->scrub_running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        size_t ns = (size_t)deadline.tv_nsec +
+                    ctx->fs_params.scrub_interval_ms % 1000 * 1000000;
+        deadline.tv_sec += (time_t)(ctx->fs_params.scrub_interval_ms / 1000 +
+                                    ns / 1000000000);
+        deadline.tv_nsec = (long)(ns % 1000000000);
+
+        cond_timedwait(&ctx->scrub_cond, &ctx->scrub_lock, &deadline);
+        if (!ctx->scrub_running) {
+            break;
+        }
+        mutex_unlock(&ctx->scrub_lock);
+
+        for (size_t n = 0; n < SCRUB_BATCH; n++) {
+            scrub_block(ctx, next);
+            next = (next + 1) % DATA_BLOCKS;
+        }
+
+        mutex_lock(&ctx->scrub_lock);
+    }
+    mutex_unlock(&ctx->scrub_lock);
+
+    return NULL;
+}
+
+/**
+ * Set up the block checksums and start the background scrub (if enabled).
  *
  * Returns 0 if successful, -1 otherwise.
+ */
+static int checksum_state_init(tfs_ctx_t *ctx) {
+    if (!ctx->fs_params.checksums) {
+        return 0;
+    }
+
+    crc32c_init();
+
+    ctx->block_crcs =
+        array_alloc(DATA_BLOCKS, ctx->block_reserve, sizeof(uint32_t));
+    ctx->block_crc_valid =
+        array_alloc(DATA_BLOCKS, ctx->block_reserve, sizeof(bool));
+    if (!ctx->block_crcs || !ctx->block_crc_valid) {
+        goto fail_arrays;
+    }
+
+    for (size_t i = 0; i < DATA_BLOCKS; i++) {
+        ctx->block_crc_valid[i] = false;
+    }
+
+    for (size_t i = 0; i < CHECKSUM_STRIPES; i++) {
+        mutex_init(&ctx->checksum_stripes[i].cs_lock);
+        memset(&ctx->checksum_stripes[i].cs_stats, 0,
+               sizeof(tfs_checksum_stats_t));
+        ctx->checksum_stripes[i].cs_computed = 0;
+    }
+
+    if (ctx->fs_params.scrub_interval_ms > 0) {
+        mutex_init(&ctx->scrub_lock);
+        cond_init(&ctx->scrub_cond);
+        ctx->scrub_running = true;
+        if (pthread_create(&ctx->scrub_thread, NULL, scrub_main, ctx) != 0) {
+            cond_destroy(&ctx->scrub_cond);
+            mutex_destroy(&ctx->scrub_lock);
+            goto fail_stripes;
+        }
+    }
+
+    return 0;
+
+fail_stripes:
+    for (size_t i = 0; i < CHECKSUM_STRIPES; i++) {
+        mutex_destroy(&ctx->checksum_stripes[i].cs_lock);
+    }
+fail_arrays:
+    array_free(ctx->block_crcs, ctx->block_reserve, sizeof(uint32_t));
+    array_free(ctx->block_crc_valid, ctx->block_reserve, sizeof(bool));
+    ctx->block_crcs = NULL;
+    ctx->block_crc_valid = NULL;
+    return -1;
+}
+
+/**
+ * Stop the background scrub and release the block checksums.
+ */
+static void checksum_state_destroy(tfs_ctx_t *ctx) {
+    if (!ctx->fs_params.checksums) {
+        return;
+    }
+
+    if (ctx->fs_params.scrub_interval_ms > 0) {
+        mutex_lock(&ctx->scrub_lock);
+        ctx->scrub_running = false;
+        cond_signal(&ctx->scrub_cond);
+        mutex_unlock(&ctx->scrub_lock);
+
+        pthread_join(ctx->scrub_thread, NULL);
+        cond_destroy(&ctx->scrub_cond);
+        mutex_destroy(&ctx->scrub_lock);
+    }
+
+    for (size_t i = 0; i < CHECKSUM_STRIPES; i++) {
+        mutex_destroy(&ctx->checksum_stripes[i].cs_lock);
+    }
+
+    array_free(ctx->block_crcs, ctx->block_reserve, sizeof(uint32_t));
+    array_free(ctx->block_crc_valid, ctx->block_reserve, sizeof(bool));
+    ctx->block_crcs = NULL;
+    ctx->block_crc_valid = NULL;
+}
+
+/**
+ * Read-ahead state of a data block.
+ */
+typedef enum {
+    BLOCK_COLD = 0,   // its next read makes the storage access
+    BLOCK_QUEUED = 1, // waiting for the read-ahead thread
+    BLOCK_WARM = 2,   // already loaded, its next read is served from memory
+} block_warmth_t;
+
+/**
+ * Read-ahead thread: make the storage access of the queued blocks, so that
+ * the reads that follow do not wait for it.
+ */
+static void *readahead_main(void *arg) {
+    tfs_ctx_t *ctx = arg;
+
+    mutex_lock(&ctx->readahead_lock);
+    while (true) {
+        while (ctx->readahead_count == 0 && ctx->readahead_running) {
+            cond_wait(&ctx->readahead_cond, &ctx->readahead_lock);
+        }
+        if (!ctx->readahead_running) {
+            break;
+        }
+
+        int block_number = ctx->readahead_queue[ctx->readahead_head];
+        ctx->readahead_head = (ctx->readahead_head + 1) % READAHEAD_QUEUE;
+        ctx->readahead_count--;
+        mutex_unlock(&ctx->readahead_lock);
+
+        insert_delay(); // simulate storage access delay to block
+        __atomic_store_n(&ctx->block_warmth[block_number], BLOCK_WARM,
+                         __ATOMIC_RELEASE);
+
+        mutex_lock(&ctx->readahead_lock);
+        ctx->readahead_stats.prefetched++;
+    }
+    mutex_unlock(&ctx->readahead_lock);
+
+    return NULL;
+}
+
+/**
+ * Start the read-ahead thread (if enabled).
  *
- * Possible errors:
- *   - TFS already initialized.
- *   - malloc failure when allocating TFS structures.
+ * Returns 0 if successful, -1 otherwise.
  */
-int state_init(tfs_params params) {
-    fs_params = params;
+static int readahead_state_init(tfs_ctx_t *ctx) {
+    ctx->block_warmth = NULL;
+    if (ctx->fs_params.readahead_blocks == 0) {
+        return 0;
+    }
 
-    if (inode_table != NULL) {
-        return -1; // already initialized
+    ctx->block_warmth =
+        array_alloc(DATA_BLOCKS, ctx->block_reserve, sizeof(char));
+    if (ctx->block_warmth == NULL) {
+        return -1;
+    }
+    memset(ctx->block_warmth, BLOCK_COLD, DATA_BLOCKS);
+
+    ctx->readahead_head = 0;
+    ctx->readahead_count = 0;
+    memset(&ctx->readahead_stats, 0, sizeof(ctx->readahead_stats));
+    mutex_init(&ctx->readahead_lock);
+    cond_init(&ctx->readahead_cond);
+    ctx->readahead_running = true;
+    if (pthread_create(&ctx->readahead_thread, NULL, readahead_main, ctx) !=
+        0) {
+        cond_destroy(&ctx->readahead_cond);
+        mutex_destroy(&ctx->readahead_lock);
+        array_free(ctx->block_warmth, ctx->block_reserve, sizeof(char));
+        ctx->block_warmth = NULL;
+        return -1;
     }
 
-    inode_table = malloc(INODE_TABLE_SIZE * sizeof(inode_t));
-    inode_rwl = malloc(INODE_TABLE_SIZE * sizeof(pthread_rwlock_t));
-    freeinode_ts = malloc(INODE_TABLE_SIZE * sizeof(allocation_state_t));
-    fs_data = malloc(DATA_BLOCKS * BLOCK_SIZE);
-    free_blocks = malloc(DATA_BLOCKS * sizeof(allocation_state_t));
-    open_file_table = malloc(MAX_OPEN_FILES * sizeof(open_file_entry_t));
-    free_open_file_entries =
-        malloc(MAX_OPEN_FILES * sizeof(allocation_state_t));
+    return 0;
+}
 
-    if (!inode_table || !freeinode_ts || !fs_data || !free_blocks ||
-        !open_file_table || !free_open_file_entries) {
-        return -1; // allocation failed
+/**
+ * Stop the read-ahead thread (the queued blocks are left unread).
+ */
+static void readahead_state_destroy(tfs_ctx_t *ctx) {
+    if (ctx->block_warmth == NULL) {
+        return;
     }
 
-    for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
-        freeinode_ts[i] = FREE;
+    mutex_lock(&ctx->readahead_lock);
+    ctx->readahead_running = false;
+    cond_signal(&ctx->readahead_cond);
+    mutex_unlock(&ctx->readahead_lock);
+
+    pthread_join(ctx->readahead_thread, NULL);
+    cond_destroy(&ctx->readahead_cond);
+    mutex_destroy(&ctx->readahead_lock);
+
+    array_free(ctx->block_warmth, ctx->block_reserve, sizeof(char));
+    ctx->block_warmth = NULL;
+}
+
+/**
+ * Open the spill file (if tiering is enabled). It is unlinked right away, so
+ * it only lives as long as the instance.
+ *
+ * Returns 0 if successful, -1 otherwise (and tiering is left disabled).
+ */
+static int spill_state_init(tfs_ctx_t *ctx) {
+    ctx->spill_fd = -1;
+    ctx->spill_free_slots = NULL;
+    ctx->block_referenced = NULL;
+    if (ctx->fs_params.spill_block_count == 0) {
+        return 0;
     }
 
-    for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        free_blocks[i] = FREE;
+    ctx->spill_fd =
+        open(ctx->fs_params.spill_path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (ctx->spill_fd == -1) {
+        return -1;
+    }
+    unlink(ctx->fs_params.spill_path);
+
+    size_t slots = ctx->fs_params.spill_block_count;
+    ctx->spill_free_slots = malloc(slots * sizeof(size_t));
+    ctx->block_referenced =
+        array_alloc(DATA_BLOCKS, ctx->block_reserve, sizeof(bool));
+    if (!ctx->spill_free_slots || !ctx->block_referenced) {
+        close(ctx->spill_fd);
+        ctx->spill_fd = -1;
+        free(ctx->spill_free_slots);
+        ctx->spill_free_slots = NULL;
+        if (ctx->block_referenced != NULL) {
+            array_free(ctx->block_referenced, ctx->block_reserve,
+                       sizeof(bool));
+            ctx->block_referenced = NULL;
+        }
+        return -1;
     }
 
-    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
-        free_open_file_entries[i] = FREE;
+    // slots are handed out from the start of the file
+    for (size_t i = 0; i < slots; i++) {
+        ctx->spill_free_slots[i] = slots - 1 - i;
+    }
+    ctx->spill_free_count = slots;
+    memset(ctx->block_referenced, false, DATA_BLOCKS * sizeof(bool));
+    ctx->spill_hand_inode = 0;
+    ctx->spill_hand_index = 0;
+    memset(&ctx->spill_stats, 0, sizeof(ctx->spill_stats));
+    mutex_init(&ctx->spill_lock);
+
+    return 0;
+}
+
+/**
+ * Close the spill file (dropping the blocks in it).
+ */
+static void spill_state_destroy(tfs_ctx_t *ctx) {
+    if (ctx->spill_fd == -1) {
+        return;
     }
 
-    rwl_init(&inode_table_rwl);
-    rwl_init(&free_blocks_rwl);
-    rwl_init(&open_file_table_rwl);
+    close(ctx->spill_fd);
+    ctx->spill_fd = -1;
+    mutex_destroy(&ctx->spill_lock);
+    free(ctx->spill_free_slots);
+    ctx->spill_free_slots = NULL;
+    array_free(ctx->block_referenced, ctx->block_reserve, sizeof(bool));
+    ctx->block_referenced = NULL;
+}
 
-    for (int i = 0; i < INODE_TABLE_SIZE; ++i) {
-        rwl_init(&inode_rwl[i]);
+/**
+ * Note that a data block was used, for the clock sweep of the tiered storage.
+ */
+static inline void block_touch(tfs_ctx_t *ctx, int block_number) {
+    if (ctx->block_referenced != NULL) {
+        __atomic_store_n(&ctx->block_referenced[block_number], true,
+                         __ATOMIC_RELAXED);
     }
+}
 
-    for (int i = 0; i < MAX_OPEN_FILES; ++i) {
-        mutex_init(&open_file_table[i].lock);
+/**
+ * Move the data block backing a chunk of a file to a free slot of the spill
+ * file. Must be called with spill_lock held, a free slot, and the inode's
+ * lock held for writing.
+ *
+ * Returns 0 if successful, -1 otherwise (the block is left in memory).
+ */
+static int chunk_spill(tfs_ctx_t *ctx, inode_t *inode, size_t index) {
+    int block_number = inode->i_data_blocks[index];
+
+    // moving a shared block would not free it
+    rwl_rdlock(&ctx->free_blocks_rwl);
+    bool shared = ctx->block_refs[block_number] != 1;
+    rwl_unlock(&ctx->free_blocks_rwl);
+    if (shared || inode->i_zlengths[index] != 0) {
+        return -1;
     }
 
+    // a corrupted block is left for the reads of the file to report
+    char const *block = data_block_get(ctx, block_number);
+    if (block == NULL) {
+        return -1;
+    }
+
+    size_t slot = ctx->spill_free_slots[ctx->spill_free_count - 1];
+    if (pwrite(ctx->spill_fd, block, BLOCK_SIZE, (off_t)(slot * BLOCK_SIZE)) !=
+        (ssize_t)BLOCK_SIZE) {
+        return -1;
+    }
+    ctx->spill_free_count--;
+    inode->i_data_blocks[index] = CHUNK_SPILLED(slot);
+    data_block_free(ctx, block_number);
+
+    ctx->spill_stats.spilled++;
+    ctx->spill_stats.evictions++;
     return 0;
 }
 
 /**
- * Destroy FS state.
+ * Advance the clock hand of the tiered storage through the chunks of a file,
+ * moving the first block it finds not referenced since the last sweep to the
+ * spill file. Must be called with spill_lock held, a free slot, and the
+ * inode's lock held for writing.
  *
- * Returns 0 if succesful, -1 otherwise.
+ * Returns 0 if a block was moved, -1 if the hand reached the end of the file.
  */
-int state_destroy(void) {
+static int spill_sweep(tfs_ctx_t *ctx, inode_t *inode) {
+    if (inode->i_node_type != T_FILE || inode->i_inline ||
+        inode->i_compressed) {
+        return -1;
+    }
 
-    // destroy all inode rwlocks
-    for (int i = 0; i < INODE_TABLE_SIZE; ++i) {
-        rwl_destroy(&inode_rwl[i]);
+    while (ctx->spill_hand_index < MAX_FILE_BLOCKS) {
+        size_t index = ctx->spill_hand_index++;
+        int block_number = inode->i_data_blocks[index];
+        if (block_number < 0 ||
+            __atomic_exchange_n(&ctx->block_referenced[block_number], false,
+                                __ATOMIC_RELAXED)) {
+            continue; // hole, already spilled, or gets a second chance
+        }
+
+        if (chunk_spill(ctx, inode, index) == 0) {
+            return 0;
+        }
     }
 
-    // destroy all open file entry mutexes
-    for (int i = 0; i < MAX_OPEN_FILES; ++i) {
-        mutex_destroy(&open_file_table[i].lock);
+    return -1;
+}
+
+/**
+ * Make room in memory by moving a cold file block to the spill file.
+ *
+ * Files whose lock cannot be taken right away (because they are in use,
+ * possibly by the caller) are skipped by the sweep, so their blocks stay in
+ * memory while they are being read or written.
+ *
+ * Returns 0 if a data block was freed, -1 otherwise.
+ */
+static int spill_evict(tfs_ctx_t *ctx) {
+    if (ctx->spill_fd == -1) {
+        return -1;
+    }
+
+    mutex_lock(&ctx->spill_lock);
+    // inodes cannot be deleted while their blocks are looked at
+    if (ctx->spill_free_count == 0 ||
+        pthread_rwlock_tryrdlock(&ctx->inode_table_rwl) != 0) {
+        mutex_unlock(&ctx->spill_lock);
+        return -1;
     }
 
-    free(inode_table);
-    free(inode_rwl);
-    free(freeinode_ts);
-    free(fs_data);
-    free(free_blocks);
-    free(open_file_table);
-    free(free_open_file_entries);
+    // two turns of the clock: the first one may only clear reference bits
+    size_t inodes = INODE_TABLE_SIZE;
+    int result = -1;
+    for (size_t n = 0; n <= 2 * inodes && result == -1; n++) {
+        size_t inumber = ctx->spill_hand_inode % inodes;
+        pthread_rwlock_t *inode_rwl = &ctx->inode_rwl[inumber];
+        if (ctx->freeinode_ts[inumber] == TAKEN &&
+            pthread_rwlock_trywrlock(inode_rwl) == 0) {
+            result = spill_sweep(ctx, &ctx->inode_table[inumber]);
+            pthread_rwlock_unlock(inode_rwl);
+        }
+
+        if (result == -1) {
+            ctx->spill_hand_inode = (inumber + 1) % inodes;
+            ctx->spill_hand_index = 0;
+        }
+    }
+
+    pthread_rwlock_unlock(&ctx->inode_table_rwl);
+    mutex_unlock(&ctx->spill_lock);
+    return result;
+}
+
+/**
+ * Give a slot of the spill file back (its chunk was dropped).
+ */
+static void spill_slot_free(tfs_ctx_t *ctx, size_t slot) {
+    mutex_lock(&ctx->spill_lock);
+    ctx->spill_free_slots[ctx->spill_free_count++] = slot;
+    ctx->spill_stats.spilled--;
+    mutex_unlock(&ctx->spill_lock);
+}
+
+/**
+ * Record where a shared array starts in a shared memory segment, on its own
+ * cache line.
+ *
+ * Returns the size of the segment once the array is added.
+ */
+static size_t shm_reserve(size_t size, size_t *offset, size_t bytes) {
+    *offset = size;
+    return size + (bytes + 63) / 64 * 64;
+}
+
+/**
+ * Lay the shared arrays out in a shared memory segment, after its header.
+ *
+ * Returns the size of the segment.
+ */
+static size_t shm_layout(tfs_ctx_t *ctx, shm_header_t *header) {
+    (void)ctx; // the limits are compiled in with TFS_STATIC_PARAMS
+    size_t size = (sizeof(shm_header_t) + 63) / 64 * 64;
+    size = shm_reserve(size, &header->sh_inode_table,
+                       INODE_TABLE_SIZE * sizeof(inode_t));
+    size = shm_reserve(size, &header->sh_inode_rwl,
+                       INODE_TABLE_SIZE * sizeof(pthread_rwlock_t));
+    size = shm_reserve(size, &header->sh_inode_ranges,
+                       INODE_TABLE_SIZE * sizeof(range_lock_t));
+    size = shm_reserve(size, &header->sh_freeinode_ts,
+                       INODE_TABLE_SIZE * sizeof(allocation_state_t));
+    size = shm_reserve(size, &header->sh_free_blocks,
+                       DATA_BLOCKS * sizeof(allocation_state_t));
+    size = shm_reserve(size, &header->sh_block_refs,
+                       DATA_BLOCKS * sizeof(unsigned int));
+    size = shm_reserve(size, &header->sh_inode_opens,
+                       INODE_TABLE_SIZE * sizeof(unsigned int));
+    return shm_reserve(size, &header->sh_fs_data, DATA_BLOCKS * BLOCK_SIZE);
+}
+
+/**
+ * Point the state at the shared arrays of the mapped segment.
+ */
+static void shm_map_arrays(tfs_ctx_t *ctx) {
+    char *base = (char *)ctx->shm;
+    ctx->inode_table = (void *)(base + ctx->shm->sh_inode_table);
+    ctx->inode_rwl = (void *)(base + ctx->shm->sh_inode_rwl);
+    ctx->inode_ranges = (void *)(base + ctx->shm->sh_inode_ranges);
+    ctx->freeinode_ts = (void *)(base + ctx->shm->sh_freeinode_ts);
+    ctx->free_blocks = (void *)(base + ctx->shm->sh_free_blocks);
+    ctx->block_refs = (void *)(base + ctx->shm->sh_block_refs);
+    ctx->inode_opens = (void *)(base + ctx->shm->sh_inode_opens);
+    ctx->fs_data = base + ctx->shm->sh_fs_data;
+}
+
+/**
+ * Create the shared memory segment the inode table, the data blocks, their
+ * allocation maps and the inode locks are placed in (if shm_name is set),
+ * for other processes to attach to (see state_attach). The arrays are then
+ * initialized as usual, with process-shared locks.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int shm_state_init(tfs_ctx_t *ctx) {
+    ctx->shm = NULL;
+    ctx->shm_name = NULL;
+    ctx->shm_attached = false;
+    ctx->inode_opens = NULL;
+    if (ctx->fs_params.shm_name == NULL) {
+        return 0;
+    }
+
+    shm_header_t layout;
+    memset(&layout, 0, sizeof(layout));
+    size_t size = shm_layout(ctx, &layout);
+
+    int fd =
+        shm_open(ctx->fs_params.shm_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1) {
+        return -1;
+    }
+    void *base = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0) {
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    ctx->shm_name = strdup(ctx->fs_params.shm_name);
+    if (base == MAP_FAILED || ctx->shm_name == NULL) {
+        if (base != MAP_FAILED) {
+            munmap(base, size);
+        }
+        shm_unlink(ctx->fs_params.shm_name);
+        free(ctx->shm_name);
+        ctx->shm_name = NULL;
+        return -1;
+    }
+
+    // the magic number is only set once the state is initialized
+    ctx->shm = base;
+    *ctx->shm = layout;
+    ctx->shm->sh_size = size;
+    ctx->shm->sh_params = ctx->fs_params;
+    ctx->shm->sh_params.shm_name = NULL; // pointers mean nothing to others
+    ctx->shm->sh_params.spill_path = NULL;
+    shm_map_arrays(ctx);
+
+    return 0;
+}
+
+/**
+ * Unmap the shared memory segment (if any), removing it if this instance
+ * created it. Processes still attached keep their mapping.
+ */
+static void shm_state_destroy(tfs_ctx_t *ctx) {
+    if (ctx->shm == NULL) {
+        return;
+    }
+
+    if (!ctx->shm_attached) {
+        shm_unlink(ctx->shm_name);
+        free(ctx->shm_name);
+        ctx->shm_name = NULL;
+    }
+    munmap(ctx->shm, ctx->shm->sh_size);
+    ctx->shm = NULL;
+    ctx->shm_attached = false;
+    ctx->inode_opens = NULL;
+}
+
+static void table_state_destroy(tfs_ctx_t *ctx);
+static void dedup_state_destroy(tfs_ctx_t *ctx);
+
+/**
+ * Set up the allocation maps of the inodes and data blocks, the inode locks
+ * (which are initialized once the rest of the state is) and the locks of the
+ * tables. Those of a shared memory segment are already placed in it, and
+ * only its owner initializes them.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int table_state_init(tfs_ctx_t *ctx) {
+    rwl_init(&ctx->inode_table_rwl);
+    rwl_init(&ctx->free_blocks_rwl);
+    if (ctx->shm == NULL) {
+        ctx->inode_rwl = array_alloc(INODE_TABLE_SIZE, ctx->inode_reserve,
+                                     sizeof(pthread_rwlock_t));
+        ctx->inode_ranges = array_alloc(INODE_TABLE_SIZE, ctx->inode_reserve,
+                                        sizeof(range_lock_t));
+        ctx->freeinode_ts = array_alloc(INODE_TABLE_SIZE, ctx->inode_reserve,
+                                        sizeof(allocation_state_t));
+        ctx->free_blocks = array_alloc(DATA_BLOCKS, ctx->block_reserve,
+                                       sizeof(allocation_state_t));
+        ctx->block_refs =
+            array_alloc(DATA_BLOCKS, ctx->block_reserve, sizeof(unsigned int));
+        if (!ctx->inode_rwl || !ctx->inode_ranges || !ctx->freeinode_ts ||
+            !ctx->free_blocks || !ctx->block_refs) {
+            table_state_destroy(ctx);
+            return -1; // allocation failed
+        }
+    }
+
+    if (!ctx->shm_attached) {
+        for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
+            ctx->freeinode_ts[i] = FREE;
+        }
+
+        for (size_t i = 0; i < DATA_BLOCKS; i++) {
+            ctx->free_blocks[i] = FREE;
+            ctx->block_refs[i] = 0;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Release the tables set up by table_state_init (those it got, if it failed).
+ */
+static void table_state_destroy(tfs_ctx_t *ctx) {
+    if (ctx->shm == NULL) {
+        array_free(ctx->inode_rwl, ctx->inode_reserve,
+                   sizeof(pthread_rwlock_t));
+        array_free(ctx->inode_ranges, ctx->inode_reserve,
+                   sizeof(range_lock_t));
+        array_free(ctx->freeinode_ts, ctx->inode_reserve,
+                   sizeof(allocation_state_t));
+        array_free(ctx->free_blocks, ctx->block_reserve,
+                   sizeof(allocation_state_t));
+        array_free(ctx->block_refs, ctx->block_reserve, sizeof(unsigned int));
+    }
+    ctx->inode_rwl = NULL;
+    ctx->inode_ranges = NULL;
+    ctx->freeinode_ts = NULL;
+    ctx->free_blocks = NULL;
+    ctx->block_refs = NULL;
+
+    rwl_destroy(&ctx->inode_table_rwl);
+    rwl_destroy(&ctx->free_blocks_rwl);
+}
+
+/**
+ * Set up the index of the data blocks' contents (if deduplication is
+ * enabled).
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int dedup_state_init(tfs_ctx_t *ctx) {
+    memset(&ctx->dedup_stats, 0, sizeof(ctx->dedup_stats));
+    if (!ctx->fs_params.dedup) {
+        return 0;
+    }
+
+    ctx->dedup_bucket_count = DATA_BLOCKS;
+    ctx->block_hashes =
+        array_alloc(DATA_BLOCKS, ctx->block_reserve, sizeof(uint64_t));
+    ctx->block_indexed =
+        array_alloc(DATA_BLOCKS, ctx->block_reserve, sizeof(bool));
+    ctx->dedup_buckets = malloc(ctx->dedup_bucket_count * sizeof(int));
+    ctx->dedup_next = array_alloc(DATA_BLOCKS, ctx->block_reserve, sizeof(int));
+    if (!ctx->block_hashes || !ctx->block_indexed || !ctx->dedup_buckets ||
+        !ctx->dedup_next) {
+        dedup_state_destroy(ctx);
+        return -1; // allocation failed
+    }
+
+    for (size_t i = 0; i < DATA_BLOCKS; i++) {
+        ctx->block_indexed[i] = false;
+        ctx->dedup_buckets[i] = -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Release the index set up by dedup_state_init (what it got, if it failed).
+ */
+static void dedup_state_destroy(tfs_ctx_t *ctx) {
+    if (!ctx->fs_params.dedup) {
+        return;
+    }
+
+    array_free(ctx->block_hashes, ctx->block_reserve, sizeof(uint64_t));
+    array_free(ctx->block_indexed, ctx->block_reserve, sizeof(bool));
+    free(ctx->dedup_buckets);
+    array_free(ctx->dedup_next, ctx->block_reserve, sizeof(int));
+    ctx->block_hashes = NULL;
+    ctx->block_indexed = NULL;
+    ctx->dedup_buckets = NULL;
+    ctx->dedup_next = NULL;
+}
+
+/**
+ * Initialize the state that is private to an instance, whether its tables
+ * are its own or attached to: the open file table and the compressed block
+ * cache (which only the owner uses, see inode_block_read).
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int local_state_init(tfs_ctx_t *ctx) {
+    ctx->compress_cache_data = malloc(COMPRESS_CACHE_ENTRIES * BLOCK_SIZE);
+    ctx->open_file_table = malloc(MAX_OPEN_FILES * sizeof(open_file_entry_t));
+    ctx->free_open_file_entries =
+        malloc(MAX_OPEN_FILES * sizeof(allocation_state_t));
+    ctx->orphans = malloc(
+        (ctx->shm != NULL ? INODE_TABLE_SIZE : MAX_OPEN_FILES) * sizeof(int));
+    if (!ctx->compress_cache_data || !ctx->open_file_table ||
+        !ctx->free_open_file_entries || !ctx->orphans) {
+        free(ctx->compress_cache_data);
+        free(ctx->open_file_table);
+        free(ctx->free_open_file_entries);
+        free(ctx->orphans);
+        ctx->compress_cache_data = NULL;
+        ctx->open_file_table = NULL;
+        ctx->free_open_file_entries = NULL;
+        ctx->orphans = NULL;
+        return -1; // allocation failed
+    }
+
+    for (size_t i = 0; i < COMPRESS_CACHE_ENTRIES; i++) {
+        ctx->compress_cache[i].zc_valid = false;
+        ctx->compress_cache[i].zc_data =
+            ctx->compress_cache_data + i * BLOCK_SIZE;
+        mutex_init(&ctx->compress_cache[i].zc_lock);
+    }
+    memset(&ctx->compress_stats, 0, sizeof(ctx->compress_stats));
+    mutex_init(&ctx->compress_stats_lock);
+
+    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
+        ctx->free_open_file_entries[i] = FREE;
+        mutex_init(&ctx->open_file_table[i].lock);
+        mutex_init(&ctx->open_file_table[i].of_wbuf_lock);
+        ctx->open_file_table[i].of_wbuf = NULL;
+    }
+    rwl_init(&ctx->open_file_table_rwl);
+    ctx->orphan_count = 0;
+
+    return 0;
+}
+
+/**
+ * Destroy the state initialized by local_state_init.
+ */
+static void local_state_destroy(tfs_ctx_t *ctx) {
+    // destroy all open file entry mutexes
+    for (int i = 0; i < MAX_OPEN_FILES; ++i) {
+        if (ctx->shm_attached && ctx->free_open_file_entries[i] == TAKEN) {
+            // the owner may delete the file once it is unlinked
+            __atomic_sub_fetch(
+                &ctx->inode_opens[ctx->open_file_table[i].of_inumber], 1,
+                __ATOMIC_RELEASE);
+        }
+        mutex_destroy(&ctx->open_file_table[i].lock);
+        mutex_destroy(&ctx->open_file_table[i].of_wbuf_lock);
+        free(ctx->open_file_table[i].of_wbuf); // handles left open
+    }
+    rwl_destroy(&ctx->open_file_table_rwl);
+
+    for (size_t i = 0; i < COMPRESS_CACHE_ENTRIES; i++) {
+        mutex_destroy(&ctx->compress_cache[i].zc_lock);
+    }
+    mutex_destroy(&ctx->compress_stats_lock);
+
+    free(ctx->compress_cache_data);
+    free(ctx->open_file_table);
+    free(ctx->free_open_file_entries);
+    free(ctx->orphans); // left open, freed with the rest of the state
+    ctx->compress_cache_data = NULL;
+    ctx->open_file_table = NULL;
+    ctx->free_open_file_entries = NULL;
+    ctx->orphans = NULL;
+}
+
+/**
+ * Initialize FS state.
+ *
+ * Input:
+ *   - params: TécnicoFS parameters
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - TFS already initialized.
+ *   - malloc failure when allocating TFS structures.
+ *   - inline_threshold larger than INODE_INLINE_SIZE.
+ *   - max_file_blocks is 0 or larger than INODE_DIRECT_BLOCKS.
+ *   - scrub_interval_ms set without checksums.
+ *   - spill_block_count set without a spill_path, or too large.
+ *   - The spill file cannot be created (or already exists).
+ *   - shm_name set with NUMA placement, a growth reserve or a spill file.
+ *   - The shared memory segment cannot be created (or already exists).
+ *   - Growth reserved with TFS_NUMA_LOCAL placement.
+ *   - (specialized build) params differ from the compiled-in limits, or
+ *     reserve room to grow past them.
+ */
+int state_init(tfs_ctx_t *ctx, tfs_params params) {
+#ifdef TFS_STATIC_PARAMS
+    // a specialized build only supports the limits it was compiled with
+    if (params.max_inode_count != INODE_TABLE_SIZE ||
+        params.max_block_count != DATA_BLOCKS ||
+        params.max_open_files_count != MAX_OPEN_FILES ||
+        params.block_size != BLOCK_SIZE ||
+        params.max_file_blocks != MAX_FILE_BLOCKS ||
+        params.max_inode_reserve > INODE_TABLE_SIZE ||
+        params.max_block_reserve > DATA_BLOCKS) {
+        return -1;
+    }
+#endif
+
+#ifdef TFS_STATS
+    // the lock wrappers (utils/utils.c) time lock waits for the histograms
+    lock_wait_hook_set(stats_lock_wait);
+#endif
+
+    if (params.inline_threshold > INODE_INLINE_SIZE) {
+        return -1; // inline data does not fit in the inode
+    }
+
+    if (params.max_file_blocks == 0 ||
+        params.max_file_blocks > INODE_DIRECT_BLOCKS) {
+        return -1; // files must fit in their inode's block slots
+    }
+
+    if (params.scrub_interval_ms > 0 && !params.checksums) {
+        return -1; // nothing to scrub
+    }
+
+    if (params.spill_block_count > 0 &&
+        (params.spill_path == NULL ||
+         params.spill_block_count > (size_t)INT_MAX - 1)) {
+        return -1; // slots must be told apart from blocks in i_data_blocks
+    }
+
+    if (ctx->inode_table != NULL) {
+        return -1; // already initialized
+    }
+
+    ctx->fs_params = params;
+    ctx->inode_reserve = params.max_inode_reserve > params.max_inode_count
+                             ? params.max_inode_reserve
+                             : 0;
+    ctx->block_reserve = params.max_block_reserve > params.max_block_count
+                             ? params.max_block_reserve
+                             : 0;
+
+    if ((ctx->inode_reserve > 0 || ctx->block_reserve > 0) &&
+        params.numa_mode == TFS_NUMA_LOCAL) {
+        return -1; // node stripes are fixed at init
+    }
+
+    if (params.shm_name != NULL &&
+        (params.numa_mode != TFS_NUMA_NONE || ctx->inode_reserve > 0 ||
+         ctx->block_reserve > 0 || params.spill_block_count > 0)) {
+        return -1; // attached processes only see the segment as laid out
+    }
+
+    // first, so that a spill file that cannot be created leaves nothing behind
+    if (spill_state_init(ctx) != 0) {
+        return -1;
+    }
+    if (shm_state_init(ctx) != 0) {
+        goto fail_spill;
+    }
+    if (numa_state_init(ctx) != 0) {
+        goto fail_shm;
+    }
+    if (table_state_init(ctx) != 0) {
+        goto fail_numa;
+    }
+    if (dedup_state_init(ctx) != 0) {
+        goto fail_tables;
+    }
+    if (checksum_state_init(ctx) != 0) {
+        goto fail_dedup;
+    }
+    if (readahead_state_init(ctx) != 0) {
+        goto fail_checksum;
+    }
+    if (local_state_init(ctx) != 0) {
+        goto fail_readahead;
+    }
+
+    // attached processes take the range locks (and, briefly, the root
+    // directory's and inodes' locks, to open files)
+    bool shared = ctx->shm != NULL;
+    for (int i = 0; i < INODE_TABLE_SIZE; ++i) {
+        if (shared) {
+            rwl_init_shared(&ctx->inode_rwl[i]);
+        } else {
+            rwl_init(&ctx->inode_rwl[i]);
+        }
+        range_lock_init(&ctx->inode_ranges[i], shared);
+    }
+
+    if (shared) {
+        __atomic_store_n(&ctx->shm->sh_magic, SHM_MAGIC, __ATOMIC_RELEASE);
+    }
+
+    return 0;
+
+    // undo the steps that succeeded, in the reverse order (see state_destroy)
+fail_readahead:
+    readahead_state_destroy(ctx);
+fail_checksum:
+    checksum_state_destroy(ctx);
+fail_dedup:
+    dedup_state_destroy(ctx);
+fail_tables:
+    table_state_destroy(ctx);
+fail_numa:
+    numa_state_destroy(ctx);
+fail_shm:
+    shm_state_destroy(ctx);
+fail_spill:
+    spill_state_destroy(ctx);
+    return -1;
+}
+
+/**
+ * Attach to the state another instance placed in a shared memory segment
+ * (see shm_name in tfs_params), to read it from this process.
+ *
+ * The instance is read-only (see state_read_only): the owner stays the only
+ * writer. Reads take the files' (robust) range locks rather than their inode
+ * locks, which the owner waits for when it locks an inode for writing.
+ * The open file table, the caches and the background threads are private to
+ * the instance; the owner's deduplication, checksums and read-ahead are not
+ * used by it.
+ *
+ * Input:
+ *   - shm_name: name of the shared memory segment
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - TFS already initialized.
+ *   - No such segment, or its owner has not finished initializing it.
+ *   - (specialized build) the segment's limits differ from the compiled-in
+ *     ones.
+ */
+int state_attach(tfs_ctx_t *ctx, char const *shm_name) {
+    if (ctx->inode_table != NULL) {
+        return -1; // already initialized
+    }
+
+#ifdef TFS_STATS
+    // the lock wrappers (utils/utils.c) time lock waits for the histograms
+    lock_wait_hook_set(stats_lock_wait);
+#endif
+
+    int fd = shm_open(shm_name, O_RDWR, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    void *base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(shm_header_t)) {
+        base = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+
+    shm_header_t *header = base;
+    tfs_params params = header->sh_params;
+    if (__atomic_load_n(&header->sh_magic, __ATOMIC_ACQUIRE) != SHM_MAGIC ||
+        header->sh_size != (size_t)st.st_size
+#ifdef TFS_STATIC_PARAMS
+        || params.max_inode_count != INODE_TABLE_SIZE ||
+        params.max_block_count != DATA_BLOCKS ||
+        params.max_open_files_count != MAX_OPEN_FILES ||
+        params.block_size != BLOCK_SIZE ||
+        params.max_file_blocks != MAX_FILE_BLOCKS
+#endif
+    ) {
+        munmap(base, (size_t)st.st_size);
+        return -1;
+    }
+
+    params.dedup = false;
+    params.checksums = false;
+    params.scrub_interval_ms = 0;
+    params.readahead_blocks = 0;
+    params.async_workers = 0;
+    ctx->fs_params = params;
+    ctx->inode_reserve = 0;
+    ctx->block_reserve = 0;
+    ctx->shm = header;
+    ctx->shm_name = NULL;
+    ctx->shm_attached = true;
+    shm_map_arrays(ctx);
+
+    // the same steps as state_init, those turned off above do nothing
+    if (spill_state_init(ctx) != 0) {
+        goto fail_shm;
+    }
+    if (numa_state_init(ctx) != 0) {
+        goto fail_spill;
+    }
+    if (table_state_init(ctx) != 0) {
+        goto fail_numa;
+    }
+    if (checksum_state_init(ctx) != 0) {
+        goto fail_tables;
+    }
+    if (readahead_state_init(ctx) != 0) {
+        goto fail_checksum;
+    }
+    if (local_state_init(ctx) != 0) {
+        goto fail_readahead;
+    }
+
+    return 0;
+
+fail_readahead:
+    readahead_state_destroy(ctx);
+fail_checksum:
+    checksum_state_destroy(ctx);
+fail_tables:
+    table_state_destroy(ctx);
+fail_numa:
+    numa_state_destroy(ctx);
+fail_spill:
+    spill_state_destroy(ctx);
+fail_shm:
+    shm_state_destroy(ctx);
+    return -1;
+}
+
+/**
+ * Whether the instance is attached to another one's shared memory segment,
+ * which it can only read.
+ */
+bool state_read_only(tfs_ctx_t *ctx) { return ctx->shm_attached; }
+
+/**
+ * Whether the instance placed its state in a shared memory segment, which
+ * other processes may be attached to (see shm_name in tfs_params).
+ */
+bool state_shared(tfs_ctx_t *ctx) {
+    return ctx->shm != NULL && !ctx->shm_attached;
+}
+
+/**
+ * Destroy FS state.
+ *
+ * Returns 0 if succesful, -1 otherwise.
+ */
+int state_destroy(tfs_ctx_t *ctx) {
+    spill_state_destroy(ctx);
+    readahead_state_destroy(ctx);
+    checksum_state_destroy(ctx);
+
+    // destroy all inode rwlocks (those of a shared segment are its owner's)
+    if (!ctx->shm_attached) {
+        for (int i = 0; i < INODE_TABLE_SIZE; ++i) {
+            rwl_destroy(&ctx->inode_rwl[i]);
+            range_lock_destroy(&ctx->inode_ranges[i]);
+        }
+    }
+
+    local_state_destroy(ctx);
+    dedup_state_destroy(ctx);
+    table_state_destroy(ctx);
+    numa_state_destroy(ctx);
+    shm_state_destroy(ctx);
+
+    return 0;
+}
+
+/**
+ * Grow the inode table and the data region (and their allocation maps) of a
+ * live FS, within the address space reserved by state_init. Nothing moves, so
+ * pointers to inodes and data blocks stay valid.
+ *
+ * Input:
+ *   - inode_count: new number of inodes
+ *   - block_count: new number of data blocks
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - TFS not initialized.
+ *   - A count is lower than the current one, or above its reserve.
+ *   - The FS is in a shared memory segment.
+ *   - (specialized build) the limits are compiled in.
+ */
+int state_grow(tfs_ctx_t *ctx, size_t inode_count, size_t block_count) {
+#ifdef TFS_STATIC_PARAMS
+    (void)ctx;
+    (void)inode_count;
+    (void)block_count;
+    return -1;
+#else
+    if (ctx->inode_table == NULL || ctx->shm != NULL) {
+        return -1;
+    }
+
+    // same order as inode_delete (inode table, then data blocks)
+    rwl_wrlock(&ctx->inode_table_rwl);
+    rwl_wrlock(&ctx->free_blocks_rwl);
+
+    size_t inodes = INODE_TABLE_SIZE;
+    size_t blocks = DATA_BLOCKS;
+    if (inode_count < inodes || block_count < blocks ||
+        (inode_count > inodes && inode_count > ctx->inode_reserve) ||
+        (block_count > blocks && block_count > ctx->block_reserve)) {
+        rwl_unlock(&ctx->free_blocks_rwl);
+        rwl_unlock(&ctx->inode_table_rwl);
+        return -1;
+    }
+
+    insert_delay(); // simulate storage access delay (to freeinode_ts)
+    for (size_t i = inodes; i < inode_count; i++) {
+        ctx->freeinode_ts[i] = FREE;
+        rwl_init(&ctx->inode_rwl[i]);
+        range_lock_init(&ctx->inode_ranges[i], false);
+    }
+
+    insert_delay(); // simulate storage access delay (to free_blocks)
+    for (size_t i = blocks; i < block_count; i++) {
+        ctx->free_blocks[i] = FREE;
+        ctx->block_refs[i] = 0;
+        if (ctx->fs_params.dedup) {
+            ctx->block_indexed[i] = false;
+        }
+        if (ctx->fs_params.checksums) {
+            ctx->block_crc_valid[i] = false;
+        }
+        if (ctx->block_warmth != NULL) {
+            ctx->block_warmth[i] = BLOCK_COLD;
+        }
+        if (ctx->block_referenced != NULL) {
+            ctx->block_referenced[i] = false;
+        }
+    }
+
+    // publish the new entries (lock free readers only check bounds)
+    __atomic_store_n(&ctx->fs_params.max_inode_count, inode_count,
+                     __ATOMIC_RELEASE);
+    __atomic_store_n(&ctx->fs_params.max_block_count, block_count,
+                     __ATOMIC_RELEASE);
+
+    rwl_unlock(&ctx->free_blocks_rwl);
+    rwl_unlock(&ctx->inode_table_rwl);
+
+    return 0;
+#endif
+}
+
+/**
+ * (Try to) Allocate a new inode in the inode table, without initializing its
+ * data.
+ *
+ * Returns the inumber of the newly allocated inode, or -1 in the case of error.
+ *
+ * Possible errors:
+ *   - No free slots in inode table.
+ */
+static int inode_alloc(tfs_ctx_t *ctx) {
+    rwl_wrlock(&ctx->inode_table_rwl);
+    STATS_START(start);
+    for (size_t inumber = 0; inumber < INODE_TABLE_SIZE; inumber++) {
+        if ((inumber * sizeof(allocation_state_t) % BLOCK_SIZE) == 0) {
+            insert_delay(); // simulate storage access delay (to freeinode_ts)
+        }
+
+        // Finds first free entry in inode table
+        if (ctx->freeinode_ts[inumber] == FREE) {
+            ctx->freeinode_ts[inumber] = TAKEN;
+            STATS_STOP(STATS_INODE_ALLOC, start);
+            rwl_unlock(&ctx->inode_table_rwl);
+            return (int)inumber;
+        }
+    }
+
+    STATS_STOP(STATS_INODE_ALLOC, start);
+    rwl_unlock(&ctx->inode_table_rwl);
+    // no free inodes
+    return -1;
+}
+
+/**
+ * (Try to) Allocate several inodes in a single pass over the inode table,
+ * without initializing their data.
+ *
+ * Input:
+ *   - count: number of inodes wanted
+ *   - inumbers: filled with the inumbers of the allocated inodes
+ *
+ * Returns the number of inodes allocated (lower than count if the inode table
+ * fills up).
+ */
+static size_t inode_alloc_many(tfs_ctx_t *ctx, size_t count, int *inumbers) {
+    size_t allocated = 0;
+
+    rwl_wrlock(&ctx->inode_table_rwl);
+    for (size_t inumber = 0; inumber < INODE_TABLE_SIZE && allocated < count;
+         inumber++) {
+        if ((inumber * sizeof(allocation_state_t) % BLOCK_SIZE) == 0) {
+            insert_delay(); // simulate storage access delay (to freeinode_ts)
+        }
+
+        if (ctx->freeinode_ts[inumber] == FREE) {
+            ctx->freeinode_ts[inumber] = TAKEN;
+            inumbers[allocated++] = (int)inumber;
+        }
+    }
+    rwl_unlock(&ctx->inode_table_rwl);
+
+    return allocated;
+}
+
+/**
+ * Initialize the fields of a newly allocated inode (no data block is
+ * allocated, i_size is left to the caller).
+ */
+static void inode_init(tfs_ctx_t *ctx, int inumber, inode_type i_type) {
+    inode_t *inode = &ctx->inode_table[inumber];
+
+    inode->i_node_type = i_type;
+    inode->i_links_count = 1;
+    inode->i_reserved = 0;
+    inode->i_inline = false;
+    inode->i_compressed = false;
+    inode->i_zpack = -1;
+    inode->i_zpack_used = 0;
+    for (size_t i = 0; i < INODE_DIRECT_BLOCKS; i++) {
+        inode->i_data_blocks[i] = -1;
+        inode->i_zoffsets[i] = 0;
+        inode->i_zlengths[i] = 0;
+    }
+}
+
+static void orphans_reap(tfs_ctx_t *ctx);
+
+/**
+ * Create a new inode in the inode table.
+ *
+ * Allocates and initializes a new inode.
+ * Directories will have their data block allocated and initialized, with i_size
+ * set to BLOCK_SIZE. Regular files will not have their data block allocated
+ * (i_size will be set to 0, all i_data_blocks to -1).
+ *
+ * Input:
+ *   - i_type: the type of the node (file or directory)
+ *
+ * Returns inumber of the new inode, or -1 in the case of error.
+ *
+ * Possible errors:
+ *   - No free slots in inode table.
+ *   - (if creating a directory) No free data blocks.
+ */
+int inode_create(tfs_ctx_t *ctx, inode_type i_type) {
+    orphans_reap(ctx); // their inodes can be reused
+
+    int inumber = inode_alloc(ctx);
+    if (inumber == -1) {
+        return -1; // no free slots in inode table
+    }
+
+    /*
+     * section doesn't require locks as inode_alloc returned a thread-safe inum
+     */
+
+    inode_t *inode = &ctx->inode_table[inumber];
+    insert_delay(); // simulate storage access delay (to inode)
+
+    inode_init(ctx, inumber, i_type);
+    switch (i_type) {
+    case T_DIRECTORY: {
+        // Initializes directory (filling its block with empty entries, labeled
+        // with inumber==-1)
+        int b = data_block_alloc(ctx);
+        if (b == -1) {
+            // ensure fields are initialized
+            inode->i_size = 0;
+
+            // run regular deletion process
+            inode_delete(ctx, inumber);
+            return -1;
+        }
+
+        ctx->inode_table[inumber].i_size = BLOCK_SIZE;
+        ctx->inode_table[inumber].i_data_blocks[0] = b;
+
+        dir_entry_t *dir_entry =
+            (dir_entry_t *)data_block_get_mut(ctx, b, true);
+        if (dir_entry == NULL) {
+            return -1;
+        }
+
+        for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+            dir_entry[i].d_inumber = -1;
+        }
+        data_block_put_mut(ctx, b);
+    } break;
+    case T_FILE:
+        // In case of a new file, simply sets its size to 0
+        ctx->inode_table[inumber].i_size = 0;
+        break;
+    case T_LINK:
+        // Size is the length of the target path (set when the link is filled)
+        ctx->inode_table[inumber].i_size = 0;
+        break;
+    default:
+        PANIC("inode_create: unknown file type");
+    }
+
+    return inumber;
+}
+
+/**
+ * Delete an inode.
+ *
+ * Input:
+ *   - inumber: inode's number
+ * Returns 0 if succesful and -1 on error (possible errors might be another
+ * thread deleting this inode)
+ */
+int inode_delete(tfs_ctx_t *ctx, int inumber) {
+    // simulate storage access delay (to inode and freeinode_ts)
+    insert_delay();
+    insert_delay();
+
+    if (!valid_inumber(ctx, inumber)) {
+        return -1;
+    }
+
+    // wait for the reads still going through the inode (those of attached
+    // instances only take its range lock), then lock inode table
+    int slot = lock_inode(ctx, inumber, true);
+    rwl_wrlock(&ctx->inode_table_rwl);
+    // if another thread deleted this inode before acquiring rwlock
+    if (ctx->freeinode_ts[inumber] == FREE) {
+        rwl_unlock(&ctx->inode_table_rwl);
+        unlock_inode(ctx, inumber, slot);
+        return -1;
+    }
+
+    inode_free_blocks(ctx, &ctx->inode_table[inumber]);
+
+    ctx->freeinode_ts[inumber] = FREE;
+
+    rwl_unlock(&ctx->inode_table_rwl);
+    unlock_inode(ctx, inumber, slot);
+
+    return 0;
+}
+
+/**
+ * Delete several (unreachable) inodes, in a single pass over the inode table.
+ *
+ * Input:
+ *   - inumbers: inode numbers
+ *   - count: number of inodes
+ */
+static void inode_delete_many(tfs_ctx_t *ctx, int const *inumbers,
+                              size_t count) {
+    size_t last_inode_block = SIZE_MAX;
+    size_t last_bitmap_block = SIZE_MAX;
+
+    // the inodes are locked first, as in inode_delete
+    int *slots = malloc(count * sizeof(int));
+    if (slots == NULL) {
+        for (size_t i = 0; i < count; i++) {
+            inode_delete(ctx, inumbers[i]);
+        }
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        slots[i] = lock_inode(ctx, inumbers[i], true);
+    }
+
+    rwl_wrlock(&ctx->inode_table_rwl);
+    for (size_t i = 0; i < count; i++) {
+        size_t inumber = (size_t)inumbers[i];
+
+        // simulate storage access delay (to inode and freeinode_ts), once per
+        // block touched
+        size_t inode_block = inumber * sizeof(inode_t) / BLOCK_SIZE;
+        size_t bitmap_block = inumber * sizeof(allocation_state_t) / BLOCK_SIZE;
+        if (inode_block != last_inode_block) {
+            insert_delay();
+            last_inode_block = inode_block;
+        }
+        if (bitmap_block != last_bitmap_block) {
+            insert_delay();
+            last_bitmap_block = bitmap_block;
+        }
+
+        if (ctx->freeinode_ts[inumber] == TAKEN) {
+            inode_free_blocks(ctx, &ctx->inode_table[inumber]);
+            ctx->freeinode_ts[inumber] = FREE;
+        }
+    }
+    rwl_unlock(&ctx->inode_table_rwl);
+
+    for (size_t i = 0; i < count; i++) {
+        unlock_inode(ctx, inumbers[i], slots[i]);
+    }
+    free(slots);
+}
+
+/**
+ * Obtain a pointer to an inode from its inumber.
+ *
+ * Input:
+ *   - inumber: inode's number
+ *
+ * Returns pointer to inode.
+ */
+inode_t *inode_get(tfs_ctx_t *ctx, int inumber) {
+    if (!valid_inumber(ctx, inumber)) {
+        return NULL;
+    }
+
+    insert_delay(); // simulate storage access delay to inode
+    return &ctx->inode_table[inumber];
+}
+
+pthread_rwlock_t *inode_rwl_get(tfs_ctx_t *ctx, int inumber) {
+    if (!valid_inumber(ctx, inumber)) {
+        return NULL;
+    }
+
+    return ctx->inode_rwl + inumber;
+}
+
+range_lock_t *inode_range_lock_get(tfs_ctx_t *ctx, int inumber) {
+    if (!valid_inumber(ctx, inumber)) {
+        return NULL;
+    }
+
+    return ctx->inode_ranges + inumber;
+}
+
+/**
+ * Lock an inode, for reading or writing.
+ *
+ * Instances attached to a shared memory segment do not take the inode's lock,
+ * which is not robust (a reader that died holding it would block the owner's
+ * writers for good), but the file's range lock for reading, whole: the owner
+ * waits for their ranges when it locks the inode for writing. Attached
+ * instances only read, writer is ignored.
+ *
+ * Input:
+ *   - inumber: the inode's number
+ *   - writer: whether to lock it for writing
+ *
+ * Returns the slot of the whole file's range (-1 if none was locked), to
+ * unlock the inode with.
+ */
+int lock_inode(tfs_ctx_t *ctx, int inumber, bool writer) {
+    range_lock_t *ranges = inode_range_lock_get(ctx, inumber);
+    if (state_read_only(ctx)) {
+        return range_lock_acquire(ranges, 0, SIZE_MAX, false);
+    }
+
+    pthread_rwlock_t *inode_lock = inode_rwl_get(ctx, inumber);
+    if (!writer) {
+        rwl_rdlock(inode_lock);
+        return -1;
+    }
+
+    rwl_wrlock(inode_lock);
+    if (state_shared(ctx)) {
+        // no thread of this process holds a range (they need the inode's
+        // lock), only attached instances may
+        return range_lock_acquire(ranges, 0, SIZE_MAX, true);
+    }
+    return -1;
+}
+
+/**
+ * Unlock an inode locked with lock_inode, given the slot it returned.
+ */
+void unlock_inode(tfs_ctx_t *ctx, int inumber, int slot) {
+    if (slot != -1) {
+        range_lock_release(inode_range_lock_get(ctx, inumber), slot);
+    }
+    if (!state_read_only(ctx)) {
+        rwl_unlock(inode_rwl_get(ctx, inumber));
+    }
+}
+
+/**
+ * Slot of the compressed block cache holding a given compressed chunk.
+ */
+static size_t compress_cache_slot(int block_number, size_t zoffset) {
+    return ((size_t)block_number * 31 + zoffset) % COMPRESS_CACHE_ENTRIES;
+}
+
+/**
+ * Drop a compressed chunk of a file (and its reference to the block holding
+ * it), leaving a hole.
+ *
+ * Input:
+ *   - inode: the file's inode
+ *   - index: index of the (compressed) chunk
+ */
+static void compressed_chunk_release(tfs_ctx_t *ctx, inode_t *inode,
+                                     size_t index) {
+    int block_number = inode->i_data_blocks[index];
+    size_t zoffset = inode->i_zoffsets[index];
+
+    // the block may be reused, forget its decompressed copy
+    compress_cache_entry_t *entry =
+        &ctx->compress_cache[compress_cache_slot(block_number, zoffset)];
+    mutex_lock(&entry->zc_lock);
+    if (entry->zc_block == block_number && entry->zc_offset == zoffset) {
+        entry->zc_valid = false;
+    }
+    mutex_unlock(&entry->zc_lock);
+
+    mutex_lock(&ctx->compress_stats_lock);
+    ctx->compress_stats.blocks--;
+    ctx->compress_stats.raw_bytes -= BLOCK_SIZE;
+    ctx->compress_stats.compressed_bytes -= inode->i_zlengths[index];
+    mutex_unlock(&ctx->compress_stats_lock);
+
+    data_block_free(ctx, block_number);
+    inode->i_data_blocks[index] = -1;
+    inode->i_zoffsets[index] = 0;
+    inode->i_zlengths[index] = 0;
+}
+
+/**
+ * Hash of the contents of a data block (64-bit FNV-1a).
+ */
+static uint64_t block_hash(tfs_ctx_t *ctx, char const *block) {
+    (void)ctx; // the limits are compiled in with TFS_STATIC_PARAMS
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        hash ^= (unsigned char)block[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static inline bool dedup_is_indexed(tfs_ctx_t *ctx, int block_number) {
+    return ctx->fs_params.dedup && ctx->block_indexed[block_number];
+}
+
+/**
+ * Remove a block from the content index.
+ *
+ * Must be called with free_blocks_rwl held for writing.
+ */
+static void dedup_unindex(tfs_ctx_t *ctx, int block_number) {
+    size_t bucket = ctx->block_hashes[block_number] % ctx->dedup_bucket_count;
+    int *link = &ctx->dedup_buckets[bucket];
+    while (*link != block_number) {
+        link = &ctx->dedup_next[*link];
+    }
+    *link = ctx->dedup_next[block_number];
+
+    ctx->block_indexed[block_number] = false;
+    ctx->dedup_stats.indexed_blocks--;
+}
+
+/**
+ * Determine if content of a given size can be stored inside an inode.
+ *
+ * Input:
+ *   - inode: the inode (a regular file or a symlink)
+ *   - size: total content size, in bytes
+ *
+ * Returns true if the content fits the inode's inline area for its type.
+ */
+bool inode_fits_inline(tfs_ctx_t *ctx, inode_t const *inode, size_t size) {
+    switch (inode->i_node_type) {
+    case T_FILE:
+        return size <= ctx->fs_params.inline_threshold;
+    case T_LINK:
+        return size <= INODE_INLINE_SIZE;
+    case T_DIRECTORY:
+    default:
+        return false;
+    }
+}
+
+/**
+ * Move the inline content of an inode to a newly allocated data block.
+ *
+ * Must be called with the inode's lock held for writing.
+ *
+ * Input:
+ *   - inode: inode with inline content
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - No free data blocks (the content is left inline).
+ */
+int inode_promote_inline(tfs_ctx_t *ctx, inode_t *inode) {
+    int block_number = data_block_alloc(ctx);
+    if (block_number == -1) {
+        return -1;
+    }
+
+    // the rest of the block must read as zeros
+    char *block = data_block_get_mut(ctx, block_number, true);
+    memcpy(block, inode->i_inline_data, inode->i_size);
+    memset(block + inode->i_size, 0, BLOCK_SIZE - inode->i_size);
+    data_block_put_mut(ctx, block_number);
+
+    inode->i_data_blocks[0] = block_number;
+    inode->i_inline = false;
+
+    return 0;
+}
+
+/**
+ * Allocate the data block backing a block-sized chunk of a file.
+ *
+ * The block is zero filled, so the parts of it that are not written read as
+ * zeros. Must be called with the inode's lock held for writing, or held for
+ * reading with the chunk's byte range locked for writing.
+ *
+ * Input:
+ *   - inode: the file's inode
+ *   - index: index of the chunk (offset / block size)
+ *
+ * Returns the block number if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - No free data blocks.
+ */
+int inode_block_alloc(tfs_ctx_t *ctx, inode_t *inode, size_t index) {
+    int block_number = data_block_alloc(ctx);
+    if (block_number == -1) {
+        return -1;
+    }
+
+    memset(&ctx->fs_data[(size_t)block_number * BLOCK_SIZE], 0, BLOCK_SIZE);
+    block_checksum_update(ctx, (size_t)block_number);
+    inode->i_data_blocks[index] = block_number;
+
+    return block_number;
+}
+
+/**
+ * Get the data block backing a chunk of a file, bringing it back from the
+ * spill file first if it was moved there.
+ *
+ * Must be called with the inode's lock held for writing, or held for reading
+ * with the chunk's byte range locked (the chunks of a file are not moved to
+ * the spill file while its lock is held).
+ *
+ * Input:
+ *   - inode: the file's inode
+ *   - index: index of the chunk (offset / block size)
+ *
+ * Returns the block number, or -1 if the chunk is a hole or could not be
+ * brought back.
+ *
+ * Possible errors:
+ *   - No free data blocks (and nothing to move to the spill file instead).
+ *   - Failure reading the spill file.
+ */
+int inode_block_resident(tfs_ctx_t *ctx, inode_t *inode, size_t index) {
+    int entry =
+        __atomic_load_n(&inode->i_data_blocks[index], __ATOMIC_ACQUIRE);
+    if (entry >= -1) {
+        return entry;
+    }
+
+    int block_number = data_block_alloc(ctx);
+    if (block_number == -1) {
+        return -1;
+    }
+
+    // readers of the chunk can get here together, the first one brings it
+    // back and the others give their block up
+    mutex_lock(&ctx->spill_lock);
+    entry = __atomic_load_n(&inode->i_data_blocks[index], __ATOMIC_ACQUIRE);
+    if (entry >= -1) {
+        mutex_unlock(&ctx->spill_lock);
+        data_block_free(ctx, block_number);
+        return entry;
+    }
+
+    size_t slot = CHUNK_SPILL_SLOT(entry);
+    char *block = data_block_get_mut(ctx, block_number, true);
+    ssize_t done =
+        pread(ctx->spill_fd, block, BLOCK_SIZE, (off_t)(slot * BLOCK_SIZE));
+    data_block_put_mut(ctx, block_number);
+    if (done != (ssize_t)BLOCK_SIZE) {
+        mutex_unlock(&ctx->spill_lock);
+        data_block_free(ctx, block_number);
+        return -1;
+    }
+
+    __atomic_store_n(&inode->i_data_blocks[index], block_number,
+                     __ATOMIC_RELEASE);
+    ctx->spill_free_slots[ctx->spill_free_count++] = slot;
+    ctx->spill_stats.spilled--;
+    ctx->spill_stats.faults++;
+    mutex_unlock(&ctx->spill_lock);
+
+    return block_number;
+}
+
+/**
+ * Free every data block of an inode, leaving its contents empty.
+ *
+ * Must be called with the inode's lock held for writing (or with the inode
+ * unreachable).
+ *
+ * Input:
+ *   - inode: the inode
+ */
+void inode_free_blocks(tfs_ctx_t *ctx, inode_t *inode) {
+    if (!inode->i_inline) {
+        for (size_t i = 0; i < INODE_DIRECT_BLOCKS; i++) {
+            if (inode->i_zlengths[i] != 0) {
+                compressed_chunk_release(ctx, inode, i);
+            } else if (inode->i_data_blocks[i] < -1) {
+                spill_slot_free(ctx, CHUNK_SPILL_SLOT(inode->i_data_blocks[i]));
+                inode->i_data_blocks[i] = -1;
+            } else if (inode->i_data_blocks[i] != -1) {
+                data_block_free(ctx, inode->i_data_blocks[i]);
+                inode->i_data_blocks[i] = -1;
+            }
+        }
+    }
+
+    if (inode->i_zpack != -1) {
+        data_block_free(ctx, inode->i_zpack);
+        inode->i_zpack = -1;
+        inode->i_zpack_used = 0;
+    }
+
+    inode->i_size = 0;
+    inode->i_reserved = 0;
+    inode->i_inline = false;
+}
+
+/**
+ * Compress the data block backing a chunk of a compressed file, packing it
+ * into the file's current pack block.
+ *
+ * Blocks that do not shrink by at least an eighth are left as they are. When
+ * the pack block has no room left, the block being compressed becomes the new
+ * pack block, so compressing never needs to allocate. Must be called with the
+ * inode's lock held for writing.
+ *
+ * Input:
+ *   - inode: the file's inode
+ *   - index: index of the chunk (offset / block size)
+ *
+ * Returns 0 if the chunk was compressed, -1 if it was left uncompressed.
+ */
+int inode_block_compress(tfs_ctx_t *ctx, inode_t *inode, size_t index) {
+    int block_number = inode->i_data_blocks[index];
+    if (block_number == -1 || inode->i_zlengths[index] != 0) {
+        return -1;
+    }
+
+    // the block size is a parameter, so the output is not put on the stack
+    // (of writers and async workers)
+    char *packed = malloc(BLOCK_SIZE);
+    if (packed == NULL) {
+        return -1;
+    }
+    size_t packed_len = lz_compress(
+        &ctx->fs_data[(size_t)block_number * BLOCK_SIZE], BLOCK_SIZE, packed,
+        BLOCK_SIZE - BLOCK_SIZE / 8);
+    if (packed_len == 0) {
+        free(packed);
+        return -1; // not worth it
+    }
+
+    int pack = inode->i_zpack;
+    if (pack == -1 || BLOCK_SIZE - inode->i_zpack_used < packed_len) {
+        // the chunk's reference moves to the new pack, which also gets one
+        // for being the file's pack
+        if (pack != -1) {
+            data_block_free(ctx, pack);
+        }
+        pack = block_number;
+        data_block_ref(ctx, pack);
+        inode->i_zpack = pack;
+        inode->i_zpack_used = 0;
+    } else {
+        data_block_ref(ctx, pack);
+        data_block_free(ctx, block_number);
+    }
+
+    insert_delay(); // simulate storage access delay to the pack block
+    block_checksum_invalidate(ctx, (size_t)pack);
+    memcpy(&ctx->fs_data[(size_t)pack * BLOCK_SIZE + inode->i_zpack_used],
+           packed, packed_len);
+    block_checksum_update(ctx, (size_t)pack);
+    free(packed);
+
+    inode->i_data_blocks[index] = pack;
+    inode->i_zoffsets[index] = (uint32_t)inode->i_zpack_used;
+    inode->i_zlengths[index] = (uint32_t)packed_len;
+    inode->i_zpack_used += packed_len;
+
+    mutex_lock(&ctx->compress_stats_lock);
+    ctx->compress_stats.blocks++;
+    ctx->compress_stats.raw_bytes += BLOCK_SIZE;
+    ctx->compress_stats.compressed_bytes += packed_len;
+    mutex_unlock(&ctx->compress_stats_lock);
+
+    return 0;
+}
+
+/**
+ * Move a compressed chunk of a file back to a data block of its own, so that
+ * it can be written to. Must be called with the inode's lock held for writing.
+ *
+ * Input:
+ *   - inode: the file's inode
+ *   - index: index of the (compressed) chunk
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - No free data blocks.
+ *   - The compressed data is corrupted.
+ */
+int inode_block_decompress(tfs_ctx_t *ctx, inode_t *inode, size_t index) {
+    int block_number = data_block_alloc(ctx);
+    if (block_number == -1) {
+        return -1;
+    }
+
+    if (inode_block_read(ctx, inode, index, 0,
+                         &ctx->fs_data[(size_t)block_number * BLOCK_SIZE],
+                         BLOCK_SIZE) == -1) {
+        data_block_free(ctx, block_number);
+        return -1;
+    }
+    block_checksum_update(ctx, (size_t)block_number);
+
+    compressed_chunk_release(ctx, inode, index);
+    inode->i_data_blocks[index] = block_number;
+
+    return 0;
+}
+
+/**
+ * Decompress a compressed chunk of a file.
+ *
+ * Input:
+ *   - inode: the file's inode
+ *   - index: index of the (compressed) chunk
+ *   - data: destination, of the block size
+ *
+ * Returns 0 if successful, -1 if the compressed data is corrupted.
+ */
+static int compressed_chunk_decompress(tfs_ctx_t *ctx, inode_t const *inode,
+                                       size_t index, char *data) {
+    size_t block_number = (size_t)inode->i_data_blocks[index];
+
+    insert_delay(); // simulate storage access delay to block
+    if (!block_checksum_verify(ctx, block_number)) {
+        return -1;
+    }
+    char const *packed =
+        &ctx->fs_data[block_number * BLOCK_SIZE + inode->i_zoffsets[index]];
+    if (lz_decompress(packed, inode->i_zlengths[index], data, BLOCK_SIZE) !=
+        BLOCK_SIZE) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Read part of a compressed chunk of a file.
+ *
+ * The chunk is decompressed into the compressed block cache, unless it is
+ * already there. Instances attached to a shared memory segment do not use the
+ * cache: the owner frees and reuses blocks without telling them, so a cached
+ * copy could be another file's data.
+ *
+ * Must be called with the inode's lock held (for reading, at least).
+ *
+ * Input:
+ *   - inode: the file's inode
+ *   - index: index of the (compressed) chunk
+ *   - offset: offset within the chunk
+ *   - buffer: destination buffer
+ *   - len: bytes to read (offset + len at most the block size)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - The compressed data is corrupted.
+ *   - (attached instance) No memory to decompress the chunk into.
+ */
+int inode_block_read(tfs_ctx_t *ctx, inode_t const *inode, size_t index,
+                     size_t offset, void *buffer, size_t len) {
+    if (ctx->shm_attached) {
+        char *data = malloc(BLOCK_SIZE);
+        if (data == NULL) {
+            return -1;
+        }
+        int result = compressed_chunk_decompress(ctx, inode, index, data);
+        if (result == 0) {
+            memcpy(buffer, data + offset, len);
+        }
+        free(data);
+
+        mutex_lock(&ctx->compress_stats_lock);
+        ctx->compress_stats.cache_misses++;
+        mutex_unlock(&ctx->compress_stats_lock);
+        return result;
+    }
+
+    int block_number = inode->i_data_blocks[index];
+    size_t zoffset = inode->i_zoffsets[index];
+    compress_cache_entry_t *entry =
+        &ctx->compress_cache[compress_cache_slot(block_number, zoffset)];
+
+    mutex_lock(&entry->zc_lock);
+
+    bool hit = entry->zc_valid && entry->zc_block == block_number &&
+               entry->zc_offset == zoffset;
+    if (!hit) {
+        if (compressed_chunk_decompress(ctx, inode, index,
+                                        entry->zc_data) != 0) {
+            entry->zc_valid = false;
+            mutex_unlock(&entry->zc_lock);
+            return -1; // corrupted
+        }
+
+        entry->zc_valid = true;
+        entry->zc_block = block_number;
+        entry->zc_offset = zoffset;
+    }
+
+    memcpy(buffer, entry->zc_data + offset, len);
+
+    mutex_unlock(&entry->zc_lock);
+
+    mutex_lock(&ctx->compress_stats_lock);
+    if (hit) {
+        ctx->compress_stats.cache_hits++;
+    } else {
+        ctx->compress_stats.cache_misses++;
+    }
+    mutex_unlock(&ctx->compress_stats_lock);
+
+    return 0;
+}
+
+/**
+ * Share the (full) data block backing a chunk of a file with an indexed block
+ * of the same contents, or index it if there is none.
+ *
+ * Must be called with the inode's lock held for writing, or held for reading
+ * with the chunk's byte range locked for writing.
+ *
+ * Input:
+ *   - inode: the file's inode
+ *   - index: index of the chunk (offset / block size)
+ *
+ * Returns 0 if successful, -1 if deduplication is off.
+ */
+int inode_block_dedup(tfs_ctx_t *ctx, inode_t *inode, size_t index) {
+    int block_number = inode->i_data_blocks[index];
+    if (!ctx->fs_params.dedup || block_number == -1) {
+        return -1;
+    }
+
+    char const *contents = &ctx->fs_data[(size_t)block_number * BLOCK_SIZE];
+    uint64_t hash = block_hash(ctx, contents);
+    size_t bucket = hash % ctx->dedup_bucket_count;
+
+    rwl_wrlock(&ctx->free_blocks_rwl);
+
+    if (ctx->block_indexed[block_number]) {
+        rwl_unlock(&ctx->free_blocks_rwl);
+        return 0; // already shareable
+    }
+
+    for (int candidate = ctx->dedup_buckets[bucket]; candidate != -1;
+         candidate = ctx->dedup_next[candidate]) {
+        if (ctx->block_hashes[candidate] != hash) {
+            continue;
+        }
+
+        insert_delay(); // simulate storage access delay to candidate block
+        if (memcmp(&ctx->fs_data[(size_t)candidate * BLOCK_SIZE], contents,
+                   BLOCK_SIZE) == 0) {
+            ctx->block_refs[candidate]++;
+            ctx->dedup_stats.hits++;
+            ctx->dedup_stats.saved_blocks++;
+            rwl_unlock(&ctx->free_blocks_rwl);
+
+            inode->i_data_blocks[index] = candidate;
+            data_block_free(ctx, block_number);
+            return 0;
+        }
+    }
+
+    ctx->block_hashes[block_number] = hash;
+    ctx->dedup_next[block_number] = ctx->dedup_buckets[bucket];
+    ctx->dedup_buckets[bucket] = block_number;
+    ctx->block_indexed[block_number] = true;
+    ctx->dedup_stats.indexed_blocks++;
+
+    rwl_unlock(&ctx->free_blocks_rwl);
+
+    return 0;
+}
+
+/**
+ * Make sure a chunk of a file can be modified in place: a block shared with
+ * other chunks is replaced by a private copy (copy-on-write), and a private
+ * block is removed from the content index.
+ *
+ * Must be called with the inode's lock held for writing, or held for reading
+ * with the chunk's byte range locked for writing.
+ *
+ * Input:
+ *   - inode: the file's inode
+ *   - index: index of the chunk (offset / block size)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - No free data blocks for the copy.
+ */
+int inode_block_unshare(tfs_ctx_t *ctx, inode_t *inode, size_t index) {
+    int block_number = inode->i_data_blocks[index];
+    if (block_number == -1) {
+        return 0;
+    }
+
+    rwl_rdlock(&ctx->free_blocks_rwl);
+    bool shared = ctx->block_refs[block_number] > 1;
+    bool indexed = dedup_is_indexed(ctx, block_number);
+    rwl_unlock(&ctx->free_blocks_rwl);
+
+    if (!shared && indexed) {
+        // contents are about to change, so they must no longer be found
+        rwl_wrlock(&ctx->free_blocks_rwl);
+        shared = ctx->block_refs[block_number] > 1;
+        if (!shared && dedup_is_indexed(ctx, block_number)) {
+            dedup_unindex(ctx, block_number);
+        }
+        rwl_unlock(&ctx->free_blocks_rwl);
+    }
+
+    if (!shared) {
+        return 0;
+    }
+
+    int copy = data_block_alloc(ctx);
+    if (copy == -1) {
+        return -1;
+    }
+
+    insert_delay(); // simulate storage access delay to the shared block
+    memcpy(&ctx->fs_data[(size_t)copy * BLOCK_SIZE],
+           &ctx->fs_data[(size_t)block_number * BLOCK_SIZE], BLOCK_SIZE);
+    block_checksum_update(ctx, (size_t)copy);
+    inode->i_data_blocks[index] = copy;
+    data_block_free(ctx, block_number);
+
+    rwl_wrlock(&ctx->free_blocks_rwl);
+    ctx->dedup_stats.cow_copies++;
+    rwl_unlock(&ctx->free_blocks_rwl);
+
+    return 0;
+}
+
+/**
+ * Make a file share every data block of another one, which it becomes a copy
+ * of: the blocks are copied (by inode_block_unshare) only once either file
+ * modifies them.
+ *
+ * Must be called with the source's lock held for writing, and the clone
+ * unreachable.
+ *
+ * Input:
+ *   - src: the inode of the file being cloned
+ *   - dst: the inode of the (empty) clone
+ *
+ * Returns 0 if successful, -1 otherwise (and the clone is left empty).
+ *
+ * Possible errors:
+ *   - No free data blocks to bring chunks of the source back from the spill
+ *     file.
+ */
+int inode_clone(tfs_ctx_t *ctx, inode_t *src, inode_t *dst) {
+    if (src->i_inline) {
+        memcpy(dst->i_inline_data, src->i_inline_data, INODE_INLINE_SIZE);
+        dst->i_inline = true;
+    }
+
+    dst->i_compressed = src->i_compressed;
+    for (size_t i = 0; i < INODE_DIRECT_BLOCKS && !src->i_inline; i++) {
+        if (src->i_data_blocks[i] == -1) {
+            continue; // hole
+        }
+
+        // spilled chunks can only be shared once they are back in memory
+        int block_number = inode_block_resident(ctx, src, i);
+        if (block_number == -1 || data_block_ref(ctx, block_number) == -1) {
+            inode_free_blocks(ctx, dst);
+            return -1;
+        }
+        dst->i_data_blocks[i] = block_number;
+
+        if (src->i_zlengths[i] != 0) {
+            dst->i_zoffsets[i] = src->i_zoffsets[i];
+            dst->i_zlengths[i] = src->i_zlengths[i];
+
+            mutex_lock(&ctx->compress_stats_lock);
+            ctx->compress_stats.blocks++;
+            ctx->compress_stats.raw_bytes += BLOCK_SIZE;
+            ctx->compress_stats.compressed_bytes += src->i_zlengths[i];
+            mutex_unlock(&ctx->compress_stats_lock);
+        }
+    }
+
+    dst->i_size = src->i_size;
+    dst->i_reserved = src->i_size;
+
+    return 0;
+}
+
+/**
+ * Clear the directory entry associated with a sub file.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - sub_name: sub file name
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - inode is not a directory inode.
+ *   - Directory does not contain an entry for sub_name.
+ */
+int clear_dir_entry(tfs_ctx_t *ctx, inode_t *inode, char const *sub_name) {
+    insert_delay();
+    // if not a directory
+    if (inode->i_node_type != T_DIRECTORY) {
+        return -1;
+    }
+
+    // rwlock_wrlock();
+
+    // Locates the block containing the entries of the directory
+    int block_number = inode->i_data_blocks[0];
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get_mut(ctx, block_number, false);
+    if (dir_entry == NULL) {
+        return -1; // corrupted
+    }
+
+    STATS_START(start);
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        if (!strcmp(dir_entry[i].d_name, sub_name)) {
+            dir_entry[i].d_inumber = -1;
+            memset(dir_entry[i].d_name, 0, MAX_FILE_NAME);
+            STATS_STOP(STATS_DIR_SCAN, start);
+
+            data_block_put_mut(ctx, block_number);
+            return 0;
+        }
+    }
+    STATS_STOP(STATS_DIR_SCAN, start);
+
+    data_block_put_mut(ctx, block_number);
+    return -1; // sub_name not found
+}
+
+/**
+ * Store the inumber for a sub file in a directory.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - sub_name: sub file name
+ *   - sub_inumber: inumber of the sub inode
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - inode is not a directory inode.
+ *   - sub_name is not a valid file name (length 0 or > MAX_FILE_NAME - 1).
+ *   - Directory is already full of entries.
+ */
+int add_dir_entry(tfs_ctx_t *ctx, inode_t *inode, char const *sub_name,
+                  int sub_inumber) {
+    if (strlen(sub_name) == 0 || strlen(sub_name) > MAX_FILE_NAME - 1) {
+        return -1; // invalid sub_name
+    }
+
+    insert_delay(); // simulate storage access delay to inode with inumber
+    if (inode->i_node_type != T_DIRECTORY) {
+        return -1; // not a directory
+    }
+
+    // Locates the block containing the entries of the directory
+    int block_number = inode->i_data_blocks[0];
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get_mut(ctx, block_number, false);
+    if (dir_entry == NULL) {
+        return -1; // corrupted
+    }
+
+    // Finds and fills the first empty entry
+    STATS_START(start);
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        if (dir_entry[i].d_inumber == -1) {
+            dir_entry[i].d_inumber = sub_inumber;
+            strncpy(dir_entry[i].d_name, sub_name, MAX_FILE_NAME - 1);
+            dir_entry[i].d_name[MAX_FILE_NAME - 1] = '\0';
+            STATS_STOP(STATS_DIR_SCAN, start);
+
+            data_block_put_mut(ctx, block_number);
+            return 0;
+        }
+    }
+    STATS_STOP(STATS_DIR_SCAN, start);
+
+    data_block_put_mut(ctx, block_number);
+    return -1; // no space for entry
+}
+
+/**
+ * Index of the entry of a directory block holding a given name.
+ *
+ * Returns the index, or -1 if there is no such entry.
+ */
+static int dir_entry_find(tfs_ctx_t *ctx, dir_entry_t const *dir_entry,
+                          char const *sub_name) {
+    (void)ctx; // the limits are compiled in with TFS_STATIC_PARAMS
+    STATS_START(start);
+    int entry = -1;
+    for (int i = 0; i < MAX_DIR_ENTRIES && entry == -1; i++) {
+        if ((dir_entry[i].d_inumber != -1) &&
+            (strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) == 0)) {
+            entry = i;
+        }
+    }
+    STATS_STOP(STATS_DIR_SCAN, start);
+
+    return entry;
+}
+
+static bool valid_sub_name(char const *sub_name) {
+    size_t len = strlen(sub_name);
+    return len > 0 && len <= MAX_FILE_NAME - 1;
+}
+
+/**
+ * Create several empty regular files in a directory, with a single pass over
+ * the directory and over the inode table.
+ *
+ * Must be called with the directory's lock held for writing.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - sub_names: names of the files
+ *   - count: number of files
+ *   - results: results[i] is set to 0 if sub_names[i] was created, -1
+ *     otherwise
+ *
+ * Returns the number of files created.
+ *
+ * Possible errors (per file):
+ *   - Invalid name, or a file with that name already exists (or appears
+ *     earlier in sub_names).
+ *   - Directory or inode table full.
+ */
+size_t dir_create_many(tfs_ctx_t *ctx, inode_t *inode,
+                       char const *const *sub_names, size_t count,
+                       int *results) {
+    for (size_t i = 0; i < count; i++) {
+        results[i] = -1;
+    }
+
+    insert_delay(); // simulate storage access delay to inode with inumber
+    if (inode->i_node_type != T_DIRECTORY || count == 0) {
+        return 0;
+    }
+
+    int block_number = inode->i_data_blocks[0];
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get_mut(ctx, block_number, false);
+    if (dir_entry == NULL) {
+        return 0; // corrupted
+    }
+
+    size_t free_entries = 0;
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        if (dir_entry[i].d_inumber == -1) {
+            free_entries++;
+        }
+    }
+
+    // pick the names that can be created
+    size_t wanted = 0;
+    for (size_t i = 0; i < count && wanted < free_entries; i++) {
+        if (!valid_sub_name(sub_names[i]) ||
+            dir_entry_find(ctx, dir_entry, sub_names[i]) != -1) {
+            continue;
+        }
+
+        bool repeated = false;
+        for (size_t j = 0; j < i && !repeated; j++) {
+            repeated = results[j] == 0 &&
+                       strncmp(sub_names[j], sub_names[i], MAX_FILE_NAME) == 0;
+        }
+        if (!repeated) {
+            results[i] = 0;
+            wanted++;
+        }
+    }
+
+    int *inumbers = malloc(wanted * sizeof(int));
+    size_t allocated = 0;
+    if (inumbers != NULL) {
+        allocated = inode_alloc_many(ctx, wanted, inumbers);
+    }
+
+    size_t created = 0;
+    size_t entry = 0;
+    size_t last_inode_block = SIZE_MAX;
+    for (size_t i = 0; i < count; i++) {
+        if (results[i] != 0) {
+            continue;
+        }
+        if (created == allocated) {
+            results[i] = -1; // no space in inode table
+            continue;
+        }
+
+        int inumber = inumbers[created++];
+        size_t inode_block = (size_t)inumber * sizeof(inode_t) / BLOCK_SIZE;
+        if (inode_block != last_inode_block) {
+            insert_delay(); // simulate storage access delay (to inode)
+            last_inode_block = inode_block;
+        }
+        inode_init(ctx, inumber, T_FILE);
+        ctx->inode_table[inumber].i_size = 0;
+
+        while (dir_entry[entry].d_inumber != -1) {
+            entry++;
+        }
+        dir_entry[entry].d_inumber = inumber;
+        strncpy(dir_entry[entry].d_name, sub_names[i], MAX_FILE_NAME - 1);
+        dir_entry[entry].d_name[MAX_FILE_NAME - 1] = '\0';
+    }
+
+    data_block_put_mut(ctx, block_number);
+    free(inumbers);
+
+    return created;
+}
+
+/**
+ * Remove several entries from a directory, deleting the files they were the
+ * last link to, with a single pass over the directory and over the inode
+ * table.
+ *
+ * Must be called with the directory's lock held for writing.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - sub_names: names of the entries
+ *   - count: number of entries
+ *   - results: results[i] is set to 0 if sub_names[i] was removed, -1
+ *     otherwise
+ *
+ * Returns the number of entries removed.
+ *
+ * Possible errors (per entry):
+ *   - No entry with that name.
+ */
+size_t dir_unlink_many(tfs_ctx_t *ctx, inode_t *inode,
+                       char const *const *sub_names, size_t count,
+                       int *results) {
+    for (size_t i = 0; i < count; i++) {
+        results[i] = -1;
+    }
+
+    insert_delay(); // simulate storage access delay to inode with inumber
+    if (inode->i_node_type != T_DIRECTORY || count == 0) {
+        return 0;
+    }
+
+    int *doomed = malloc(count * sizeof(int));
+    if (doomed == NULL) {
+        return 0;
+    }
+
+    int block_number = inode->i_data_blocks[0];
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get_mut(ctx, block_number, false);
+    if (dir_entry == NULL) {
+        free(doomed);
+        return 0; // corrupted
+    }
+
+    size_t removed = 0;
+    size_t doomed_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        int entry = dir_entry_find(ctx, dir_entry, sub_names[i]);
+        if (entry == -1) {
+            continue;
+        }
+
+        int inumber = dir_entry[entry].d_inumber;
+        inode_t *target = &ctx->inode_table[inumber];
+
+        dir_entry[entry].d_inumber = -1;
+        memset(dir_entry[entry].d_name, 0, MAX_FILE_NAME);
+
+        rwl_wrlock(&ctx->inode_rwl[inumber]);
+        bool last_link = target->i_links_count == 1;
+        target->i_links_count--;
+        rwl_unlock(&ctx->inode_rwl[inumber]);
+
+        // unreachable from now on, deleted below (or on its last close)
+        if (last_link && !inode_orphan(ctx, inumber)) {
+            doomed[doomed_count++] = inumber;
+        }
+
+        results[i] = 0;
+        removed++;
+    }
+
+    data_block_put_mut(ctx, block_number);
+
+    inode_delete_many(ctx, doomed, doomed_count);
+    free(doomed);
+
+    return removed;
+}
+
+/**
+ * Obtain the inumber for a sub file inside a directory.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - sub_name: sub file name
+ *
+ * Returns inumber linked to the target name, -1 if errors occur.
+ *
+ * Possible errors:
+ *   - inode is not a directory inode.
+ *   - Directory does not contain a file named sub_name.
+ */
+int find_in_dir(tfs_ctx_t *ctx, inode_t *inode, char const *sub_name) {
+    insert_delay(); // simulate storage access delay to inode with inumber
+    if (inode->i_node_type != T_DIRECTORY) {
+        return -1; // not a directory
+    }
+
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(ctx, inode->i_data_blocks[0]);
+    if (dir_entry == NULL) {
+        return -1;
+    }
+
+    // Iterates over the directory entries looking for one that has the target
+    // name
+    int entry = dir_entry_find(ctx, dir_entry, sub_name);
+    if (entry == -1) {
+        return -1; // entry not found
+    }
+
+    return dir_entry[entry].d_inumber;
+}
+
+/**
+ * Copy the entries of a directory.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - entries: set to a newly allocated array with a copy of every entry in
+ *     use (to be freed by the caller)
+ *
+ * Returns the number of entries copied, or -1 in case of error.
+ *
+ * Possible errors:
+ *   - inode is not a directory.
+ *   - Out of memory.
+ */
+ssize_t dir_snapshot(tfs_ctx_t *ctx, inode_t *inode, dir_entry_t **entries) {
+    insert_delay(); // simulate storage access delay to inode with inumber
+    if (inode->i_node_type != T_DIRECTORY) {
+        return -1; // not a directory
+    }
+
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(ctx, inode->i_data_blocks[0]);
+    if (dir_entry == NULL) {
+        return -1;
+    }
+
+    *entries = malloc(MAX_DIR_ENTRIES * sizeof(dir_entry_t));
+    if (*entries == NULL) {
+        return -1;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        if (dir_entry[i].d_inumber != -1) {
+            (*entries)[count++] = dir_entry[i];
+        }
+    }
+
+    return (ssize_t)count;
+}
+
+/**
+ * Take a free data block.
+ *
+ * Returns block number/index if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - No free data blocks.
+ */
+static int data_block_take(tfs_ctx_t *ctx) {
+    size_t node = 0;
+    size_t start = 0;
+    if (ctx->fs_params.numa_mode != TFS_NUMA_NONE) {
+        node = (size_t)numa_current_node() % ctx->numa_nodes;
+    }
+    // in local mode, start looking in the stripe of the writer's node
+    if (ctx->fs_params.numa_mode == TFS_NUMA_LOCAL) {
+        start = node * ctx->numa_stripe;
+    }
+
+    rwl_wrlock(&ctx->free_blocks_rwl);
+    STATS_START(scan_start);
+    for (size_t n = 0; n < DATA_BLOCKS; n++) {
+        size_t i = (start + n) % DATA_BLOCKS;
+        if (n == 0 || i * sizeof(allocation_state_t) % BLOCK_SIZE == 0) {
+            insert_delay(); // simulate storage access delay to free_blocks
+        }
+
+        if (ctx->free_blocks[i] == FREE) {
+            ctx->free_blocks[i] = TAKEN;
+            ctx->block_refs[i] = 1;
+            block_checksum_invalidate(ctx, i);
+            block_touch(ctx, (int)i);
+
+            size_t block_nd = block_node(ctx, i);
+            ctx->numa_stats[block_nd].allocs++;
+            ctx->numa_stats[block_nd].in_use++;
+            if (block_nd != node) {
+                ctx->numa_stats[block_nd].remote++;
+            }
+
+            STATS_STOP(STATS_BLOCK_ALLOC, scan_start);
+            rwl_unlock(&ctx->free_blocks_rwl);
+            return (int)i;
+        }
+    }
+
+    STATS_STOP(STATS_BLOCK_ALLOC, scan_start);
+    rwl_unlock(&ctx->free_blocks_rwl);
+    return -1;
+}
+
+/**
+ * (Try to) Allocate a data block, moving a cold file block to the spill file
+ * to make room when none is free (with tiering enabled).
+ *
+ * Returns the block number if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - No free data blocks, and nothing that can be moved to the spill file.
+ */
+int data_block_alloc(tfs_ctx_t *ctx) {
+    int block_number = data_block_take(ctx);
+    // another thread can take the block that was freed first
+    while (block_number == -1 && spill_evict(ctx) == 0) {
+        block_number = data_block_take(ctx);
+    }
+
+    return block_number;
+}
+
+/**
+ * Take an extra reference to an allocated data block (which, for a block in
+ * the content index, counts as a block saved by deduplication).
+ *
+ * Input:
+ *   - block_number: the block number/index
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int data_block_ref(tfs_ctx_t *ctx, int block_number) {
+    if (!valid_block_number(ctx, block_number)) {
+        return -1;
+    }
+
+    rwl_wrlock(&ctx->free_blocks_rwl);
+    if (ctx->free_blocks[block_number] == FREE) {
+        rwl_unlock(&ctx->free_blocks_rwl);
+        return -1;
+    }
+    ctx->block_refs[block_number]++;
+    if (dedup_is_indexed(ctx, block_number)) {
+        ctx->dedup_stats.saved_blocks++;
+    }
+    rwl_unlock(&ctx->free_blocks_rwl);
+
+    return 0;
+}
+
+/**
+ * Drop a reference to a data block, freeing it when it was the last one.
+ *
+ * Input:
+ *   - block_number: the block number/index
+ */
+int data_block_free(tfs_ctx_t *ctx, int block_number) {
+    if (!valid_block_number(ctx, block_number)) {
+        return -1;
+    }
+
+    // lock blocks bitmap table (not necessary but might make data more compact)
+    rwl_wrlock(&ctx->free_blocks_rwl);
+
+    insert_delay(); // simulate storage access delay to free_blocks
+
+    if (ctx->block_refs[block_number] > 1) {
+        ctx->block_refs[block_number]--;
+        if (dedup_is_indexed(ctx, block_number)) {
+            ctx->dedup_stats.saved_blocks--;
+        }
+        rwl_unlock(&ctx->free_blocks_rwl);
+        return 0;
+    }
+
+    if (dedup_is_indexed(ctx, block_number)) {
+        dedup_unindex(ctx, block_number);
+    }
+    block_checksum_invalidate(ctx, (size_t)block_number);
+    if (ctx->block_warmth != NULL) {
+        __atomic_store_n(&ctx->block_warmth[block_number], BLOCK_COLD,
+                         __ATOMIC_RELAXED);
+    }
 
-    inode_table = NULL;
-    freeinode_ts = NULL;
-    fs_data = NULL;
-    free_blocks = NULL;
-    open_file_table = NULL;
-    free_open_file_entries = NULL;
+    if (ctx->free_blocks[block_number] == TAKEN) {
+        ctx->numa_stats[block_node(ctx, (size_t)block_number)].in_use--;
+    }
+    ctx->free_blocks[block_number] = FREE;
+    ctx->block_refs[block_number] = 0;
 
-    rwl_destroy(&inode_table_rwl);
-    rwl_destroy(&free_blocks_rwl);
-    rwl_destroy(&open_file_table_rwl);
+    // lock blocks bitmap table
+    rwl_unlock(&ctx->free_blocks_rwl);
 
     return 0;
 }
 
 /**
- * (Try to) Allocate a new inode in the inode table, without initializing its
- * data.
+ * Copy the per node allocation statistics.
  *
- * Returns the inumber of the newly allocated inode, or -1 in the case of error.
+ * Input:
+ *   - stats: destination array
+ *   - max_nodes: length of the destination array
  *
- * Possible errors:
- *   - No free slots in inode table.
+ * Returns the number of nodes the data region is spread across.
  */
-static int inode_alloc(void) {
-    rwl_wrlock(&inode_table_rwl);
-    for (size_t inumber = 0; inumber < INODE_TABLE_SIZE; inumber++) {
-        if ((inumber * sizeof(allocation_state_t) % BLOCK_SIZE) == 0) {
-            insert_delay(); // simulate storage access delay (to freeinode_ts)
-        }
+size_t state_numa_stats(tfs_ctx_t *ctx, tfs_numa_node_stats_t *stats,
+                        size_t max_nodes) {
+    if (ctx->numa_stats == NULL) {
+        return 0;
+    }
 
-        // Finds first free entry in inode table
-        if (freeinode_ts[inumber] == FREE) {
-            freeinode_ts[inumber] = TAKEN;
-            rwl_unlock(&inode_table_rwl);
-            return (int)inumber;
-        }
+    rwl_rdlock(&ctx->free_blocks_rwl);
+    for (size_t node = 0; node < ctx->numa_nodes && node < max_nodes; node++) {
+        stats[node] = ctx->numa_stats[node];
     }
+    rwl_unlock(&ctx->free_blocks_rwl);
 
-    rwl_unlock(&inode_table_rwl);
-    // no free inodes
-    return -1;
+    return ctx->numa_nodes;
 }
 
 /**
- * Create a new inode in the inode table.
- *
- * Allocates and initializes a new inode.
- * Directories will have their data block allocated and initialized, with i_size
- * set to BLOCK_SIZE. Regular files will not have their data block allocated
- * (i_size will be set to 0, i_data_block to -1).
+ * Copy the block compression statistics.
  *
  * Input:
- *   - i_type: the type of the node (file or directory)
+ *   - stats: destination
  *
- * Returns inumber of the new inode, or -1 in the case of error.
- *
- * Possible errors:
- *   - No free slots in inode table.
- *   - (if creating a directory) No free data blocks.
+ * Returns 0 if successful, -1 if the FS is not initialized.
  */
-int inode_create(inode_type i_type) {
-    int inumber = inode_alloc();
-    if (inumber == -1) {
-        return -1; // no free slots in inode table
+int state_compress_stats(tfs_ctx_t *ctx, tfs_compress_stats_t *stats) {
+    if (ctx->inode_table == NULL) {
+        return -1;
     }
 
-    /*
-     * section doesn't require locks as inode_alloc returned a thread-safe inum
-     */
-
-    inode_t *inode = &inode_table[inumber];
-    insert_delay(); // simulate storage access delay (to inode)
-
-    inode->i_node_type = i_type;
-    inode->i_links_count = 1;
-    rwl_init(inode_rwl + inumber);
-    switch (i_type) {
-    case T_DIRECTORY: {
-        // Initializes directory (filling its block with empty entries, labeled
-        // with inumber==-1)
-        int b = data_block_alloc();
-        if (b == -1) {
-            // ensure fields are initialized
-            inode->i_size = 0;
-            inode->i_data_block = -1;
-
-            // run regular deletion process
-            inode_delete(inumber);
-            return -1;
-        }
-
-        inode_table[inumber].i_size = BLOCK_SIZE;
-        inode_table[inumber].i_data_block = b;
+    mutex_lock(&ctx->compress_stats_lock);
+    *stats = ctx->compress_stats;
+    mutex_unlock(&ctx->compress_stats_lock);
 
-        dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(b);
-        if (dir_entry == NULL) {
-            return -1;
-        }
+    return 0;
+}
 
-        for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-            dir_entry[i].d_inumber = -1;
-        }
-    } break;
-    case T_FILE:
-        // In case of a new file, simply sets its size to 0
-        inode_table[inumber].i_size = 0;
-        inode_table[inumber].i_data_block = -1;
-        break;
-    case T_LINK:
-        // Size unused because no read and write operations in link type files
-        inode_table[inumber].i_size = 0;
-        inode_table[inumber].i_data_block = -1;
-        break;
-    default:
-        PANIC("inode_create: unknown file type");
+/**
+ * Copy the block deduplication statistics.
+ *
+ * Input:
+ *   - stats: destination
+ *
+ * Returns 0 if successful, -1 if the FS is not initialized.
+ */
+int state_dedup_stats(tfs_ctx_t *ctx, tfs_dedup_stats_t *stats) {
+    if (ctx->inode_table == NULL) {
+        return -1;
     }
 
-    return inumber;
+    rwl_rdlock(&ctx->free_blocks_rwl);
+    *stats = ctx->dedup_stats;
+    rwl_unlock(&ctx->free_blocks_rwl);
+
+    return 0;
 }
 
 /**
- * Delete an inode.
+ * Copy the data block checksum statistics.
  *
  * Input:
- *   - inumber: inode's number
- * Returns 0 if succesful and -1 on error (possible errors might be another
- * thread deleting this inode)
+ *   - stats: destination
+ *
+ * Returns 0 if successful, -1 if the FS is not initialized.
  */
-int inode_delete(int inumber) {
-    // simulate storage access delay (to inode and freeinode_ts)
-    insert_delay();
-    insert_delay();
-
-    if (!valid_inumber(inumber)) {
+int state_checksum_stats(tfs_ctx_t *ctx, tfs_checksum_stats_t *stats) {
+    if (ctx->inode_table == NULL) {
         return -1;
     }
 
-    // lock inode table
-    rwl_wrlock(&inode_table_rwl);
-    // if another thread deleted this inode before acquiring rwlock
-    if (freeinode_ts[inumber] == FREE) {
-        rwl_unlock(&inode_table_rwl);
-        return -1;
+    memset(stats, 0, sizeof(*stats));
+    if (!ctx->fs_params.checksums) {
+        return 0;
     }
 
-    if (inode_table[inumber].i_size > 0) {
-        data_block_free(inode_table[inumber].i_data_block);
+    for (size_t i = 0; i < CHECKSUM_STRIPES; i++) {
+        checksum_stripe_t *stripe = &ctx->checksum_stripes[i];
+        mutex_lock(&stripe->cs_lock);
+        stats->verified += stripe->cs_stats.verified;
+        stats->updated += stripe->cs_stats.updated;
+        stats->errors += stripe->cs_stats.errors;
+        stats->scrubbed += stripe->cs_stats.scrubbed;
+        stats->scrub_errors += stripe->cs_stats.scrub_errors;
+        stats->checksum_ns += stripe->cs_stats.checksum_ns;
+        mutex_unlock(&stripe->cs_lock);
     }
 
-    freeinode_ts[inumber] = FREE;
-
-    rwl_unlock(&inode_table_rwl);
-
     return 0;
 }
 
 /**
- * Obtain a pointer to an inode from its inumber.
+ * Copy the read-ahead statistics.
  *
  * Input:
- *   - inumber: inode's number
+ *   - stats: destination
  *
- * Returns pointer to inode.
+ * Returns 0 if successful, -1 if the FS is not initialized.
  */
-inode_t *inode_get(int inumber) {
-    if (!valid_inumber(inumber)) {
-        return NULL;
+int state_readahead_stats(tfs_ctx_t *ctx, tfs_readahead_stats_t *stats) {
+    if (ctx->inode_table == NULL) {
+        return -1;
     }
 
-    insert_delay(); // simulate storage access delay to inode
-    return &inode_table[inumber];
-}
-
-pthread_rwlock_t *inode_rwl_get(int inumber) {
-    if (!valid_inumber(inumber)) {
-        return NULL;
+    memset(stats, 0, sizeof(*stats));
+    if (ctx->block_warmth == NULL) {
+        return 0;
     }
 
-    return inode_rwl + inumber;
+    mutex_lock(&ctx->readahead_lock);
+    *stats = ctx->readahead_stats;
+    mutex_unlock(&ctx->readahead_lock);
+    stats->hits = __atomic_load_n(&ctx->readahead_stats.hits, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+size_t state_readahead_blocks(tfs_ctx_t *ctx) {
+    return ctx->fs_params.readahead_blocks;
 }
 
 /**
- * Clear the directory entry associated with a sub file.
+ * Copy the tiered storage statistics.
  *
  * Input:
- *   - inode: directory inode
- *   - sub_name: sub file name
- *
- * Returns 0 if successful, -1 otherwise.
+ *   - stats: destination
  *
- * Possible errors:
- *   - inode is not a directory inode.
- *   - Directory does not contain an entry for sub_name.
+ * Returns 0 if successful, -1 if the FS is not initialized.
  */
-int clear_dir_entry(inode_t *inode, char const *sub_name) {
-    insert_delay();
-    // if not a directory
-    if (inode->i_node_type != T_DIRECTORY) {
+int state_spill_stats(tfs_ctx_t *ctx, tfs_spill_stats_t *stats) {
+    if (ctx->inode_table == NULL) {
         return -1;
     }
 
-    // rwlock_wrlock();
-
-    // Locates the block containing the entries of the directory
-    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
-    ALWAYS_ASSERT(dir_entry != NULL,
-                  "clear_dir_entry: directory must have a data block");
-
-    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (!strcmp(dir_entry[i].d_name, sub_name)) {
-            dir_entry[i].d_inumber = -1;
-            memset(dir_entry[i].d_name, 0, MAX_FILE_NAME);
-
-            return 0;
-        }
+    memset(stats, 0, sizeof(*stats));
+    if (ctx->spill_fd == -1) {
+        return 0;
     }
 
-    return -1; // sub_name not found
+    mutex_lock(&ctx->spill_lock);
+    *stats = ctx->spill_stats;
+    mutex_unlock(&ctx->spill_lock);
+
+    return 0;
 }
 
 /**
- * Store the inumber for a sub file in a directory.
+ * Queue a data block for the read-ahead thread, unless it is already loaded
+ * or queued (or the queue is full).
  *
  * Input:
- *   - inode: directory inode
- *   - sub_name: sub file name
- *   - sub_inumber: inumber of the sub inode
- *
- * Returns 0 if successful, -1 otherwise.
- *
- * Possible errors:
- *   - inode is not a directory inode.
- *   - sub_name is not a valid file name (length 0 or > MAX_FILE_NAME - 1).
- *   - Directory is already full of entries.
+ *   - block_number: the block number/index
  */
-int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber) {
-    if (strlen(sub_name) == 0 || strlen(sub_name) > MAX_FILE_NAME - 1) {
-        return -1; // invalid sub_name
+void data_block_prefetch(tfs_ctx_t *ctx, int block_number) {
+    if (ctx->block_warmth == NULL || !valid_block_number(ctx, block_number)) {
+        return;
     }
 
-    insert_delay(); // simulate storage access delay to inode with inumber
-    if (inode->i_node_type != T_DIRECTORY) {
-        return -1; // not a directory
+    char cold = BLOCK_COLD;
+    if (!__atomic_compare_exchange_n(&ctx->block_warmth[block_number], &cold,
+                                     BLOCK_QUEUED, false, __ATOMIC_RELAXED,
+                                     __ATOMIC_RELAXED)) {
+        return;
     }
 
-    // Locates the block containing the entries of the directory
-    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
-    ALWAYS_ASSERT(dir_entry != NULL,
-                  "add_dir_entry: directory must have a data block");
+    mutex_lock(&ctx->readahead_lock);
+    if (ctx->readahead_count == READAHEAD_QUEUE) {
+        ctx->readahead_stats.dropped++;
+        __atomic_store_n(&ctx->block_warmth[block_number], BLOCK_COLD,
+                         __ATOMIC_RELAXED);
+    } else {
+        size_t tail =
+            (ctx->readahead_head + ctx->readahead_count) % READAHEAD_QUEUE;
+        ctx->readahead_queue[tail] = block_number;
+        ctx->readahead_count++;
+        cond_signal(&ctx->readahead_cond);
+    }
+    mutex_unlock(&ctx->readahead_lock);
+}
 
-    // Finds and fills the first empty entry
-    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (dir_entry[i].d_inumber == -1) {
-            dir_entry[i].d_inumber = sub_inumber;
-            strncpy(dir_entry[i].d_name, sub_name, MAX_FILE_NAME - 1);
-            dir_entry[i].d_name[MAX_FILE_NAME - 1] = '\0';
+/**
+ * Take the read-ahead of a block: a loaded block is served from memory (once,
+ * it goes cold again), any other has to be read from storage.
+ *
+ * Returns whether the block was loaded.
+ */
+static bool block_warm_take(tfs_ctx_t *ctx, int block_number) {
+    if (ctx->block_warmth == NULL) {
+        return false;
+    }
 
-            return 0;
-        }
+    char warmth = __atomic_exchange_n(&ctx->block_warmth[block_number],
+                                      BLOCK_COLD, __ATOMIC_ACQUIRE);
+    if (warmth != BLOCK_WARM) {
+        return false;
     }
 
-    return -1; // no space for entry
+    __atomic_add_fetch(&ctx->readahead_stats.hits, 1, __ATOMIC_RELAXED);
+    return true;
 }
 
 /**
- * Obtain the inumber for a sub file inside a directory.
+ * Obtain a pointer to the contents of a given block, for reading (loaded by
+ * the read-ahead thread, if it got to it first).
  *
  * Input:
- *   - inode: directory inode
- *   - sub_name: sub file name
- *
- * Returns inumber linked to the target name, -1 if errors occur.
+ *   - block_number: the block number/index
  *
- * Possible errors:
- *   - inode is not a directory inode.
- *   - Directory does not contain a file named sub_name.
+ * Returns a pointer to the first byte of the block, or NULL if the block number
+ * is invalid or (with checksums on) the block is corrupted.
  */
-int find_in_dir(inode_t *inode, char const *sub_name) {
-    insert_delay(); // simulate storage access delay to inode with inumber
-    if (inode->i_node_type != T_DIRECTORY) {
-        return -1; // not a directory
+void *data_block_get(tfs_ctx_t *ctx, int block_number) {
+    if (!valid_block_number(ctx, block_number)) {
+        return NULL;
     }
 
-    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
-    if (dir_entry == NULL) {
-        return -1;
+    if (!block_warm_take(ctx, block_number)) {
+        insert_delay(); // simulate storage access delay to block
     }
+    if (!block_checksum_verify(ctx, (size_t)block_number)) {
+        return NULL;
+    }
+    block_touch(ctx, block_number);
 
-    // Iterates over the directory entries looking for one that has the target
-    // name
-    for (int i = 0; i < MAX_DIR_ENTRIES; i++)
-        if ((dir_entry[i].d_inumber != -1) &&
-            (strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) == 0)) {
-
-            int sub_inumber = dir_entry[i].d_inumber;
-            return sub_inumber;
-        }
-
-    return -1; // entry not found
+    return &ctx->fs_data[(size_t)block_number * BLOCK_SIZE];
 }
 
 /**
- * Allocate a new data block.
+ * Obtain a pointer to the contents of a given block, for modifying it.
  *
- * Returns block number/index if successful, -1 otherwise.
+ * Every call must be followed by a call to data_block_put_mut once the
+ * modification is done, so the block's checksum is brought up to date.
  *
- * Possible errors:
- *   - No free data blocks.
+ * Input:
+ *   - block_number: the block number/index
+ *   - overwrite: the whole block is about to be rewritten (its current
+ *     contents are not verified)
+ *
+ * Returns a pointer to the first byte of the block, or NULL if the block number
+ * is invalid or (with checksums on) the block is corrupted.
  */
-int data_block_alloc(void) {
-    rwl_wrlock(&free_blocks_rwl);
-    for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        if (i * sizeof(allocation_state_t) % BLOCK_SIZE == 0) {
-            insert_delay(); // simulate storage access delay to free_blocks
-        }
+void *data_block_get_mut(tfs_ctx_t *ctx, int block_number, bool overwrite) {
+    if (!valid_block_number(ctx, block_number)) {
+        return NULL;
+    }
 
-        if (free_blocks[i] == FREE) {
-            free_blocks[i] = TAKEN;
-            rwl_unlock(&free_blocks_rwl);
-            return (int)i;
-        }
+    insert_delay(); // simulate storage access delay to block
+    if (!overwrite && !block_checksum_verify(ctx, (size_t)block_number)) {
+        return NULL;
     }
+    block_checksum_invalidate(ctx, (size_t)block_number);
+    block_touch(ctx, block_number);
 
-    rwl_unlock(&free_blocks_rwl);
-    return -1;
+    return &ctx->fs_data[(size_t)block_number * BLOCK_SIZE];
 }
 
 /**
- * Free a data block.
+ * Finish modifying a block obtained from data_block_get_mut.
  *
  * Input:
  *   - block_number: the block number/index
  */
-int data_block_free(int block_number) {
-    if (!valid_block_number(block_number)) {
-        return -1;
+void data_block_put_mut(tfs_ctx_t *ctx, int block_number) {
+    if (valid_block_number(ctx, block_number)) {
+        block_checksum_update(ctx, (size_t)block_number);
     }
+}
 
-    // lock blocks bitmap table (not necessary but might make data more compact)
-    rwl_wrlock(&free_blocks_rwl);
-
-    insert_delay(); // simulate storage access delay to free_blocks
-
-    free_blocks[block_number] = FREE;
-
-    // lock blocks bitmap table
-    rwl_unlock(&free_blocks_rwl);
+/**
+ * Determine if given inumber is in the open file table.
+ *
+ * Must be called with the open file table's lock held.
+ *
+ * Input:
+ *   - inumber: inumber of inode to be searched for in open file table
+ *
+ * Returns true if given inumber is present in the open file table and false
+ * if not.
+ */
+static bool open_file_table_has(tfs_ctx_t *ctx, int inumber) {
+    for (int i = 0; i < MAX_OPEN_FILES; ++i) {
+        if (ctx->free_open_file_entries[i] == TAKEN &&
+            ctx->open_file_table[i].of_inumber == inumber) {
+            return true;
+        }
+    }
 
-    return 0;
+    return false;
 }
 
 /**
- * Obtain a pointer to the contents of a given block.
+ * Check whether a file is open, in this instance or in one attached to its
+ * shared memory segment. Must be called with open_file_table_rwl held.
  *
  * Input:
- *   - block_number: the block number/index
+ *   - inumber: inode number of the file
  *
- * Returns a pointer to the first byte of the block.
+ * Returns true if the file has a handle, false if not.
  */
-void *data_block_get(int block_number) {
-    if (!valid_block_number(block_number)) {
-        return NULL;
+static bool inode_open(tfs_ctx_t *ctx, int inumber) {
+    return open_file_table_has(ctx, inumber) ||
+           (ctx->inode_opens != NULL &&
+            __atomic_load_n(&ctx->inode_opens[inumber], __ATOMIC_ACQUIRE) > 0);
+}
+
+/**
+ * Delete the orphans whose last handles were closed by attached instances
+ * (the owner is not told, so it looks for them when it creates or closes a
+ * file).
+ */
+static void orphans_reap(tfs_ctx_t *ctx) {
+    if (ctx->inode_opens == NULL || ctx->shm_attached) {
+        return; // all the handles are this instance's
     }
 
-    insert_delay(); // simulate storage access delay to block
-    return &fs_data[(size_t)block_number * BLOCK_SIZE];
+    while (true) {
+        int inumber = -1;
+        rwl_wrlock(&ctx->open_file_table_rwl);
+        for (size_t i = 0; i < ctx->orphan_count; i++) {
+            if (!inode_open(ctx, ctx->orphans[i])) {
+                inumber = ctx->orphans[i];
+                ctx->orphans[i] = ctx->orphans[--ctx->orphan_count];
+                break;
+            }
+        }
+        rwl_unlock(&ctx->open_file_table_rwl);
+
+        if (inumber == -1) {
+            return;
+        }
+        inode_delete(ctx, inumber);
+    }
 }
 
 /**
@@ -544,35 +3535,49 @@ void *data_block_get(int block_number) {
  * Input:
  *   - inumber: inode number of the file to open
  *   - offset: initial offset
+ *   - append: whether writes go to the end of the file
+ *   - buffered: whether writes are gathered in a buffer (TFS_O_BUFFERED)
  *
  * Returns file handle if successful, -1 otherwise.
  *
  * Possible errors:
  *   - No space in open file table for a new open file.
  */
-int add_to_open_file_table(int inumber, size_t offset) {
+int add_to_open_file_table(tfs_ctx_t *ctx, int inumber, size_t offset,
+                           bool append, bool buffered) {
 
-    rwl_wrlock(&open_file_table_rwl);
+    rwl_wrlock(&ctx->open_file_table_rwl);
 
     for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (free_open_file_entries[i] == FREE) {
-            free_open_file_entries[i] = TAKEN;
-            mutex_lock(&open_file_table[i].lock);
-            open_file_table[i].of_inumber = inumber;
-            open_file_table[i].of_offset = offset;
-            mutex_unlock(&open_file_table[i].lock);
-            rwl_unlock(&open_file_table_rwl);
+        if (ctx->free_open_file_entries[i] == FREE) {
+            ctx->free_open_file_entries[i] = TAKEN;
+            mutex_lock(&ctx->open_file_table[i].lock);
+            ctx->open_file_table[i].of_inumber = inumber;
+            ctx->open_file_table[i].of_offset = offset;
+            ctx->open_file_table[i].of_append = append;
+            ctx->open_file_table[i].of_ra_next = offset;
+            ctx->open_file_table[i].of_ra_window = 0;
+            ctx->open_file_table[i].of_buffered = buffered;
+            ctx->open_file_table[i].of_wbuf_len = 0;
+            mutex_unlock(&ctx->open_file_table[i].lock);
+            if (ctx->shm_attached) {
+                // seen by the owner if it unlinks the file
+                __atomic_add_fetch(&ctx->inode_opens[inumber], 1,
+                                   __ATOMIC_RELEASE);
+            }
+            rwl_unlock(&ctx->open_file_table_rwl);
             return i;
         }
     }
 
-    rwl_unlock(&open_file_table_rwl);
+    rwl_unlock(&ctx->open_file_table_rwl);
 
     return -1;
 }
 
 /**
- * Free an entry from the open file table.
+ * Free an entry from the open file table. If it was the last handle of an
+ * orphan (see inode_orphan), the orphan is deleted.
  *
  * Input:
  *   - fhandle: file handle to free/close
@@ -580,23 +3585,45 @@ int add_to_open_file_table(int inumber, size_t offset) {
  * Returns 0 if succesful and -1 if failed (invalid fhandle or fhandle not in
  * open file table)
  */
-int remove_from_open_file_table(int fhandle) {
+int remove_from_open_file_table(tfs_ctx_t *ctx, int fhandle) {
     // invalid fhandle
-    if (!valid_file_handle(fhandle)) {
+    if (!valid_file_handle(ctx, fhandle)) {
         return -1;
     }
 
-    rwl_wrlock(&open_file_table_rwl);
+    rwl_wrlock(&ctx->open_file_table_rwl);
     // not opened fhandle
-    if (free_open_file_entries[fhandle] == FREE) {
-        rwl_unlock(&open_file_table_rwl);
+    if (ctx->free_open_file_entries[fhandle] == FREE) {
+        rwl_unlock(&ctx->open_file_table_rwl);
         return -1;
     }
 
-    free_open_file_entries[fhandle] = FREE;
+    ctx->free_open_file_entries[fhandle] = FREE;
+
+    int inumber = ctx->open_file_table[fhandle].of_inumber;
+    if (ctx->shm_attached) {
+        // the owner deletes the file if it was unlinked (see orphans_reap)
+        __atomic_sub_fetch(&ctx->inode_opens[inumber], 1, __ATOMIC_RELEASE);
+    }
+    bool last_handle = false;
+    for (size_t i = 0; i < ctx->orphan_count; i++) {
+        if (ctx->orphans[i] == inumber) {
+            last_handle = !inode_open(ctx, inumber);
+            if (last_handle) {
+                ctx->orphans[i] = ctx->orphans[--ctx->orphan_count];
+            }
+            break;
+        }
+    }
 
     // unlock open file table
-    rwl_unlock(&open_file_table_rwl);
+    rwl_unlock(&ctx->open_file_table_rwl);
+
+    // nothing refers to the orphan anymore
+    if (last_handle) {
+        inode_delete(ctx, inumber);
+    }
+    orphans_reap(ctx);
 
     return 0;
 }
@@ -610,45 +3637,45 @@ int remove_from_open_file_table(int fhandle) {
  * Returns pointer to the entry, or NULL if the fhandle is invalid/closed/never
  * opened.
  */
-open_file_entry_t *get_open_file_entry(int fhandle) {
-    if (!valid_file_handle(fhandle)) {
+open_file_entry_t *get_open_file_entry(tfs_ctx_t *ctx, int fhandle) {
+    if (!valid_file_handle(ctx, fhandle)) {
         return NULL;
     }
 
-    if (free_open_file_entries[fhandle] == FREE) {
+    if (ctx->free_open_file_entries[fhandle] == FREE) {
         return NULL;
     }
 
-    return &open_file_table[fhandle];
+    return &ctx->open_file_table[fhandle];
 }
 
 /**
- * Determine if given inumber is in the open file table
+ * Turn a file whose last link was just removed into an orphan if it is still
+ * open, here or in an attached instance: it stays allocated, and readable and
+ * writable through its handles, until the last one is closed (see
+ * remove_from_open_file_table and orphans_reap).
  *
- * Input:
- *   - inumber: inumber of inode to be searched for in open file table
+ * Must be called with the lock of the directory the link was in held for
+ * writing (so that the file is not opened again meanwhile), but not the
+ * inode's (handles are locked before it, and added to the table after).
  *
- * Returns true if given inumber is present in the open file table and false
- * if not.
+ * Input:
+ *   - inumber: inode number of the file
  *
+ * Returns true if the file is now an orphan, false if it is not open (and
+ * can be deleted right away).
  */
-bool is_in_open_file_table(int inumber) {
-    if (!valid_inumber(inumber)) {
+bool inode_orphan(tfs_ctx_t *ctx, int inumber) {
+    if (!valid_inumber(ctx, inumber)) {
         return false;
     }
 
-    rwl_rdlock(&open_file_table_rwl);
-
-    for (int i = 0; i < MAX_OPEN_FILES; ++i) {
-        if (free_open_file_entries[i] == TAKEN) {
-            if (open_file_table[i].of_inumber == inumber) {
-                rwl_unlock(&open_file_table_rwl);
-                return true;
-            }
-        }
+    rwl_wrlock(&ctx->open_file_table_rwl);
+    bool open = inode_open(ctx, inumber);
+    if (open) {
+        ctx->orphans[ctx->orphan_count++] = inumber;
     }
+    rwl_unlock(&ctx->open_file_table_rwl);
 
-    rwl_unlock(&open_file_table_rwl);
-
-    return false;
+    return open;
 }
@@ -1,11 +1,18 @@
 #ifndef STATE_H
 #define STATE_H
 
+#include "async.h"
 #include "config.h"
 #include "operations.h"
+#include "range_lock.h"
+
+#ifdef TFS_STATIC_PARAMS
+#include "static_params.h"
+#endif
 
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
@@ -27,9 +34,32 @@ typedef struct {
     inode_type i_node_type;
     unsigned int i_links_count;
     size_t i_size;
-    int i_data_block;
+    // end of the space handed out to appends, which are published by moving
+    // i_size (their commit watermark) past them once they are copied in
+    size_t i_reserved;
+    // block of each block-sized chunk of the file (-1 if never written, i.e.
+    // a hole that reads as zeros, or a CHUNK_SPILLED slot of the spill file);
+    // directories only use the first one
+    int i_data_blocks[INODE_DIRECT_BLOCKS];
+
+    // content stored in the inode itself instead of in data blocks
+    bool i_inline;
+    char i_inline_data[INODE_INLINE_SIZE];
+
+    // compressed files: a chunk with a non zero i_zlengths entry is stored
+    // compressed, i_zoffsets bytes into its (shared) block
+    bool i_compressed;
+    uint32_t i_zoffsets[INODE_DIRECT_BLOCKS];
+    uint32_t i_zlengths[INODE_DIRECT_BLOCKS];
+    // block compressed chunks are being packed into (-1 if none)
+    int i_zpack;
+    size_t i_zpack_used;
 } inode_t;
 
+// i_data_blocks entry of a chunk moved to a given slot of the spill file
+#define CHUNK_SPILLED(slot) (-2 - (int)(slot))
+#define CHUNK_SPILL_SLOT(entry) ((size_t)(-2 - (entry)))
+
 typedef enum { FREE = 0, TAKEN = 1 } allocation_state_t;
 
 /**
@@ -38,32 +68,110 @@ typedef enum { FREE = 0, TAKEN = 1 } allocation_state_t;
 typedef struct {
     int of_inumber;
     size_t of_offset;
+    bool of_append; // writes go to the end of the file
+    // sequential read detection (see do_read): offset the next sequential
+    // read starts at, and blocks read ahead of it (0 if reads are not
+    // sequential)
+    size_t of_ra_next;
+    size_t of_ra_window;
     pthread_mutex_t lock;
-} open_file_entry_t;
-
-int state_init(tfs_params);
-int state_destroy(void);
-
-size_t state_block_size(void);
 
-int inode_create(inode_type n_type);
-int inode_delete(int inumber);
-inode_t *inode_get(int inumber);
-
-pthread_rwlock_t *inode_rwl_get(int inumber);
-
-int clear_dir_entry(inode_t *inode, char const *sub_name);
-int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber);
-int find_in_dir(inode_t *inode, char const *sub_name);
-
-int data_block_alloc(void);
-int data_block_free(int block_number);
-void *data_block_get(int block_number);
-
-int add_to_open_file_table(int inumber, size_t offset);
-int remove_from_open_file_table(int fhandle);
-open_file_entry_t *get_open_file_entry(int fhandle);
+    // write buffer of TFS_O_BUFFERED handles (see tfs_flush), protected by
+    // of_wbuf_lock, which is taken before lock
+    bool of_buffered;
+    char *of_wbuf; // allocated on the first buffered write
+    size_t of_wbuf_len;
+    uint64_t of_wbuf_since; // when the oldest buffered byte was written (ns)
+    pthread_mutex_t of_wbuf_lock;
+} open_file_entry_t;
 
-bool is_in_open_file_table(int inumber);
+tfs_ctx_t *state_ctx_create(void);
+void state_ctx_free(tfs_ctx_t *instance);
+tfs_ctx_t *state_ctx_default(void);
+tfs_ctx_t *state_ctx_get(tfs_ctx_t *instance);
+
+async_pool_t *state_async_pool(tfs_ctx_t *ctx);
+void state_set_async_pool(tfs_ctx_t *ctx, async_pool_t *pool);
+
+int state_init(tfs_ctx_t *ctx, tfs_params);
+int state_destroy(tfs_ctx_t *ctx);
+int state_grow(tfs_ctx_t *ctx, size_t inode_count, size_t block_count);
+int state_attach(tfs_ctx_t *ctx, char const *shm_name);
+bool state_read_only(tfs_ctx_t *ctx);
+bool state_shared(tfs_ctx_t *ctx);
+
+#ifdef TFS_STATIC_PARAMS
+// the limits are compiled in, the same for every instance
+static inline size_t state_block_size(tfs_ctx_t *ctx) {
+    (void)ctx;
+    return (size_t)TFS_STATIC_BLOCK_SIZE;
+}
+static inline size_t state_max_file_size(tfs_ctx_t *ctx) {
+    (void)ctx;
+    return (size_t)TFS_STATIC_MAX_FILE_BLOCKS * TFS_STATIC_BLOCK_SIZE;
+}
+#else
+size_t state_block_size(tfs_ctx_t *ctx);
+size_t state_max_file_size(tfs_ctx_t *ctx);
+#endif
+
+int inode_create(tfs_ctx_t *ctx, inode_type n_type);
+int inode_delete(tfs_ctx_t *ctx, int inumber);
+bool inode_orphan(tfs_ctx_t *ctx, int inumber);
+inode_t *inode_get(tfs_ctx_t *ctx, int inumber);
+
+pthread_rwlock_t *inode_rwl_get(tfs_ctx_t *ctx, int inumber);
+range_lock_t *inode_range_lock_get(tfs_ctx_t *ctx, int inumber);
+int lock_inode(tfs_ctx_t *ctx, int inumber, bool writer);
+void unlock_inode(tfs_ctx_t *ctx, int inumber, int slot);
+
+bool inode_fits_inline(tfs_ctx_t *ctx, inode_t const *inode, size_t size);
+int inode_promote_inline(tfs_ctx_t *ctx, inode_t *inode);
+int inode_block_alloc(tfs_ctx_t *ctx, inode_t *inode, size_t index);
+int inode_block_resident(tfs_ctx_t *ctx, inode_t *inode, size_t index);
+void inode_free_blocks(tfs_ctx_t *ctx, inode_t *inode);
+
+int inode_block_compress(tfs_ctx_t *ctx, inode_t *inode, size_t index);
+int inode_block_decompress(tfs_ctx_t *ctx, inode_t *inode, size_t index);
+int inode_block_read(tfs_ctx_t *ctx, inode_t const *inode, size_t index,
+                     size_t offset, void *buffer, size_t len);
+
+int inode_block_dedup(tfs_ctx_t *ctx, inode_t *inode, size_t index);
+int inode_block_unshare(tfs_ctx_t *ctx, inode_t *inode, size_t index);
+int inode_clone(tfs_ctx_t *ctx, inode_t *src, inode_t *dst);
+
+int clear_dir_entry(tfs_ctx_t *ctx, inode_t *inode, char const *sub_name);
+int add_dir_entry(tfs_ctx_t *ctx, inode_t *inode, char const *sub_name,
+                  int sub_inumber);
+int find_in_dir(tfs_ctx_t *ctx, inode_t *inode, char const *sub_name);
+ssize_t dir_snapshot(tfs_ctx_t *ctx, inode_t *inode, dir_entry_t **entries);
+size_t dir_create_many(tfs_ctx_t *ctx, inode_t *inode,
+                       char const *const *sub_names, size_t count,
+                       int *results);
+size_t dir_unlink_many(tfs_ctx_t *ctx, inode_t *inode,
+                       char const *const *sub_names, size_t count,
+                       int *results);
+
+int data_block_alloc(tfs_ctx_t *ctx);
+int data_block_ref(tfs_ctx_t *ctx, int block_number);
+int data_block_free(tfs_ctx_t *ctx, int block_number);
+void *data_block_get(tfs_ctx_t *ctx, int block_number);
+void *data_block_get_mut(tfs_ctx_t *ctx, int block_number, bool overwrite);
+void data_block_put_mut(tfs_ctx_t *ctx, int block_number);
+void data_block_prefetch(tfs_ctx_t *ctx, int block_number);
+
+size_t state_numa_stats(tfs_ctx_t *ctx, tfs_numa_node_stats_t *stats,
+                        size_t max_nodes);
+int state_compress_stats(tfs_ctx_t *ctx, tfs_compress_stats_t *stats);
+int state_dedup_stats(tfs_ctx_t *ctx, tfs_dedup_stats_t *stats);
+int state_checksum_stats(tfs_ctx_t *ctx, tfs_checksum_stats_t *stats);
+int state_readahead_stats(tfs_ctx_t *ctx, tfs_readahead_stats_t *stats);
+size_t state_readahead_blocks(tfs_ctx_t *ctx);
+int state_spill_stats(tfs_ctx_t *ctx, tfs_spill_stats_t *stats);
+
+int add_to_open_file_table(tfs_ctx_t *ctx, int inumber, size_t offset,
+                           bool append, bool buffered);
+int remove_from_open_file_table(tfs_ctx_t *ctx, int fhandle);
+open_file_entry_t *get_open_file_entry(tfs_ctx_t *ctx, int fhandle);
 
 #endif // STATE_H
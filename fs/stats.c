@@ -0,0 +1,268 @@
+/**
+ * Latency histograms (built with -DTFS_STATS).
+ *
+ * Each thread records into its own set of histograms, one per event, so the
+ * hot path never takes a lock or shares a cache line. The sets are chained in
+ * a global list and summed when dumped. A set outlives its thread: it is
+ * handed over to the next thread that starts recording, so the counts are
+ * never lost and the memory is bounded by the peak number of threads.
+ *
+ * Histograms are log-linear (as in HdrHistogram): values below
+ * STATS_SUB_BUCKETS nanoseconds get a bucket each, and every power of two
+ * above is split in STATS_SUB_BUCKETS buckets, which keeps the relative error
+ * of any reported value under 1 / STATS_SUB_BUCKETS.
+ */
+#include "stats.h"
+
+#ifdef TFS_STATS
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define STATS_SUB_BUCKETS_LOG (4)
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BUCKETS_LOG)
+// values of up to 2^STATS_MAX_LOG ns (about 18 minutes), larger ones are
+// clamped
+#define STATS_MAX_LOG (40)
+#define STATS_BUCKETS                                                          \
+    ((STATS_MAX_LOG - STATS_SUB_BUCKETS_LOG + 1) * STATS_SUB_BUCKETS)
+
+typedef struct stats_set {
+    // written by the owner thread only, read by stats_dump (relaxed atomics)
+    uint64_t counts[STATS_EVENT_COUNT][STATS_BUCKETS];
+    uint64_t total_ns[STATS_EVENT_COUNT];
+    uint64_t max_ns[STATS_EVENT_COUNT];
+
+    bool owned; // protected by stats_lock
+    struct stats_set *next;
+} stats_set_t;
+
+// not the utils/utils.c wrappers, which record their lock waits here
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static stats_set_t *stats_sets;
+static pthread_once_t stats_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_key;
+static _Thread_local stats_set_t *stats_local;
+
+static char const *const stats_names[STATS_EVENT_COUNT] = {
+    [STATS_OPEN] = "open",
+    [STATS_CLOSE] = "close",
+    [STATS_READ] = "read",
+    [STATS_WRITE] = "write",
+    [STATS_LSEEK] = "lseek",
+    [STATS_UNLINK] = "unlink",
+    [STATS_LINK] = "link",
+    [STATS_SYM_LINK] = "sym_link",
+    [STATS_FLUSH] = "flush",
+    [STATS_STAT] = "stat",
+    [STATS_OPENDIR] = "opendir",
+    [STATS_READDIR] = "readdir",
+    [STATS_CREATE_MANY] = "create_many",
+    [STATS_UNLINK_MANY] = "unlink_many",
+    [STATS_COPY_EXT] = "copy_ext",
+    [STATS_CLONE_FILE] = "clone_file",
+    [STATS_LOCK_WAIT] = "lock_wait",
+    [STATS_DIR_SCAN] = "dir_scan",
+    [STATS_INODE_ALLOC] = "inode_alloc",
+    [STATS_BLOCK_ALLOC] = "block_alloc",
+    [STATS_DELAY] = "delay",
+};
+
+/**
+ * Thread exit: hand the thread's set over to the next thread.
+ */
+static void stats_release(void *set) {
+    pthread_mutex_lock(&stats_lock);
+    ((stats_set_t *)set)->owned = false;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static void stats_key_create(void) {
+    pthread_key_create(&stats_key, stats_release);
+}
+
+/**
+ * Set of the calling thread (taken over or created on its first record).
+ *
+ * Returns NULL if out of memory.
+ */
+static stats_set_t *stats_set_get(void) {
+    if (stats_local != NULL) {
+        return stats_local;
+    }
+
+    pthread_once(&stats_key_once, stats_key_create);
+
+    pthread_mutex_lock(&stats_lock);
+    stats_set_t *set = stats_sets;
+    while (set != NULL && set->owned) {
+        set = set->next;
+    }
+    if (set == NULL) {
+        set = calloc(1, sizeof(stats_set_t));
+        if (set != NULL) {
+            set->next = stats_sets;
+            stats_sets = set;
+        }
+    }
+    if (set != NULL) {
+        set->owned = true;
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    if (set != NULL) {
+        pthread_setspecific(stats_key, set);
+        stats_local = set;
+    }
+
+    return set;
+}
+
+static size_t stats_bucket(uint64_t ns) {
+    if (ns < STATS_SUB_BUCKETS) {
+        return (size_t)ns;
+    }
+    if (ns >= (uint64_t)1 << STATS_MAX_LOG) {
+        return STATS_BUCKETS - 1;
+    }
+
+    // position of the most significant bit, and the bits right below it
+    size_t msb = (size_t)(63 - __builtin_clzll(ns));
+    size_t sub = (size_t)(ns >> (msb - STATS_SUB_BUCKETS_LOG)) &
+                 (STATS_SUB_BUCKETS - 1);
+
+    return (msb - STATS_SUB_BUCKETS_LOG + 1) * STATS_SUB_BUCKETS + sub;
+}
+
+/**
+ * Highest value that falls in a bucket.
+ */
+static uint64_t stats_bucket_value(size_t bucket) {
+    if (bucket < STATS_SUB_BUCKETS) {
+        return bucket;
+    }
+
+    size_t msb = bucket / STATS_SUB_BUCKETS + STATS_SUB_BUCKETS_LOG - 1;
+    uint64_t sub = bucket % STATS_SUB_BUCKETS;
+    uint64_t width = (uint64_t)1 << (msb - STATS_SUB_BUCKETS_LOG);
+
+    return (STATS_SUB_BUCKETS + sub) * width + width - 1;
+}
+
+static inline uint64_t stats_load(uint64_t const *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+// single writer: a plain read-modify-write, published for stats_dump
+static inline void stats_store(uint64_t *counter, uint64_t value) {
+    __atomic_store_n(counter, value, __ATOMIC_RELAXED);
+}
+
+uint64_t stats_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * Record the latency of an event on the calling thread's histograms.
+ */
+void stats_record(stats_event_t event, uint64_t ns) {
+    stats_set_t *set = stats_set_get();
+    if (set == NULL) {
+        return;
+    }
+
+    uint64_t *count = &set->counts[event][stats_bucket(ns)];
+    stats_store(count, stats_load(count) + 1);
+    stats_store(&set->total_ns[event], stats_load(&set->total_ns[event]) + ns);
+    if (ns > stats_load(&set->max_ns[event])) {
+        stats_store(&set->max_ns[event], ns);
+    }
+}
+
+/**
+ * Record a lock wait: the lock wait hook of the utils/utils.c lock wrappers
+ * (see lock_wait_hook_set), set when the FS is initialized.
+ */
+void stats_lock_wait(uint64_t ns) { stats_record(STATS_LOCK_WAIT, ns); }
+
+/**
+ * Value (in microseconds) below which a fraction of the recorded latencies
+ * fall.
+ */
+static double stats_percentile(uint64_t const *counts, uint64_t total,
+                               uint64_t max_ns, double fraction) {
+    uint64_t rank = (uint64_t)((double)total * fraction);
+    uint64_t seen = 0;
+    size_t bucket = 0;
+    while (bucket < STATS_BUCKETS - 1 && seen + counts[bucket] <= rank) {
+        seen += counts[bucket++];
+    }
+
+    // the bucket's bound can overshoot the largest value actually seen
+    uint64_t value = stats_bucket_value(bucket);
+    return (double)(value < max_ns ? value : max_ns) / 1000.0;
+}
+
+/**
+ * Merge the histograms of every thread and print, for each event recorded,
+ * its count and latency distribution (in microseconds).
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int stats_dump(FILE *out) {
+    static uint64_t counts[STATS_BUCKETS];
+
+    pthread_mutex_lock(&stats_lock);
+
+    fprintf(out, "%-12s %10s %10s %10s %10s %10s %10s %10s\n", "event",
+            "count", "mean_us", "p50_us", "p90_us", "p99_us", "p99.9_us",
+            "max_us");
+
+    for (size_t event = 0; event < STATS_EVENT_COUNT; event++) {
+        uint64_t total = 0;
+        uint64_t total_ns = 0;
+        uint64_t max_ns = 0;
+        for (size_t bucket = 0; bucket < STATS_BUCKETS; bucket++) {
+            counts[bucket] = 0;
+        }
+
+        for (stats_set_t *set = stats_sets; set != NULL; set = set->next) {
+            for (size_t bucket = 0; bucket < STATS_BUCKETS; bucket++) {
+                uint64_t count = stats_load(&set->counts[event][bucket]);
+                counts[bucket] += count;
+                total += count;
+            }
+            total_ns += stats_load(&set->total_ns[event]);
+            uint64_t set_max = stats_load(&set->max_ns[event]);
+            max_ns = set_max > max_ns ? set_max : max_ns;
+        }
+
+        if (total == 0) {
+            continue;
+        }
+
+        fprintf(out,
+                "%-12s %10llu %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+                stats_names[event], (unsigned long long)total,
+                (double)total_ns / (double)total / 1000.0,
+                stats_percentile(counts, total, max_ns, 0.5),
+                stats_percentile(counts, total, max_ns, 0.9),
+                stats_percentile(counts, total, max_ns, 0.99),
+                stats_percentile(counts, total, max_ns, 0.999),
+                (double)max_ns / 1000.0);
+    }
+
+    pthread_mutex_unlock(&stats_lock);
+
+    return fflush(out) == 0 ? 0 : -1;
+}
+#else
+int stats_dump(FILE *out) {
+    (void)out;
+    return -1; // compiled out
+}
+#endif
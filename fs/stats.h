@@ -0,0 +1,53 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Events whose latency is recorded: the public operations and the internal
+ * phases they spend their time in (phases nest inside operations, and the
+ * simulated delays inside the other phases).
+ */
+typedef enum {
+    STATS_OPEN,
+    STATS_CLOSE,
+    STATS_READ,
+    STATS_WRITE,
+    STATS_LSEEK,
+    STATS_UNLINK,
+    STATS_LINK,
+    STATS_SYM_LINK,
+    STATS_FLUSH,
+    STATS_STAT,
+    STATS_OPENDIR,
+    STATS_READDIR,
+    STATS_CREATE_MANY,
+    STATS_UNLINK_MANY,
+    STATS_COPY_EXT, // tfs_copy_from_external_fs
+    STATS_CLONE_FILE,
+    STATS_LOCK_WAIT,   // acquiring a rwlock or mutex (see stats_lock_wait)
+    STATS_DIR_SCAN,    // searching or updating directory entries
+    STATS_INODE_ALLOC, // scanning the inode table for a free inode
+    STATS_BLOCK_ALLOC, // scanning the block bitmap for a free block
+    STATS_DELAY,       // simulated storage accesses
+    STATS_EVENT_COUNT,
+} stats_event_t;
+
+#ifdef TFS_STATS
+uint64_t stats_now(void);
+void stats_record(stats_event_t event, uint64_t ns);
+void stats_lock_wait(uint64_t ns);
+
+// time the code between STATS_START(name) and STATS_STOP(event, name)
+#define STATS_START(name) uint64_t name = stats_now()
+#define STATS_STOP(event, name) stats_record(event, stats_now() - (name))
+#else
+// compiled out: no clock reads, no stores
+#define STATS_START(name)
+#define STATS_STOP(event, name)
+#endif
+
+int stats_dump(FILE *out);
+
+#endif // STATS_H
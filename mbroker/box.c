@@ -25,6 +25,7 @@ int box_initialize(box_t *box, char *name) {
     }
 
     box->alloc_state = USED;
+    box->shard = get_box_shard(name);
 
     return 0;
 }
@@ -53,14 +54,13 @@ int create_box(manager_response_t *resp, char *name) {
     }
 
     // create new file in TFS
-    int fd = tfs_open(new_box.name, TFS_O_CREAT);
+    int fd = tfs_ctx_open(new_box.shard, new_box.name, TFS_O_CREAT);
     if (fd == -1) {
         manager_response_set_error_msg(resp, RESP_ERR_CREATE_BOX);
-        tfs_close(fd);
         return -1;
     }
 
-    tfs_close(fd);
+    tfs_ctx_close(new_box.shard, fd);
 
     box_t *boxes = get_mbroker_boxes_ref();
     mutex_lock(get_mbroker_boxes_lock());
@@ -98,7 +98,10 @@ int delete_box(manager_response_t *resp, char *name) {
 
     mutex_lock(&box->mutex);
 
-    if (tfs_unlink(box->name) != 0) {
+    // publishers and subscribers still attached keep their handles until
+    // they notice, the box's file is deleted when the last one closes it
+    if (tfs_ctx_unlink(box->shard, box->name) != 0) {
+        mutex_unlock(&box->mutex);
         manager_response_set_error_msg(resp, RESP_ERR_DELETE_BOX);
         return -1;
     }
@@ -113,18 +116,20 @@ int delete_box(manager_response_t *resp, char *name) {
 }
 
 /**
- * Writes a message to box opened with fd
+ * Writes a message to box opened with fd (with TFS_O_BUFFERED, the message is
+ * written to the box file in one go, when flushed)
  */
-ssize_t write_message(int fd, char *message) {
+ssize_t write_message(box_t *box, int fd, char *message) {
     size_t len = strlen(message);
-    ssize_t ret = tfs_write(fd, message, len);
+    ssize_t ret = tfs_ctx_write(box->shard, fd, message, len);
     // partial write or no write
     if (ret != len) {
         return -1;
     }
 
     // write \0 to sinalize end of message inside tfs file
-    if (tfs_write(fd, "\0", 1) == -1) {
+    if (tfs_ctx_write(box->shard, fd, "\0", 1) == -1 ||
+        tfs_ctx_flush(box->shard, fd) == -1) {
         return -1;
     }
 
@@ -134,10 +139,10 @@ ssize_t write_message(int fd, char *message) {
 /**
  * Reads a message from a box opened with fd, saves it to buffer
  */
-ssize_t read_message(int fd, char *buffer) {
+ssize_t read_message(box_t *box, int fd, char *buffer) {
     int i = 0;
     do {
-        ssize_t ret = tfs_read(fd, buffer + i, 1);
+        ssize_t ret = tfs_ctx_read(box->shard, fd, buffer + i, 1);
         // bad read
         if (ret != 1)
             return -1;
@@ -1,6 +1,7 @@
 #ifndef BOX_H
 #define BOX_H
 
+#include "operations.h"
 #include "response.h"
 #include <pthread.h>
 #include <stdint.h>
@@ -15,6 +16,8 @@ struct box_t {
     pthread_cond_t condition;
     pthread_mutex_t mutex;
     box_allocation_state_t alloc_state;
+    // TFS shard the box's file is stored in
+    tfs_ctx_t *shard;
 };
 
 typedef struct box_t box_t;
@@ -22,7 +25,7 @@ int create_box(manager_response_t *resp, char *name);
 int delete_box(manager_response_t *resp, char *name);
 int box_initialize(box_t *box, char *name);
 
-ssize_t write_message(int fd, char *msg);
-ssize_t read_message(int fd, char *msg);
+ssize_t write_message(box_t *box, int fd, char *msg);
+ssize_t read_message(box_t *box, int fd, char *msg);
 
 #endif
\ No newline at end of file
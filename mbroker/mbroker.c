@@ -11,6 +11,7 @@
 #include <pthread.h>
 #include <signal.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -20,6 +21,10 @@
 box_t *mbroker_boxes;
 pthread_mutex_t mbroker_boxes_lock = PTHREAD_MUTEX_INITIALIZER;
 static int box_count;
+// TFS instances the boxes are spread across, by a hash of their names, so that
+// boxes in different shards share no directory lock nor allocator
+static tfs_ctx_t *tfs_shards[TFS_SHARD_COUNT_MAX];
+static size_t tfs_shard_count;
 static volatile sig_atomic_t interrupt_var;
 
 /**
@@ -59,19 +64,38 @@ void *worker_thread_fn(void *queue) {
 }
 
 /**
- * Initialize mbroker
+ * Initialize mbroker, with its boxes spread across shard_count TFS instances
+ * (that read ahead up to readahead_blocks blocks of the boxes read
+ * sequentially, and spill up to spill_blocks blocks each to a host file; 0
+ * for none)
  */
-int init_mbroker() {
-    // initialize tfs instance
+int init_mbroker(size_t shard_count, size_t readahead_blocks,
+                 size_t spill_blocks) {
+    // initialize tfs instances
     tfs_params params = tfs_default_params();
     /**
-     * Ideally max open file entries should be a number close to max sessions
+     * Ideally max open file entries should be a number close to max sessions.
+     * Every shard has room for all the boxes, however they hash.
+     * Subscribers read their box sequentially, so it can be read ahead of
+     * them.
+     * Old messages are rarely read again, so they can be spilled to a host
+     * file (one per shard) once the shard's memory is full.
      */
+    char spill_path[PIPE_PATHNAME_LENGTH];
     params.max_inode_count = BOX_COUNT_MAX;
-
-    if (tfs_init(&params) != 0) {
-        PANIC(FATAL_TFS_INIT);
-        return -1;
+    params.readahead_blocks = readahead_blocks;
+    params.spill_path = spill_blocks > 0 ? spill_path : NULL;
+    params.spill_block_count = spill_blocks;
+
+    for (tfs_shard_count = 0; tfs_shard_count < shard_count;
+         tfs_shard_count++) {
+        snprintf(spill_path, sizeof(spill_path), MBROKER_SPILL_PATH_FORMAT,
+                 (int)getpid(), tfs_shard_count);
+        tfs_shards[tfs_shard_count] = tfs_ctx_init(&params);
+        if (tfs_shards[tfs_shard_count] == NULL) {
+            PANIC(FATAL_TFS_INIT, tfs_shard_count);
+            return -1;
+        }
     }
 
     // assign SIGINT handler
@@ -107,10 +131,13 @@ int mbroker_destroy() {
         mutex_destroy(&mbroker_boxes[i].mutex);
     }
 
-    if (tfs_destroy() != 0) {
-        PANIC(FATAL_TFS_DESTROY);
-        return -1;
+    for (size_t i = 0; i < tfs_shard_count; ++i) {
+        if (tfs_ctx_destroy(tfs_shards[i]) != 0) {
+            PANIC(FATAL_TFS_DESTROY);
+            return -1;
+        }
     }
+    tfs_shard_count = 0;
 
     free(mbroker_boxes);
     mutex_destroy(&mbroker_boxes_lock);
@@ -124,12 +151,39 @@ int mbroker_destroy() {
  */
 int main(int argc, char **argv) {
     if (argc < 3 || strcmp(argv[1], "--help") == 0) {
-        fprintf(stdout, "usage: mbroker <pipename> <max-sessions>\n");
+        fprintf(stdout,
+                "usage: mbroker <pipename> <max-sessions> [tfs-shards "
+                "[readahead-blocks [spill-blocks]]]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // number of TFS instances storing the boxes (1 by default)
+    int shard_count = argc > 3 ? atoi(argv[3]) : 1;
+    if (shard_count < 1 || shard_count > TFS_SHARD_COUNT_MAX) {
+        fprintf(stderr, "ERROR: The number of TFS shards must be 1 to %d\n",
+                TFS_SHARD_COUNT_MAX);
+        exit(EXIT_FAILURE);
+    }
+
+    // blocks read ahead of the subscribers (none by default, at most what the
+    // read-ahead queue holds)
+    int readahead_blocks = argc > 4 ? atoi(argv[4]) : 0;
+    if (readahead_blocks < 0 || readahead_blocks > READAHEAD_QUEUE) {
+        fprintf(stderr, "ERROR: The read-ahead blocks must be 0 to %d\n",
+                READAHEAD_QUEUE);
+        exit(EXIT_FAILURE);
+    }
+
+    // blocks each shard can spill to a file in /tmp (no spill file by default)
+    int spill_blocks = argc > 5 ? atoi(argv[5]) : 0;
+    if (spill_blocks < 0) {
+        fprintf(stderr, "ERROR: The spill blocks cannot be negative\n");
         exit(EXIT_FAILURE);
     }
 
     // initialize mbroker
-    if (init_mbroker() != 0) {
+    if (init_mbroker((size_t)shard_count, (size_t)readahead_blocks,
+                     (size_t)spill_blocks) != 0) {
         exit(EXIT_FAILURE);
     }
 
@@ -306,8 +360,10 @@ int handle_publisher(registration_request_t *req) {
         return -1;
     }
 
-    // open box file in TFS
-    int box_fd = tfs_open(box->name, TFS_O_APPEND);
+    // open box file in TFS (each message and its terminator are buffered and
+    // written together, see write_message)
+    int box_fd =
+        tfs_ctx_open(box->shard, box->name, TFS_O_APPEND | TFS_O_BUFFERED);
     if (box_fd == -1) {
         fprintf(stderr, BOX_TFS_ERR_MSG, box->name);
         close(publisher_fd);
@@ -347,7 +403,7 @@ int handle_publisher(registration_request_t *req) {
         // lock box before writting operation
         mutex_lock(&box->mutex);
         // write message contents into box
-        ret = write_message(box_fd, pub_r.message);
+        ret = write_message(box, box_fd, pub_r.message);
         // if unsucessful write
         if (ret == -1) {
             mutex_unlock(&box->mutex);
@@ -365,7 +421,7 @@ int handle_publisher(registration_request_t *req) {
     box->n_publishers--;
     mutex_unlock(&box->mutex);
 
-    tfs_close(box_fd);
+    tfs_ctx_close(box->shard, box_fd);
     // close pipe
     close(publisher_fd);
 
@@ -397,7 +453,7 @@ int handle_subscriber(registration_request_t *req) {
 
     mutex_lock(&box->mutex);
     // open file in TFS
-    int box_fd = tfs_open(box->name, 0);
+    int box_fd = tfs_ctx_open(box->shard, box->name, 0);
     if (box_fd == -1) {
         fprintf(stderr, BOX_TFS_ERR_MSG, box->name);
         close(sub_fd);
@@ -421,7 +477,7 @@ int handle_subscriber(registration_request_t *req) {
             // wait untill there are messages to be read
             cond_wait(&box->condition, &box->mutex);
         }
-        ssize_t ret = read_message(box_fd, BUFF);
+        ssize_t ret = read_message(box, box_fd, BUFF);
         // session closed (EPIPE read)
         if (ret == -1) {
             break;
@@ -459,7 +515,7 @@ int handle_subscriber(registration_request_t *req) {
 
     box->n_subscribers--;
     close(sub_fd);
-    tfs_close(box_fd);
+    tfs_ctx_close(box->shard, box_fd);
 
     mutex_unlock(&box->mutex);
 
@@ -590,6 +646,19 @@ box_t *get_box(char *name) {
     return NULL;
 }
 
+/**
+ * Return the TFS shard storing the box with given name (without the leading
+ * '/'), picked by a hash of the name
+ */
+tfs_ctx_t *get_box_shard(char const *name) {
+    size_t hash = 5381; // djb2
+    for (char const *c = name; *c != '\0'; c++) {
+        hash = hash * 33 + (unsigned char)*c;
+    }
+
+    return tfs_shards[hash % tfs_shard_count];
+}
+
 /**
  * Return the array storing all mbroker's boxes
  *
@@ -11,6 +11,8 @@
  * Configuration macros
  */
 #define BOX_COUNT_MAX 1024
+#define TFS_SHARD_COUNT_MAX 64
+#define MBROKER_SPILL_PATH_FORMAT "/tmp/mbroker-%d-%zu.spill"
 #define PIPE_PATHNAME_LENGTH 256
 
 /**
@@ -25,7 +27,7 @@
  * Fatal error messages
  */
 #define FATAL_SIGNAL_MSG "FATAL: Failed to overwrite default signal handler\n"
-#define FATAL_TFS_INIT "FATAL: Failed to instanciate TFS\n"
+#define FATAL_TFS_INIT "FATAL: Failed to instanciate TFS shard %zu\n"
 #define FATAL_TFS_DESTROY "FATAL: Failed to destroy TFS\n"
 #define FATAL_FIFO_CREATE "FATAL: Failed to create FIFO %s\n"
 #define FATAL_PCQ_INIT "FATAL: Failed to initialize producer consumer queue\n"
@@ -54,6 +56,7 @@ int handle_manager(registration_request_t *);
 int handle_list(registration_request_t *);
 
 box_t *get_box(char *name);
+tfs_ctx_t *get_box_shard(char const *name);
 box_t *get_mbroker_boxes_ref();
 pthread_mutex_t *get_mbroker_boxes_lock();
 
@@ -0,0 +1,133 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define THREADS 8
+#define RECORDS 64
+#define RECORD 32
+#define FILE_SIZE (THREADS * RECORDS * RECORD)
+
+static char const *path = "/log";
+static int append_fd;
+static bool appending = true;
+
+// a record tells its writer and sequence number apart in every byte
+static void make_record(char *record, size_t thread, size_t seq) {
+    record[0] = (char)('A' + thread);
+    record[1] = (char)seq;
+    memset(record + 2, (char)(thread * RECORDS + seq), RECORD - 2);
+}
+
+static bool record_ok(char const *record) {
+    size_t thread = (size_t)(record[0] - 'A');
+    size_t seq = (size_t)record[1];
+    if (thread >= THREADS || seq >= RECORDS) {
+        return false;
+    }
+
+    for (size_t i = 2; i < RECORD; i++) {
+        if (record[i] != (char)(thread * RECORDS + seq)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void *appender(void *arg) {
+    size_t thread = (size_t)arg;
+    char record[RECORD];
+
+    // every thread appends through the same handle
+    for (size_t seq = 0; seq < RECORDS; seq++) {
+        make_record(record, thread, seq);
+        assert(tfs_write(append_fd, record, RECORD) == RECORD);
+    }
+
+    return NULL;
+}
+
+static void *reader(void *arg) {
+    (void)arg;
+    static char buffer[FILE_SIZE];
+
+    int fd = tfs_open(path, 0);
+    assert(fd != -1);
+
+    // only whole appends are ever seen, however far the others got
+    while (__atomic_load_n(&appending, __ATOMIC_ACQUIRE)) {
+        assert(tfs_lseek(fd, 0, TFS_SEEK_SET) == 0);
+        ssize_t read = tfs_read(fd, buffer, sizeof(buffer));
+        assert(read != -1 && read % RECORD == 0);
+        for (ssize_t i = 0; i < read; i += RECORD) {
+            assert(record_ok(buffer + i));
+        }
+    }
+
+    assert(tfs_close(fd) != -1);
+    return NULL;
+}
+
+int main() {
+    static char buffer[FILE_SIZE];
+    pthread_t appenders[THREADS];
+    pthread_t reader_tid;
+
+    tfs_params params = tfs_default_params();
+    params.max_file_blocks = FILE_SIZE / params.block_size;
+    assert(tfs_init(&params) != -1);
+
+    append_fd = tfs_open(path, TFS_O_CREAT | TFS_O_APPEND);
+    assert(append_fd != -1);
+
+    assert(pthread_create(&reader_tid, NULL, reader, NULL) == 0);
+    for (size_t t = 0; t < THREADS; t++) {
+        assert(pthread_create(&appenders[t], NULL, appender, (void *)t) == 0);
+    }
+    for (size_t t = 0; t < THREADS; t++) {
+        assert(pthread_join(appenders[t], NULL) == 0);
+    }
+    __atomic_store_n(&appending, false, __ATOMIC_RELEASE);
+    assert(pthread_join(reader_tid, NULL) == 0);
+
+    // the file is full: further appends write nothing
+    assert(tfs_write(append_fd, buffer, RECORD) == 0);
+    assert(tfs_close(append_fd) != -1);
+
+    tfs_stat_t stat;
+    assert(tfs_stat(path, &stat) != -1);
+    assert(stat.size == FILE_SIZE);
+
+    // every record is there once, each thread's in the order it wrote them
+    int fd = tfs_open(path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fd, buffer, sizeof(buffer)) == FILE_SIZE);
+    assert(tfs_close(fd) != -1);
+
+    size_t next_seq[THREADS] = {0};
+    for (size_t i = 0; i < FILE_SIZE; i += RECORD) {
+        assert(record_ok(buffer + i));
+        size_t thread = (size_t)(buffer[i] - 'A');
+        assert((size_t)buffer[i + 1] == next_seq[thread]);
+        next_seq[thread]++;
+    }
+    for (size_t t = 0; t < THREADS; t++) {
+        assert(next_seq[t] == RECORDS);
+    }
+
+    // truncating starts the appends over
+    fd = tfs_open(path, TFS_O_TRUNC | TFS_O_APPEND);
+    assert(fd != -1);
+    assert(tfs_write(fd, buffer, RECORD) == RECORD);
+    assert(tfs_close(fd) != -1);
+    assert(tfs_stat(path, &stat) != -1);
+    assert(stat.size == RECORD);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FILES 4
+#define WRITES 16
+#define RECORD 64
+
+static void reap_all(tfs_ring_t *ring, tfs_completion_t *completions,
+                     size_t count) {
+    size_t reaped = 0;
+    while (reaped < count) {
+        ssize_t n = tfs_reap(ring, completions + reaped, count - reaped, 1);
+        assert(n > 0);
+        reaped += (size_t)n;
+    }
+}
+
+int main() {
+    static char records[FILES][WRITES][RECORD];
+    static char read_back[FILES][WRITES][RECORD];
+    char paths[FILES][8];
+    int fds[FILES];
+    tfs_op_t ops[FILES * WRITES];
+    tfs_completion_t completions[FILES * WRITES];
+
+    tfs_params params = tfs_default_params();
+    params.async_workers = 2;
+    assert(tfs_init(&params) != -1);
+
+    tfs_ring_t *ring = tfs_ring_create(FILES * WRITES);
+    assert(ring != NULL);
+
+    // open every file in one batch
+    for (int f = 0; f < FILES; f++) {
+        snprintf(paths[f], sizeof(paths[f]), "/f%d", f);
+        ops[f] = (tfs_op_t){.op = TFS_OP_OPEN,
+                            .name = paths[f],
+                            .mode = TFS_O_CREAT,
+                            .user_data = (unsigned long)f};
+    }
+    assert(tfs_submit(ring, ops, FILES) == FILES);
+    reap_all(ring, completions, FILES);
+    for (int i = 0; i < FILES; i++) {
+        assert(completions[i].result != -1);
+        fds[completions[i].user_data] = (int)completions[i].result;
+    }
+
+    // many small writes in flight, interleaved across the files
+    size_t n = 0;
+    for (int w = 0; w < WRITES; w++) {
+        for (int f = 0; f < FILES; f++) {
+            memset(records[f][w], 'a' + (f * WRITES + w) % 26, RECORD);
+            ops[n++] = (tfs_op_t){.op = TFS_OP_WRITE,
+                                  .fhandle = fds[f],
+                                  .buffer = records[f][w],
+                                  .len = RECORD,
+                                  .user_data = (unsigned long)(f * WRITES + w)};
+        }
+    }
+    assert(tfs_submit(ring, ops, n) == (ssize_t)n);
+
+    // the ring is full, nothing else fits until completions are reaped
+    tfs_op_t close_op = {.op = TFS_OP_CLOSE, .fhandle = fds[0]};
+    assert(tfs_submit(ring, &close_op, 1) == 0);
+
+    reap_all(ring, completions, n);
+    for (size_t i = 0; i < n; i++) {
+        assert(completions[i].result == RECORD);
+    }
+
+    // read everything back, in order, through the same file handles
+    n = 0;
+    for (int f = 0; f < FILES; f++) {
+        ops[n++] = (tfs_op_t){.op = TFS_OP_CLOSE, .fhandle = fds[f]};
+    }
+    assert(tfs_submit(ring, ops, n) == (ssize_t)n);
+    reap_all(ring, completions, n);
+
+    n = 0;
+    for (int f = 0; f < FILES; f++) {
+        ops[n++] = (tfs_op_t){.op = TFS_OP_OPEN,
+                              .name = paths[f],
+                              .mode = 0,
+                              .user_data = (unsigned long)f};
+    }
+    assert(tfs_submit(ring, ops, n) == (ssize_t)n);
+    reap_all(ring, completions, n);
+    for (int i = 0; i < FILES; i++) {
+        assert(completions[i].result != -1);
+        fds[completions[i].user_data] = (int)completions[i].result;
+    }
+
+    n = 0;
+    for (int f = 0; f < FILES; f++) {
+        for (int w = 0; w < WRITES; w++) {
+            ops[n++] = (tfs_op_t){.op = TFS_OP_READ,
+                                  .fhandle = fds[f],
+                                  .buffer = read_back[f][w],
+                                  .len = RECORD};
+        }
+    }
+    assert(tfs_submit(ring, ops, n) == (ssize_t)n);
+    reap_all(ring, completions, n);
+    for (size_t i = 0; i < n; i++) {
+        assert(completions[i].result == RECORD);
+    }
+    assert(memcmp(records, read_back, sizeof(records)) == 0);
+
+    // errors are reported in the completions
+    tfs_op_t unlink_op = {.op = TFS_OP_UNLINK, .name = "/missing"};
+    assert(tfs_submit(ring, &unlink_op, 1) == 1);
+    reap_all(ring, completions, 1);
+    assert(completions[0].result == -1);
+
+    tfs_ring_destroy(ring);
+
+    // without storage threads there is no asynchronous interface
+    assert(tfs_destroy() != -1);
+    assert(tfs_init(NULL) != -1);
+    assert(tfs_ring_create(8) == NULL);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BATCH 30
+
+int main() {
+    char paths[BATCH][16];
+    char const *names[BATCH];
+    int results[BATCH];
+
+    assert(tfs_init(NULL) != -1);
+
+    // an existing file, and a batch with a repeated and an invalid name
+    int fd = tfs_open("/f0", TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_close(fd) != -1);
+
+    char const *first[] = {"/f0", "/f1", "/f2", "/f1", "f3", "/f4"};
+    assert(tfs_create_many(first, 6, results) == 3);
+    int const first_results[] = {-1, 0, 0, -1, -1, 0};
+    assert(memcmp(results, first_results, sizeof(first_results)) == 0);
+
+    for (int i = 1; i < 5; i++) {
+        char path[8];
+        snprintf(path, sizeof(path), "/f%d", i);
+        fd = tfs_open(path, 0);
+        assert((fd != -1) == (i != 3));
+        if (fd != -1) {
+            assert(tfs_close(fd) != -1);
+        }
+    }
+
+    // the directory fills up midway through a batch
+    for (int i = 0; i < BATCH; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "/g%d", i);
+        names[i] = paths[i];
+    }
+    ssize_t created = tfs_create_many(names, BATCH, results);
+    assert(created > 0 && created < BATCH);
+    for (int i = 0; i < BATCH; i++) {
+        assert(results[i] == (i < created ? 0 : -1));
+    }
+
+    // open files are unlinked too (and deleted once closed), missing ones are
+    // reported
+    fd = tfs_open("/g0", 0);
+    assert(fd != -1);
+    assert(tfs_unlink_many(names, BATCH, results) == created);
+    for (int i = 0; i < BATCH; i++) {
+        assert(results[i] == (i < created ? 0 : -1));
+        assert(tfs_open(names[i], 0) == -1);
+    }
+    assert(tfs_write(fd, "g0", 2) == 2);
+    assert(tfs_close(fd) != -1);
+
+    // files with other hard links survive
+    assert(tfs_link("/f1", "/h1") != -1);
+    char const *second[] = {"/f0", "/f1", "/f2", "/f4"};
+    assert(tfs_unlink_many(second, 4, results) == 4);
+    fd = tfs_open("/h1", 0);
+    assert(fd != -1);
+    assert(tfs_close(fd) != -1);
+
+    // the freed entries and inodes can be reused (only /h1 is left)
+    assert(tfs_create_many(names, BATCH, results) > created);
+
+    assert(tfs_create_many(NULL, 1, results) == -1);
+    assert(tfs_unlink_many(names, 0, NULL) == 0);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include "fs/config.h"
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define BLOCK 1024
+#define BLOCKS 16
+#define TINY_WRITES 100
+
+static char const *path = "/f1";
+
+static size_t file_size(void) {
+    tfs_stat_t stat;
+    assert(tfs_stat(path, &stat) != -1);
+    return stat.size;
+}
+
+int main() {
+    char buffer[BLOCKS * BLOCK];
+    char large[WRITE_BUFFER_SIZE + 1];
+    memset(large, 'L', sizeof(large));
+
+    tfs_params params = tfs_default_params();
+    params.max_file_blocks = BLOCKS;
+    assert(tfs_init(&params) != -1);
+
+    // tiny writes are only seen once flushed
+    int fd = tfs_open(path, TFS_O_CREAT | TFS_O_BUFFERED);
+    assert(fd != -1);
+    for (int i = 0; i < TINY_WRITES; i++) {
+        char c = (char)('a' + i % 26);
+        assert(tfs_write(fd, &c, 1) == 1);
+    }
+    assert(file_size() == 0);
+    assert(tfs_flush(fd) != -1);
+    assert(file_size() == TINY_WRITES);
+    assert(tfs_flush(fd) != -1); // nothing left
+
+    // reads and seeks through the handle see its own writes
+    assert(tfs_write(fd, "xyz", 3) == 3);
+    assert(tfs_lseek(fd, 0, TFS_SEEK_SET) == 0);
+    assert(file_size() == TINY_WRITES + 3);
+    assert(tfs_read(fd, buffer, sizeof(buffer)) == TINY_WRITES + 3);
+    for (int i = 0; i < TINY_WRITES; i++) {
+        assert(buffer[i] == 'a' + i % 26);
+    }
+    assert(memcmp(buffer + TINY_WRITES, "xyz", 3) == 0);
+
+    // writes larger than the buffer go after what is buffered
+    assert(tfs_write(fd, "123", 3) == 3);
+    assert(tfs_write(fd, large, sizeof(large)) == sizeof(large));
+    assert(file_size() == TINY_WRITES + 6 + sizeof(large));
+
+    // a buffer that fills up is flushed by the write that fills it
+    size_t size = file_size();
+    assert(tfs_write(fd, "12", 2) == 2);
+    assert(tfs_write(fd, large, WRITE_BUFFER_SIZE - 2) ==
+           WRITE_BUFFER_SIZE - 2);
+    assert(file_size() == size + WRITE_BUFFER_SIZE);
+
+    // old buffered data is flushed by the next write
+    assert(tfs_write(fd, "o", 1) == 1);
+    struct timespec pause = {.tv_sec = 0,
+                             .tv_nsec = 2 * WRITE_BUFFER_AGE_MS * 1000000};
+    nanosleep(&pause, NULL);
+    assert(file_size() == size + WRITE_BUFFER_SIZE);
+    assert(tfs_write(fd, "n", 1) == 1);
+    assert(file_size() == size + WRITE_BUFFER_SIZE + 2);
+
+    // closing flushes
+    assert(tfs_write(fd, "c", 1) == 1);
+    assert(tfs_close(fd) != -1);
+    assert(file_size() == size + WRITE_BUFFER_SIZE + 3);
+    assert(tfs_flush(fd) == -1);
+
+    // buffered appends go to the end of the file, and other handles do not
+    // flush
+    fd = tfs_open(path, TFS_O_APPEND | TFS_O_BUFFERED);
+    assert(fd != -1);
+    int plain = tfs_open(path, 0);
+    assert(plain != -1);
+    assert(tfs_flush(plain) != -1);
+    assert(tfs_write(fd, "end", 3) == 3);
+    assert(tfs_close(plain) != -1);
+    assert(file_size() == size + WRITE_BUFFER_SIZE + 3);
+    assert(tfs_close(fd) != -1);
+    assert(file_size() == size + WRITE_BUFFER_SIZE + 6);
+
+    // buffered writes past the maximum file size fail when flushed
+    fd = tfs_open(path, TFS_O_TRUNC | TFS_O_BUFFERED);
+    assert(fd != -1);
+    assert(tfs_lseek(fd, BLOCKS * BLOCK - 1, TFS_SEEK_SET) != -1);
+    assert(tfs_write(fd, "ab", 2) == 2);
+    assert(tfs_flush(fd) == -1);
+    assert(file_size() == BLOCKS * BLOCK);
+    assert(tfs_close(fd) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "fs/crc32c.h"
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define BLOCK 1024
+
+char const file_path[] = "/f1";
+
+int main() {
+    static char contents[2 * BLOCK];
+    static char buffer[2 * BLOCK];
+
+    for (size_t i = 0; i < sizeof(contents); i++) {
+        contents[i] = (char)(i * 31 + i / 7);
+    }
+
+    // hardware and portable checksums agree (and match the standard value)
+    crc32c_init();
+    assert(crc32c(0, "123456789", 9) == 0xE3069283);
+    for (size_t len = 0; len <= sizeof(contents); len += 61) {
+        assert(crc32c(0, contents + len % 8, len - len % 8) ==
+               crc32c_portable(0, contents + len % 8, len - len % 8));
+    }
+
+    tfs_params params = tfs_default_params();
+    params.max_file_blocks = 2;
+    params.checksums = true;
+    params.scrub_interval_ms = 1;
+    assert(tfs_init(&params) != -1);
+
+    int fd = tfs_open(file_path, TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fd, contents, sizeof(contents)) == sizeof(contents));
+    assert(tfs_close(fd) != -1);
+
+    fd = tfs_open(file_path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fd, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(memcmp(buffer, contents, sizeof(contents)) == 0);
+    assert(tfs_close(fd) != -1);
+
+    tfs_checksum_stats_t stats;
+    assert(tfs_checksum_stats(&stats) != -1);
+    assert(stats.verified > 0);
+    assert(stats.errors == 0);
+
+    // flip a bit of the file's second block behind the FS's back
+    tfs_ctx_t *ctx = state_ctx_default(); // the one behind tfs_open
+    int inumber = 1;                      // first file created
+    char *block =
+        data_block_get(ctx, inode_get(ctx, inumber)->i_data_blocks[1]);
+    assert(block != NULL);
+    block[10] ^= 1;
+
+    // reading it fails, the first block is still readable
+    fd = tfs_open(file_path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fd, buffer, BLOCK) == BLOCK);
+    assert(tfs_read(fd, buffer, BLOCK) == -1);
+
+    assert(tfs_checksum_stats(&stats) != -1);
+    assert(stats.errors == 1);
+
+    // the scrub finds it too
+    struct timespec tick = {.tv_sec = 0, .tv_nsec = 1000000};
+    for (int i = 0; i < 5000 && stats.scrub_errors == 0; i++) {
+        nanosleep(&tick, NULL);
+        assert(tfs_checksum_stats(&stats) != -1);
+    }
+    assert(stats.scrub_errors > 0);
+
+    // rewriting the whole block repairs it
+    assert(tfs_lseek(fd, BLOCK, TFS_SEEK_SET) == BLOCK);
+    assert(tfs_write(fd, contents + BLOCK, BLOCK) == BLOCK);
+    assert(tfs_lseek(fd, 0, TFS_SEEK_SET) == 0);
+    assert(tfs_read(fd, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(memcmp(buffer, contents, sizeof(contents)) == 0);
+    assert(tfs_close(fd) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
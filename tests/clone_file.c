@@ -0,0 +1,172 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BLOCK 1024
+#define BLOCKS 4
+#define OTHERS 2
+
+static void write_file(char const *name, tfs_file_mode_t mode,
+                       char const *contents, size_t len) {
+    int fd = tfs_open(name, TFS_O_CREAT | mode);
+    assert(fd != -1);
+    assert(tfs_write(fd, contents, len) == len);
+    assert(tfs_close(fd) != -1);
+}
+
+static void check_file(char const *name, char const *contents, size_t len) {
+    char buffer[BLOCKS * BLOCK + 1];
+    int fd = tfs_open(name, 0);
+    assert(fd != -1);
+    assert(tfs_read(fd, buffer, sizeof(buffer)) == len);
+    assert(memcmp(buffer, contents, len) == 0);
+    assert(tfs_close(fd) != -1);
+}
+
+// a file of whole blocks, each filled with its own letter
+static void make_blocks(char *contents, char first) {
+    for (size_t i = 0; i < BLOCKS; i++) {
+        memset(contents + i * BLOCK, first + (char)i, BLOCK);
+    }
+}
+
+int main() {
+    char contents[BLOCKS * BLOCK];
+    char changed[BLOCKS * BLOCK];
+    char others[OTHERS][BLOCKS * BLOCK];
+    char path[16];
+    memset(contents, 'c', sizeof(contents));
+
+    // room for the root directory, one full file and a single spare block
+    tfs_params params = tfs_default_params();
+    params.max_block_count = BLOCKS + 2;
+    params.max_file_blocks = BLOCKS;
+    assert(tfs_init(&params) != -1);
+    write_file("/src", 0, contents, sizeof(contents));
+
+    // clones take no blocks of their own
+    assert(tfs_clone_file("/src", "/a") != -1);
+    assert(tfs_clone_file("/src", "/b") != -1);
+    check_file("/a", contents, sizeof(contents));
+    check_file("/b", contents, sizeof(contents));
+
+    assert(tfs_clone_file("/missing", "/c") == -1);
+    assert(tfs_clone_file("/src", "/a") == -1);
+    assert(tfs_clone_file("/src", "no_slash") == -1);
+    assert(tfs_clone_file("/", "/c") == -1);
+    assert(tfs_sym_link("/src", "/s") != -1);
+    assert(tfs_clone_file("/s", "/c") == -1);
+    tfs_stat_t stat;
+    assert(tfs_stat("/c", &stat) == -1);
+
+    // a block is copied when one of them modifies it
+    memcpy(changed, contents, sizeof(changed));
+    memset(changed + BLOCK, 'x', 10);
+    int fd = tfs_open("/a", 0);
+    assert(fd != -1);
+    assert(tfs_lseek(fd, BLOCK, TFS_SEEK_SET) == BLOCK);
+    assert(tfs_write(fd, changed + BLOCK, 10) == 10);
+    // (and no other block is left for a second copy)
+    assert(tfs_lseek(fd, 0, TFS_SEEK_SET) == 0);
+    assert(tfs_write(fd, "x", 1) == -1);
+    assert(tfs_close(fd) != -1);
+    check_file("/a", changed, sizeof(changed));
+    check_file("/src", contents, sizeof(contents));
+    check_file("/b", contents, sizeof(contents));
+
+    // the blocks live on with the last file sharing them
+    assert(tfs_unlink("/src") != -1);
+    assert(tfs_unlink("/b") != -1);
+    check_file("/a", changed, sizeof(changed));
+    assert(tfs_unlink("/a") != -1);
+    write_file("/src", 0, contents, sizeof(contents));
+    check_file("/src", contents, sizeof(contents));
+    assert(tfs_destroy() != -1);
+
+    // files kept in their inode and compressed files are cloned too
+    params.max_block_count = 3 * BLOCKS;
+    params.dedup = true;
+    assert(tfs_init(&params) != -1);
+    write_file("/tiny", 0, "tiny", 4);
+    assert(tfs_clone_file("/tiny", "/tiny2") != -1);
+    write_file("/tiny2", TFS_O_TRUNC, "other", 5);
+    check_file("/tiny", "tiny", 4);
+    check_file("/tiny2", "other", 5);
+
+    write_file("/z", TFS_O_COMPRESS, contents, sizeof(contents));
+    tfs_compress_stats_t compress;
+    assert(tfs_compress_stats(&compress) != -1);
+    assert(compress.blocks == BLOCKS);
+    assert(tfs_clone_file("/z", "/z2") != -1);
+    check_file("/z2", contents, sizeof(contents));
+    fd = tfs_open("/z2", 0);
+    assert(fd != -1);
+    assert(tfs_write(fd, changed, sizeof(changed)) == sizeof(changed));
+    assert(tfs_close(fd) != -1);
+    check_file("/z", contents, sizeof(contents));
+    check_file("/z2", changed, sizeof(changed));
+    assert(tfs_unlink("/z") != -1);
+    assert(tfs_unlink("/z2") != -1);
+    assert(tfs_compress_stats(&compress) != -1);
+    assert(compress.blocks == 0);
+
+    // with deduplication, the shared blocks count as saved
+    memset(contents, 'd', BLOCK);
+    write_file("/dd", 0, contents, BLOCK);
+    assert(tfs_clone_file("/dd", "/dd2") != -1);
+    tfs_dedup_stats_t dedup;
+    assert(tfs_dedup_stats(&dedup) != -1);
+    assert(dedup.saved_blocks == 1);
+    assert(tfs_unlink("/dd") != -1);
+    assert(tfs_dedup_stats(&dedup) != -1);
+    assert(dedup.saved_blocks == 0);
+    check_file("/dd2", contents, BLOCK);
+    assert(tfs_destroy() != -1);
+
+    // the chunks of the source in the spill file are brought back, and stay
+    // in memory while shared (the other files still fit, through the spill
+    // file)
+    char spill_path[64];
+    snprintf(spill_path, sizeof(spill_path), "/tmp/tfs_clone_file.%d",
+             (int)getpid());
+    params = tfs_default_params();
+    params.max_block_count = 2 * BLOCKS + 2;
+    params.max_file_blocks = BLOCKS;
+    params.spill_path = spill_path;
+    params.spill_block_count = (OTHERS + 1) * BLOCKS;
+    assert(tfs_init(&params) != -1);
+    make_blocks(contents, 'a');
+    write_file("/src", 0, contents, sizeof(contents));
+    for (size_t i = 0; i < OTHERS; i++) {
+        snprintf(path, sizeof(path), "/o%zu", i);
+        make_blocks(others[i], (char)('A' + i * BLOCKS));
+        write_file(path, 0, others[i], sizeof(others[i]));
+    }
+    assert(tfs_stat("/src", &stat) != -1);
+    assert(stat.spilled > 0 && stat.blocks > 0 &&
+           stat.blocks + stat.spilled == BLOCKS);
+
+    assert(tfs_clone_file("/src", "/a") != -1);
+    assert(tfs_stat("/src", &stat) != -1);
+    assert(stat.spilled == 0 && stat.blocks == BLOCKS);
+    check_file("/a", contents, sizeof(contents));
+    check_file("/src", contents, sizeof(contents));
+    for (size_t i = 0; i < OTHERS; i++) {
+        snprintf(path, sizeof(path), "/o%zu", i);
+        check_file(path, others[i], sizeof(others[i]));
+    }
+
+    // and each copy still changes on its own
+    memcpy(changed, contents, sizeof(changed));
+    memset(changed, 'x', 10);
+    write_file("/a", 0, changed, 10);
+    check_file("/a", changed, sizeof(changed));
+    check_file("/src", contents, sizeof(contents));
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK 1024
+#define FILE_BLOCKS 16
+
+char const file_path[] = "/box";
+char const plain_path[] = "/plain";
+
+static size_t blocks_in_use(void) {
+    tfs_numa_node_stats_t stats[1];
+    assert(tfs_numa_stats(stats, 1) == 1);
+    return stats[0].in_use;
+}
+
+int main() {
+    static char contents[FILE_BLOCKS * BLOCK];
+    static char buffer[FILE_BLOCKS * BLOCK];
+
+    // message log like contents, which compress well
+    size_t len = 0;
+    for (int seq = 0; len < sizeof(contents); seq++) {
+        char line[128];
+        int n = snprintf(line, sizeof(line),
+                         "{\"box\":\"/news\",\"seq\":%05d,\"publisher\":"
+                         "\"pub-1\",\"message\":\"hello subscriber\"}\n",
+                         seq);
+        size_t chunk = (size_t)n;
+        if (chunk > sizeof(contents) - len) {
+            chunk = sizeof(contents) - len;
+        }
+        memcpy(contents + len, line, chunk);
+        len += chunk;
+    }
+
+    // root directory plus seven data blocks, files of up to sixteen blocks
+    tfs_params params = tfs_default_params();
+    params.max_block_count = 8;
+    params.max_file_blocks = FILE_BLOCKS;
+    assert(tfs_init(&params) != -1);
+
+    // sixteen blocks of data fit in seven once compressed
+    int fd = tfs_open(file_path, TFS_O_CREAT | TFS_O_COMPRESS);
+    assert(fd != -1);
+    assert(tfs_write(fd, contents, sizeof(contents)) == sizeof(contents));
+    assert(tfs_close(fd) != -1);
+
+    tfs_compress_stats_t stats;
+    assert(tfs_compress_stats(&stats) != -1);
+    assert(stats.blocks == FILE_BLOCKS);
+    assert(stats.raw_bytes == sizeof(contents));
+    assert(stats.compressed_bytes * 2 < stats.raw_bytes);
+    assert(blocks_in_use() < 1 + FILE_BLOCKS / 2);
+
+    // read back in quarter blocks: each block is decompressed once
+    fd = tfs_open(file_path, 0);
+    assert(fd != -1);
+    for (size_t done = 0; done < sizeof(buffer); done += BLOCK / 4) {
+        assert(tfs_read(fd, buffer + done, BLOCK / 4) == BLOCK / 4);
+    }
+    assert(tfs_read(fd, buffer, 1) == 0);
+    assert(memcmp(buffer, contents, sizeof(contents)) == 0);
+
+    assert(tfs_compress_stats(&stats) != -1);
+    assert(stats.cache_misses == FILE_BLOCKS);
+    assert(stats.cache_hits == 3 * FILE_BLOCKS);
+    assert(tfs_close(fd) != -1);
+
+    // overwriting part of a compressed block
+    fd = tfs_open(file_path, 0);
+    assert(fd != -1);
+    assert(tfs_lseek(fd, 3 * BLOCK + 100, TFS_SEEK_SET) == 3 * BLOCK + 100);
+    assert(tfs_write(fd, "overwritten", 11) == 11);
+    memcpy(contents + 3 * BLOCK + 100, "overwritten", 11);
+
+    assert(tfs_compress_stats(&stats) != -1);
+    assert(stats.blocks == FILE_BLOCKS - 1);
+
+    assert(tfs_lseek(fd, 0, TFS_SEEK_SET) == 0);
+    assert(tfs_read(fd, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(memcmp(buffer, contents, sizeof(contents)) == 0);
+    assert(tfs_close(fd) != -1);
+
+    // every block is released on delete
+    assert(tfs_unlink(file_path) != -1);
+    assert(tfs_compress_stats(&stats) != -1);
+    assert(stats.blocks == 0);
+    assert(stats.compressed_bytes == 0);
+    assert(blocks_in_use() == 1);
+
+    // without compression, the same data does not fit
+    fd = tfs_open(plain_path, TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fd, contents, sizeof(contents)) == 7 * BLOCK);
+    assert(tfs_close(fd) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK 1024
+#define BOXES 8
+
+static size_t blocks_in_use(void) {
+    tfs_numa_node_stats_t stats[1];
+    assert(tfs_numa_stats(stats, 1) == 1);
+    return stats[0].in_use;
+}
+
+int main() {
+    static char payload[2 * BLOCK];
+    static char buffer[2 * BLOCK];
+    char path[16];
+
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = (char)('a' + (i * 7 + i / BLOCK) % 26);
+    }
+
+    // root directory plus four data blocks, files of up to four blocks
+    tfs_params params = tfs_default_params();
+    params.max_block_count = 5;
+    params.max_file_blocks = 4;
+    params.dedup = true;
+    assert(tfs_init(&params) != -1);
+
+    // the same two blocks fanned out to every box are stored once
+    for (int box = 0; box < BOXES; box++) {
+        snprintf(path, sizeof(path), "/box%d", box);
+        int fd = tfs_open(path, TFS_O_CREAT);
+        assert(fd != -1);
+        assert(tfs_write(fd, payload, sizeof(payload)) == sizeof(payload));
+        assert(tfs_close(fd) != -1);
+    }
+    assert(blocks_in_use() == 1 + 2);
+
+    tfs_dedup_stats_t stats;
+    assert(tfs_dedup_stats(&stats) != -1);
+    assert(stats.indexed_blocks == 2);
+    assert(stats.saved_blocks == 2 * (BOXES - 1));
+    assert(stats.hits == 2 * (BOXES - 1));
+
+    // modifying a shared block copies it, the other boxes are unchanged
+    int fd = tfs_open("/box0", 0);
+    assert(fd != -1);
+    assert(tfs_write(fd, "changed", 7) == 7);
+    assert(tfs_close(fd) != -1);
+    assert(blocks_in_use() == 1 + 3);
+
+    assert(tfs_dedup_stats(&stats) != -1);
+    assert(stats.cow_copies == 1);
+    assert(stats.saved_blocks == 2 * (BOXES - 1) - 1);
+
+    fd = tfs_open("/box0", 0);
+    assert(fd != -1);
+    assert(tfs_read(fd, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(memcmp(buffer, "changed", 7) == 0);
+    assert(memcmp(buffer + 7, payload + 7, sizeof(payload) - 7) == 0);
+    assert(tfs_close(fd) != -1);
+
+    for (int box = 1; box < BOXES; box++) {
+        snprintf(path, sizeof(path), "/box%d", box);
+        fd = tfs_open(path, 0);
+        assert(fd != -1);
+        assert(tfs_read(fd, buffer, sizeof(buffer)) == sizeof(buffer));
+        assert(memcmp(buffer, payload, sizeof(payload)) == 0);
+        assert(tfs_close(fd) != -1);
+    }
+
+    // shared blocks are freed with their last reference
+    for (int box = 0; box < BOXES; box++) {
+        snprintf(path, sizeof(path), "/box%d", box);
+        assert(tfs_unlink(path) != -1);
+    }
+    assert(blocks_in_use() == 1);
+
+    assert(tfs_dedup_stats(&stats) != -1);
+    assert(stats.indexed_blocks == 0);
+    assert(stats.saved_blocks == 0);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
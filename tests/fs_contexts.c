@@ -0,0 +1,109 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SHARDS 4
+#define FILES 8
+#define RECORD 32
+
+static tfs_ctx_t *shards[SHARDS];
+
+static void *shard_worker(void *arg) {
+    size_t shard = (size_t)arg;
+    tfs_ctx_t *ctx = shards[shard];
+    char record[RECORD];
+    char path[16];
+
+    // the same names in every shard, with different contents
+    for (int f = 0; f < FILES; f++) {
+        snprintf(path, sizeof(path), "/f%d", f);
+        memset(record, 'a' + (int)shard, sizeof(record));
+
+        int fd = tfs_ctx_open(ctx, path, TFS_O_CREAT);
+        assert(fd != -1);
+        assert(tfs_ctx_write(ctx, fd, record, sizeof(record)) == RECORD);
+        assert(tfs_ctx_close(ctx, fd) != -1);
+    }
+
+    return NULL;
+}
+
+int main() {
+    char buffer[RECORD];
+    char expected[RECORD];
+    char path[16];
+
+    tfs_params params = tfs_default_params();
+    params.async_workers = 1;
+    assert(tfs_init(NULL) != -1);
+    for (size_t s = 0; s < SHARDS; s++) {
+        shards[s] = tfs_ctx_init(&params);
+        assert(shards[s] != NULL);
+    }
+
+    pthread_t tids[SHARDS];
+    for (size_t s = 0; s < SHARDS; s++) {
+        assert(pthread_create(&tids[s], NULL, shard_worker, (void *)s) == 0);
+    }
+    for (size_t s = 0; s < SHARDS; s++) {
+        assert(pthread_join(tids[s], NULL) == 0);
+    }
+
+    // every shard kept its own files
+    for (size_t s = 0; s < SHARDS; s++) {
+        memset(expected, 'a' + (int)s, sizeof(expected));
+        for (int f = 0; f < FILES; f++) {
+            snprintf(path, sizeof(path), "/f%d", f);
+            int fd = tfs_ctx_open(shards[s], path, 0);
+            assert(fd != -1);
+            assert(tfs_ctx_read(shards[s], fd, buffer, sizeof(buffer)) ==
+                   RECORD);
+            assert(memcmp(buffer, expected, RECORD) == 0);
+            assert(tfs_ctx_close(shards[s], fd) != -1);
+        }
+    }
+
+    // the default instance saw none of them
+    assert(tfs_open("/f0", 0) == -1);
+    tfs_stat_t stat;
+    assert(tfs_ctx_stat(NULL, "/f0", &stat) == -1);
+    assert(tfs_ctx_stat(shards[0], "/f0", &stat) != -1);
+    assert(stat.size == RECORD);
+
+    // unlinking in one shard leaves the others alone
+    assert(tfs_ctx_unlink(shards[1], "/f0") != -1);
+    assert(tfs_ctx_stat(shards[1], "/f0", &stat) == -1);
+    assert(tfs_ctx_stat(shards[2], "/f0", &stat) != -1);
+
+    // rings run their operations on the instance they were created for
+    tfs_ring_t *ring = tfs_ctx_ring_create(shards[3], 1);
+    assert(ring != NULL);
+    assert(tfs_ring_create(1) == NULL); // the default one has no workers
+    tfs_op_t op = {.op = TFS_OP_UNLINK, .name = "/f1"};
+    tfs_completion_t completion;
+    assert(tfs_submit(ring, &op, 1) == 1);
+    assert(tfs_reap(ring, &completion, 1, 1) == 1);
+    assert(completion.result == 0);
+    tfs_ring_destroy(ring);
+    assert(tfs_ctx_stat(shards[3], "/f1", &stat) == -1);
+    assert(tfs_ctx_stat(shards[0], "/f1", &stat) != -1);
+
+    // destroying a shard does not affect the rest
+    assert(tfs_ctx_destroy(shards[0]) != -1);
+    assert(tfs_ctx_stat(shards[2], "/f1", &stat) != -1);
+    int fd = tfs_open("/default", TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_close(fd) != -1);
+
+    assert(tfs_ctx_destroy(NULL) == -1);
+    for (size_t s = 1; s < SHARDS; s++) {
+        assert(tfs_ctx_destroy(shards[s]) != -1);
+    }
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
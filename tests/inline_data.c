@@ -0,0 +1,87 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+uint8_t const small_contents[] = "AAA!";
+uint8_t const large_contents[] =
+    "BBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBB";
+char const file_path1[] = "/f1";
+char const file_path2[] = "/f2";
+char const link_path[] = "/l1";
+
+void assert_contents_ok(char const *path, uint8_t const *contents,
+                        size_t len) {
+    uint8_t buffer[256];
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == len);
+    assert(memcmp(buffer, contents, len) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+void write_contents(char const *path, uint8_t const *contents, size_t len,
+                    ssize_t expected) {
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_APPEND);
+    assert(f != -1);
+    assert(tfs_write(f, contents, len) == expected);
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    // only the root directory and one file can have a data block
+    tfs_params params = tfs_default_params();
+    params.max_block_count = 2;
+    params.inline_threshold = 64;
+    assert(tfs_init(&params) != -1);
+
+    // tiny files and symlinks are kept inside their inodes
+    write_contents(file_path1, small_contents, sizeof(small_contents),
+                   sizeof(small_contents));
+    write_contents(file_path2, small_contents, sizeof(small_contents),
+                   sizeof(small_contents));
+    assert(tfs_sym_link(file_path1, link_path) != -1);
+
+    assert_contents_ok(file_path1, small_contents, sizeof(small_contents));
+    assert_contents_ok(file_path2, small_contents, sizeof(small_contents));
+    assert_contents_ok(link_path, small_contents, sizeof(small_contents));
+
+    // growing past the threshold moves f1 to the only free block
+    write_contents(file_path1, large_contents, sizeof(large_contents),
+                   sizeof(large_contents));
+
+    uint8_t expected[sizeof(small_contents) + sizeof(large_contents)];
+    memcpy(expected, small_contents, sizeof(small_contents));
+    memcpy(expected + sizeof(small_contents), large_contents,
+           sizeof(large_contents));
+    assert_contents_ok(file_path1, expected, sizeof(expected));
+    assert_contents_ok(link_path, expected, sizeof(expected));
+
+    // f2 cannot grow (no blocks left), but keeps its inline contents
+    write_contents(file_path2, large_contents, sizeof(large_contents), -1);
+    assert_contents_ok(file_path2, small_contents, sizeof(small_contents));
+
+    // freeing f1's block lets f2 grow
+    assert(tfs_unlink(link_path) != -1);
+    assert(tfs_unlink(file_path1) != -1);
+    write_contents(file_path2, large_contents, sizeof(large_contents),
+                   sizeof(large_contents));
+    assert_contents_ok(file_path2, expected, sizeof(expected));
+
+    // truncating a promoted file makes it eligible for inlining again
+    int f = tfs_open(file_path2, TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+    write_contents(file_path1, small_contents, sizeof(small_contents),
+                   sizeof(small_contents));
+    write_contents(file_path1, large_contents, sizeof(large_contents),
+                   sizeof(large_contents));
+    assert_contents_ok(file_path1, expected, sizeof(expected));
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
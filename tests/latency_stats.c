@@ -0,0 +1,63 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FILES 10
+
+int main() {
+    char path[16];
+    char line[256];
+
+    assert(tfs_init(NULL) != -1);
+
+    for (int i = 0; i < FILES; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        int fd = tfs_open(path, TFS_O_CREAT);
+        assert(fd != -1);
+        assert(tfs_write(fd, "stats", 5) == 5);
+        assert(tfs_close(fd) != -1);
+    }
+
+    FILE *out = tmpfile();
+    assert(out != NULL);
+
+#ifdef TFS_STATS
+    assert(tfs_stats_dump(out) == 0);
+
+    // one line per event recorded, after the header
+    unsigned long long opens = 0, writes = 0, delays = 0;
+    rewind(out);
+    while (fgets(line, sizeof(line), out) != NULL) {
+        char event[32];
+        unsigned long long count;
+        double mean, p50, p90, p99, p999, max;
+        if (sscanf(line, "%31s %llu %lf %lf %lf %lf %lf %lf", event, &count,
+                   &mean, &p50, &p90, &p99, &p999, &max) != 8) {
+            continue;
+        }
+
+        assert(p50 <= p90 && p90 <= p99 && p99 <= p999);
+        if (strcmp(event, "open") == 0) {
+            opens = count;
+        } else if (strcmp(event, "write") == 0) {
+            writes = count;
+        } else if (strcmp(event, "delay") == 0) {
+            delays = count;
+        }
+    }
+    assert(opens == FILES && writes == FILES && delays > 0);
+#else
+    // compiled out: nothing is recorded
+    assert(tfs_stats_dump(out) == -1);
+    rewind(out);
+    assert(fgets(line, sizeof(line), out) == NULL);
+#endif
+
+    fclose(out);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include "fs/operations.h"
+#include "utils/utils.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define THREADS 4
+#define WRITES 32
+
+char const file_path[] = "/f1";
+
+void *writer(void *arg) {
+    int fd = *(int *)arg;
+    for (int i = 0; i < WRITES; i++) {
+        assert(tfs_write(fd, "lock", 4) == 4);
+    }
+
+    return NULL;
+}
+
+int main() {
+    pthread_t threads[THREADS];
+    char line[256];
+
+    assert(tfs_init(NULL) != -1);
+
+    // threads writing through the same file handle contend on its lock
+    int fd = tfs_open(file_path, TFS_O_CREAT);
+    assert(fd != -1);
+    for (int i = 0; i < THREADS; i++) {
+        assert(pthread_create(&threads[i], NULL, writer, &fd) == 0);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+    assert(tfs_close(fd) != -1);
+
+    FILE *out = tmpfile();
+    assert(out != NULL);
+    lock_profile_dump(fileno(out));
+    rewind(out);
+
+#ifdef LOCK_PROFILE
+    // a header, then the sites, most contended first
+    assert(fgets(line, sizeof(line), out) != NULL);
+    assert(strncmp(line, "lock site", strlen("lock site")) == 0);
+
+    size_t sites = 0;
+    unsigned long long total = 0;
+    unsigned long long last_wait = ~0ULL;
+    while (fgets(line, sizeof(line), out) != NULL) {
+        char site[192], kind[16];
+        unsigned long long acquired, contended, wait, max_wait, hold;
+        assert(sscanf(line, "%191s %15s %llu %llu %llu %llu %llu", site, kind,
+                      &acquired, &contended, &wait, &max_wait, &hold) == 7);
+        assert(strchr(site, ':') != NULL);
+        assert(contended <= acquired && max_wait <= wait);
+        assert(wait <= last_wait);
+        last_wait = wait;
+        total += acquired;
+        sites++;
+    }
+    assert(sites > 0 && total >= THREADS * WRITES);
+#else
+    // compiled out: nothing is recorded
+    assert(fgets(line, sizeof(line), out) == NULL);
+#endif
+
+    fclose(out);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FILE_COUNT 8
+#define MAX_NODES 64
+
+uint8_t const file_contents[] = "AAA!";
+
+/*
+ * Sum the allocation statistics of all nodes
+ */
+void numa_totals(size_t *allocs, size_t *in_use) {
+    tfs_numa_node_stats_t stats[MAX_NODES];
+    size_t nodes = tfs_numa_stats(stats, MAX_NODES);
+    assert(nodes >= 1);
+
+    *allocs = 0;
+    *in_use = 0;
+    for (size_t i = 0; i < nodes && i < MAX_NODES; ++i) {
+        assert(stats[i].remote <= stats[i].allocs);
+        *allocs += stats[i].allocs;
+        *in_use += stats[i].in_use;
+    }
+}
+
+void run_workload(tfs_numa_mode_t mode) {
+    char path[16];
+    uint8_t buffer[sizeof(file_contents)];
+    size_t allocs, in_use;
+
+    tfs_params params = tfs_default_params();
+    params.numa_mode = mode;
+    assert(tfs_init(&params) != -1);
+
+    // root directory block
+    numa_totals(&allocs, &in_use);
+    assert(allocs == 1 && in_use == 1);
+
+    for (int i = 0; i < FILE_COUNT; ++i) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        int fd = tfs_open(path, TFS_O_CREAT);
+        assert(fd != -1);
+        assert(tfs_write(fd, file_contents, sizeof(file_contents)) ==
+               sizeof(file_contents));
+        assert(tfs_close(fd) != -1);
+    }
+
+    numa_totals(&allocs, &in_use);
+    assert(allocs == FILE_COUNT + 1 && in_use == FILE_COUNT + 1);
+
+    for (int i = 0; i < FILE_COUNT; ++i) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        int fd = tfs_open(path, 0);
+        assert(fd != -1);
+        assert(tfs_read(fd, buffer, sizeof(buffer)) == sizeof(buffer));
+        assert(memcmp(buffer, file_contents, sizeof(buffer)) == 0);
+        assert(tfs_close(fd) != -1);
+    }
+
+    // freed blocks are no longer in use, but still count as allocations
+    assert(tfs_unlink("/f0") != -1);
+    numa_totals(&allocs, &in_use);
+    assert(allocs == FILE_COUNT + 1 && in_use == FILE_COUNT);
+
+    assert(tfs_destroy() != -1);
+}
+
+int main() {
+    run_workload(TFS_NUMA_NONE);
+    run_workload(TFS_NUMA_INTERLEAVE);
+    run_workload(TFS_NUMA_LOCAL);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
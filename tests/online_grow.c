@@ -0,0 +1,86 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK 1024
+
+int main() {
+    static char contents[BLOCK];
+    static char buffer[BLOCK];
+    char path[16];
+
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = 4;
+    params.max_block_count = 4;
+    params.max_inode_reserve = 16;
+    params.max_block_reserve = 16;
+    params.checksums = true;
+    params.dedup = true;
+    assert(tfs_init(&params) != -1);
+
+    // fill the inode table (the root directory takes an inode and a block)
+    int fds[16];
+    int files = 0;
+    for (int i = 0; i < 16; i++) {
+        memset(contents, 'a' + i, BLOCK);
+        snprintf(path, sizeof(path), "/f%d", i);
+        fds[i] = tfs_open(path, TFS_O_CREAT);
+        if (fds[i] == -1) {
+            break;
+        }
+        assert(tfs_write(fds[i], contents, BLOCK) == BLOCK);
+        files++;
+    }
+    assert(files == 3);
+
+    // no downtime: the files stay open while the FS grows
+    params.max_inode_count = 12;
+    params.max_block_count = 16;
+    assert(tfs_grow(&params) != -1);
+
+    for (int i = files; i < 16; i++) {
+        memset(contents, 'a' + i, BLOCK);
+        snprintf(path, sizeof(path), "/f%d", i);
+        fds[i] = tfs_open(path, TFS_O_CREAT);
+        if (fds[i] == -1) {
+            break;
+        }
+        assert(tfs_write(fds[i], contents, BLOCK) == BLOCK);
+        files++;
+    }
+    assert(files == 11);
+
+    for (int i = 0; i < files; i++) {
+        assert(tfs_close(fds[i]) != -1);
+
+        snprintf(path, sizeof(path), "/f%d", i);
+        int fd = tfs_open(path, 0);
+        assert(fd != -1);
+        assert(tfs_read(fd, buffer, BLOCK) == BLOCK);
+        memset(contents, 'a' + i, BLOCK);
+        assert(memcmp(buffer, contents, BLOCK) == 0);
+        assert(tfs_close(fd) != -1);
+    }
+
+    // shrinking and growing past the reserve are refused
+    params.max_inode_count = 8;
+    assert(tfs_grow(&params) == -1);
+    params.max_inode_count = 17;
+    assert(tfs_grow(&params) == -1);
+    params.max_inode_count = 16;
+    assert(tfs_grow(&params) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    // without a reserve the FS cannot grow
+    assert(tfs_init(NULL) != -1);
+    params = tfs_default_params();
+    params.max_block_count++;
+    assert(tfs_grow(&params) == -1);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,151 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define THREADS 8
+#define BLOCK 1024
+#define ROUNDS 200
+// spans the end of a block and the start of the next one
+#define SHARED_OFFSET (BLOCK / 2)
+#define SHARED_LEN (BLOCK)
+
+static char const *path = "/f1";
+
+static void *disjoint_writer(void *arg) {
+    size_t id = (size_t)arg;
+    char block[BLOCK];
+
+    int fd = tfs_open(path, 0);
+    assert(fd != -1);
+
+    // each thread only writes its own block, growing the file
+    for (int round = 0; round < ROUNDS; round++) {
+        memset(block, 'a' + (int)((id + (size_t)round) % 26), sizeof(block));
+        assert(tfs_lseek(fd, (off_t)(id * BLOCK), TFS_SEEK_SET) ==
+               (off_t)(id * BLOCK));
+        assert(tfs_write(fd, block, sizeof(block)) == BLOCK);
+    }
+    memset(block, 'a' + (int)id, sizeof(block));
+    assert(tfs_lseek(fd, (off_t)(id * BLOCK), TFS_SEEK_SET) != -1);
+    assert(tfs_write(fd, block, sizeof(block)) == BLOCK);
+
+    assert(tfs_close(fd) != -1);
+    return NULL;
+}
+
+static void *overlapping_writer(void *arg) {
+    size_t id = (size_t)arg;
+    char buffer[SHARED_LEN];
+    memset(buffer, 'A' + (int)id, sizeof(buffer));
+
+    int fd = tfs_open(path, 0);
+    assert(fd != -1);
+    for (int round = 0; round < ROUNDS; round++) {
+        assert(tfs_lseek(fd, SHARED_OFFSET, TFS_SEEK_SET) == SHARED_OFFSET);
+        assert(tfs_write(fd, buffer, sizeof(buffer)) == SHARED_LEN);
+    }
+    assert(tfs_close(fd) != -1);
+
+    return NULL;
+}
+
+static void *overlapping_reader(void *arg) {
+    (void)arg;
+    char buffer[SHARED_LEN];
+
+    int fd = tfs_open(path, 0);
+    assert(fd != -1);
+    for (int round = 0; round < ROUNDS; round++) {
+        assert(tfs_lseek(fd, SHARED_OFFSET, TFS_SEEK_SET) == SHARED_OFFSET);
+        assert(tfs_read(fd, buffer, sizeof(buffer)) == SHARED_LEN);
+
+        // writes are never seen halfway
+        for (size_t i = 1; i < SHARED_LEN; i++) {
+            assert(buffer[i] == buffer[0]);
+        }
+    }
+    assert(tfs_close(fd) != -1);
+
+    return NULL;
+}
+
+int main() {
+    char buffer[BLOCK];
+    pthread_t tids[THREADS];
+
+    tfs_params params = tfs_default_params();
+    params.max_file_blocks = THREADS;
+    assert(tfs_init(&params) != -1);
+
+    int fd = tfs_open(path, TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_close(fd) != -1);
+
+    // writes to different blocks of the same file
+    for (size_t t = 0; t < THREADS; t++) {
+        assert(pthread_create(&tids[t], NULL, disjoint_writer, (void *)t) ==
+               0);
+    }
+    for (size_t t = 0; t < THREADS; t++) {
+        assert(pthread_join(tids[t], NULL) == 0);
+    }
+
+    tfs_stat_t stat;
+    assert(tfs_stat(path, &stat) != -1);
+    assert(stat.size == THREADS * BLOCK);
+    assert(stat.blocks == THREADS);
+
+    fd = tfs_open(path, 0);
+    assert(fd != -1);
+    for (size_t t = 0; t < THREADS; t++) {
+        assert(tfs_read(fd, buffer, sizeof(buffer)) == BLOCK);
+        for (size_t i = 0; i < BLOCK; i++) {
+            assert(buffer[i] == 'a' + (int)t);
+        }
+    }
+    assert(tfs_read(fd, buffer, sizeof(buffer)) == 0);
+    assert(tfs_close(fd) != -1);
+
+    // writes and reads of the same unaligned range
+    fd = tfs_open(path, 0);
+    assert(fd != -1);
+    memset(buffer, 'A', sizeof(buffer));
+    assert(tfs_lseek(fd, SHARED_OFFSET, TFS_SEEK_SET) == SHARED_OFFSET);
+    assert(tfs_write(fd, buffer, SHARED_LEN) == SHARED_LEN);
+    assert(tfs_close(fd) != -1);
+
+    for (size_t t = 0; t < THREADS; t++) {
+        void *(*routine)(void *) =
+            t % 2 == 0 ? overlapping_writer : overlapping_reader;
+        assert(pthread_create(&tids[t], NULL, routine, (void *)t) == 0);
+    }
+    for (size_t t = 0; t < THREADS; t++) {
+        assert(pthread_join(tids[t], NULL) == 0);
+    }
+
+    // the blocks around the shared range were left alone
+    fd = tfs_open(path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fd, buffer, SHARED_OFFSET) == SHARED_OFFSET);
+    for (size_t i = 0; i < SHARED_OFFSET; i++) {
+        assert(buffer[i] == 'a');
+    }
+    assert(tfs_lseek(fd, SHARED_OFFSET + SHARED_LEN, TFS_SEEK_SET) != -1);
+    assert(tfs_read(fd, buffer, BLOCK - SHARED_OFFSET) ==
+           BLOCK - SHARED_OFFSET);
+    for (size_t i = 0; i < BLOCK - SHARED_OFFSET; i++) {
+        assert(buffer[i] == 'b');
+    }
+    assert(tfs_close(fd) != -1);
+
+    assert(tfs_stat(path, &stat) != -1);
+    assert(stat.size == THREADS * BLOCK);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define BLOCKS 8
+#define BLOCK 1024
+#define RECORD 256
+
+static char const *path = "/f1";
+
+// wait (a bounded time) for the read-ahead thread to load some blocks
+static void wait_prefetched(size_t count) {
+    struct timespec tick = {.tv_sec = 0, .tv_nsec = 100000};
+    tfs_readahead_stats_t stats;
+    assert(tfs_readahead_stats(&stats) != -1);
+    for (int i = 0; i < 50000 && stats.prefetched < count; i++) {
+        nanosleep(&tick, NULL);
+        assert(tfs_readahead_stats(&stats) != -1);
+    }
+    assert(stats.prefetched >= count);
+}
+
+int main() {
+    char contents[BLOCKS * BLOCK];
+    char buffer[BLOCK];
+    for (size_t i = 0; i < sizeof(contents); i++) {
+        contents[i] = (char)('a' + i / BLOCK);
+    }
+
+    // without read-ahead, nothing is loaded ahead
+    assert(tfs_init(NULL) != -1);
+    tfs_readahead_stats_t stats;
+    assert(tfs_readahead_stats(NULL) == -1);
+    assert(tfs_readahead_stats(&stats) != -1);
+    assert(stats.prefetched == 0 && stats.hits == 0 && stats.dropped == 0);
+    assert(tfs_destroy() != -1);
+
+    tfs_params params = tfs_default_params();
+    params.max_file_blocks = BLOCKS;
+    params.readahead_blocks = 4;
+    assert(tfs_init(&params) != -1);
+
+    int fd = tfs_open(path, TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fd, contents, sizeof(contents)) == sizeof(contents));
+    assert(tfs_close(fd) != -1);
+
+    // the window opens with one block, then doubles
+    fd = tfs_open(path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fd, buffer, BLOCK) == BLOCK);
+    assert(memcmp(buffer, contents, BLOCK) == 0);
+    wait_prefetched(1);
+    assert(tfs_read(fd, buffer, BLOCK) == BLOCK);
+    assert(memcmp(buffer, contents + BLOCK, BLOCK) == 0);
+    wait_prefetched(3);
+    assert(tfs_readahead_stats(&stats) != -1);
+    assert(stats.hits == 1);
+
+    // small reads keep the block they end in loaded: the first one loads
+    // blocks 2 (again), 4 and 5, the others one block each
+    for (size_t offset = 2 * BLOCK; offset < 4 * BLOCK; offset += RECORD) {
+        assert(tfs_read(fd, buffer, RECORD) == RECORD);
+        assert(memcmp(buffer, contents + offset, RECORD) == 0);
+        wait_prefetched(6 + (offset - 2 * BLOCK) / RECORD);
+    }
+    assert(tfs_readahead_stats(&stats) != -1);
+    assert(stats.hits == 1 + 2 * BLOCK / RECORD);
+
+    // the window stops at the end of the file
+    assert(tfs_read(fd, buffer, BLOCK) == BLOCK);
+    assert(tfs_read(fd, buffer, BLOCK) == BLOCK);
+    assert(tfs_read(fd, buffer, BLOCK) == BLOCK);
+    assert(tfs_read(fd, buffer, BLOCK) == BLOCK);
+    assert(memcmp(buffer, contents + 7 * BLOCK, BLOCK) == 0);
+    assert(tfs_read(fd, buffer, BLOCK) == 0);
+
+    // random reads close the window
+    assert(tfs_readahead_stats(&stats) != -1);
+    size_t prefetched = stats.prefetched;
+    for (size_t i = 0; i < BLOCKS; i++) {
+        size_t block = (i * 5) % BLOCKS;
+        assert(tfs_lseek(fd, (off_t)(block * BLOCK), TFS_SEEK_SET) != -1);
+        assert(tfs_read(fd, buffer, RECORD) == RECORD);
+        assert(memcmp(buffer, contents + block * BLOCK, RECORD) == 0);
+    }
+    struct timespec pause = {.tv_sec = 0, .tv_nsec = 10000000};
+    nanosleep(&pause, NULL);
+    assert(tfs_readahead_stats(&stats) != -1);
+    assert(stats.prefetched == prefetched);
+    assert(tfs_close(fd) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -3,17 +3,69 @@
 #include <stdio.h>
 #include <string.h>
 
+#define BLOCK 1024
+#define BLOCKS 4
+
 int main() {
     char *path = "/f1";
+    char contents[BLOCKS * BLOCK];
+    char buffer[BLOCKS * BLOCK];
+    memset(contents, 'o', sizeof(contents));
 
-    assert(tfs_init(NULL) != -1);
+    // just enough room for the root directory and one full file
+    tfs_params params = tfs_default_params();
+    params.max_block_count = BLOCKS + 1;
+    params.max_file_blocks = BLOCKS;
+    assert(tfs_init(&params) != -1);
 
     // Create file
     int fd = tfs_open(path, TFS_O_CREAT);
     assert(fd != -1);
+    assert(tfs_write(fd, contents, sizeof(contents)) == sizeof(contents));
+    int other = tfs_open(path, 0);
+    assert(other != -1);
 
-    // Unlink file
+    // Unlink file: the name goes away right away
+    assert(tfs_unlink(path) != -1);
+    assert(tfs_open(path, 0) == -1);
+    tfs_stat_t stat;
+    assert(tfs_stat(path, &stat) == -1);
     assert(tfs_unlink(path) == -1);
 
+    // but the file lives on (and keeps its blocks) while it is open
+    assert(tfs_read(other, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(memcmp(buffer, contents, sizeof(contents)) == 0);
+    assert(tfs_lseek(fd, 0, TFS_SEEK_SET) == 0);
+    assert(tfs_write(fd, "new", 3) == 3);
+    assert(tfs_lseek(other, 0, TFS_SEEK_SET) == 0);
+    assert(tfs_read(other, buffer, 3) == 3);
+    assert(memcmp(buffer, "new", 3) == 0);
+
+    int fresh = tfs_open(path, TFS_O_CREAT);
+    assert(fresh != -1);
+    assert(tfs_write(fresh, contents, BLOCK) == -1);
+    assert(tfs_close(fresh) != -1);
+
+    // until its last handle is closed
+    assert(tfs_close(fd) != -1);
+    assert(tfs_read(other, buffer, 3) == 3);
+    assert(tfs_close(other) != -1);
+
+    fresh = tfs_open(path, 0);
+    assert(fresh != -1);
+    assert(tfs_write(fresh, contents, sizeof(contents)) == sizeof(contents));
+    assert(tfs_close(fresh) != -1);
+
+    // files with other links are not affected by being open
+    assert(tfs_link(path, "/f2") != -1);
+    fd = tfs_open(path, 0);
+    assert(fd != -1);
+    assert(tfs_unlink(path) != -1);
+    assert(tfs_close(fd) != -1);
+    assert(tfs_stat("/f2", &stat) != -1);
+    assert(stat.size == sizeof(contents) && stat.links == 1);
+
+    assert(tfs_destroy() != -1);
+
     printf("Successful test.\n");
 }
@@ -0,0 +1,282 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FILES 4
+#define LEN 3000
+#define KILLS 8
+
+static char shm_name[64];
+
+static void make_contents(char *contents, size_t file) {
+    for (size_t i = 0; i < LEN; i++) {
+        contents[i] = (char)('a' + (file + i) % 26);
+    }
+}
+
+static void check_contents(tfs_ctx_t *ctx, char const *path,
+                           char const *contents) {
+    char buffer[LEN + 1];
+    int fd = tfs_ctx_open(ctx, path, 0);
+    assert(fd != -1);
+    assert(tfs_ctx_read(ctx, fd, buffer, sizeof(buffer)) == LEN);
+    assert(memcmp(buffer, contents, LEN) == 0);
+    assert(tfs_ctx_close(ctx, fd) != -1);
+}
+
+// read every file of the owner through an attached instance
+static void check_files(tfs_ctx_t *ctx) {
+    char contents[LEN];
+    char buffer[LEN + 1];
+    char path[16];
+
+    for (size_t file = 0; file < FILES; file++) {
+        snprintf(path, sizeof(path), "/f%zu", file);
+        make_contents(contents, file);
+        check_contents(ctx, path, contents);
+        int fd = tfs_ctx_open(ctx, path, 0);
+        assert(fd != -1);
+        assert(tfs_ctx_lseek(ctx, fd, 10, TFS_SEEK_SET) == 10);
+        assert(tfs_ctx_read(ctx, fd, buffer, 10) == 10);
+        assert(memcmp(buffer, contents + 10, 10) == 0);
+        assert(tfs_ctx_close(ctx, fd) != -1);
+    }
+
+    tfs_stat_t stat;
+    assert(tfs_ctx_stat(ctx, "/f0", &stat) != -1);
+    assert(stat.type == TFS_T_FILE && stat.size == LEN);
+
+    tfs_dir_t *dir = tfs_ctx_opendir(ctx, "/");
+    assert(dir != NULL);
+    size_t entries = 0;
+    while (tfs_readdir(dir) != NULL) {
+        entries++;
+    }
+    assert(entries == FILES);
+    assert(tfs_closedir(dir) != -1);
+}
+
+// files the owner can still create, with the inodes left
+static size_t count_free_inodes(void) {
+    char path[32];
+    size_t count = 0;
+    while (true) {
+        snprintf(path, sizeof(path), "/c%zu", count);
+        int fd = tfs_open(path, TFS_O_CREAT);
+        if (fd == -1) {
+            break;
+        }
+        assert(tfs_close(fd) != -1);
+        count++;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "/c%zu", i);
+        assert(tfs_unlink(path) != -1);
+    }
+    return count;
+}
+
+// nothing can be modified through an attached instance
+static void check_read_only(tfs_ctx_t *ctx) {
+    assert(tfs_ctx_open(ctx, "/new", TFS_O_CREAT) == -1);
+    assert(tfs_ctx_open(ctx, "/f0", TFS_O_TRUNC) == -1);
+    assert(tfs_ctx_open(ctx, "/f0", TFS_O_APPEND) == -1);
+    assert(tfs_ctx_unlink(ctx, "/f0") == -1);
+    assert(tfs_ctx_link(ctx, "/f0", "/l0") == -1);
+    assert(tfs_ctx_sym_link(ctx, "/f0", "/s0") == -1);
+
+    int fd = tfs_ctx_open(ctx, "/f0", 0);
+    assert(fd != -1);
+    assert(tfs_ctx_write(ctx, fd, "x", 1) == -1);
+    assert(tfs_ctx_close(ctx, fd) != -1);
+}
+
+int main() {
+    char contents[LEN];
+    char path[16];
+    snprintf(shm_name, sizeof(shm_name), "/tfs_shm_attach.%d", (int)getpid());
+
+    // no segment to attach to yet
+    assert(tfs_ctx_attach(NULL) == NULL);
+    assert(tfs_ctx_attach(shm_name) == NULL);
+
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = 8; // fewer than the root directory's entries
+    params.max_file_blocks = 4;
+    params.shm_name = shm_name;
+
+    // the segment is laid out once
+    params.max_block_reserve = 2 * params.max_block_count;
+    assert(tfs_init(&params) == -1);
+    params.max_block_reserve = 0;
+
+    assert(tfs_init(&params) != -1);
+    assert(tfs_init(&params) == -1);
+    for (size_t file = 0; file < FILES; file++) {
+        snprintf(path, sizeof(path), "/f%zu", file);
+        int fd = tfs_open(path, TFS_O_CREAT);
+        assert(fd != -1);
+        make_contents(contents, file);
+        assert(tfs_write(fd, contents, LEN) == LEN);
+        assert(tfs_close(fd) != -1);
+    }
+
+    // another process reads the files in place
+    pid_t pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        tfs_ctx_t *ctx = tfs_ctx_attach(shm_name);
+        assert(ctx != NULL);
+        check_files(ctx);
+        check_read_only(ctx);
+        assert(tfs_ctx_destroy(ctx) != -1);
+        _exit(0);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    // the owner still writes, and attached instances see it
+    tfs_ctx_t *ctx = tfs_ctx_attach(shm_name);
+    assert(ctx != NULL);
+    int fd = tfs_open("/f0", TFS_O_APPEND);
+    assert(fd != -1);
+    assert(tfs_write(fd, "!", 1) == 1);
+    assert(tfs_close(fd) != -1);
+    tfs_stat_t stat;
+    assert(tfs_ctx_stat(ctx, "/f0", &stat) != -1);
+    assert(stat.size == LEN + 1);
+    assert(tfs_ctx_destroy(ctx) != -1);
+
+    // a compressed file rewritten by the owner between two reads (into the
+    // blocks it had) is not read from a stale decompressed copy
+    char changed[LEN];
+    make_contents(contents, 0);
+    make_contents(changed, 1);
+    fd = tfs_open("/z", TFS_O_CREAT | TFS_O_COMPRESS);
+    assert(fd != -1);
+    assert(tfs_write(fd, contents, LEN) == LEN);
+    assert(tfs_close(fd) != -1);
+
+    int ready[2], rewritten[2];
+    char token;
+    assert(pipe(ready) == 0 && pipe(rewritten) == 0);
+    pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        ctx = tfs_ctx_attach(shm_name);
+        assert(ctx != NULL);
+        check_contents(ctx, "/z", contents);
+        assert(write(ready[1], "r", 1) == 1);
+        assert(read(rewritten[0], &token, 1) == 1);
+        check_contents(ctx, "/z", changed);
+        assert(tfs_ctx_destroy(ctx) != -1);
+        _exit(0);
+    }
+    assert(read(ready[0], &token, 1) == 1);
+    fd = tfs_open("/z", TFS_O_TRUNC | TFS_O_COMPRESS);
+    assert(fd != -1);
+    assert(tfs_write(fd, changed, LEN) == LEN);
+    assert(tfs_close(fd) != -1);
+    assert(write(rewritten[1], "w", 1) == 1);
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    for (size_t i = 0; i < 2; i++) {
+        close(ready[i]);
+        close(rewritten[i]);
+    }
+
+    // readers killed in the middle of a read leave their ranges locked, which
+    // the owner's writers (of the blocks they touch, or of the whole inode)
+    // drop once they find the process is gone
+    make_contents(contents, 1);
+    for (long round = 0; round < KILLS; round++) {
+        assert(pipe(ready) == 0);
+        pid = fork();
+        assert(pid != -1);
+        if (pid == 0) {
+            char buffer[LEN];
+            ctx = tfs_ctx_attach(shm_name);
+            assert(ctx != NULL);
+            fd = tfs_ctx_open(ctx, "/f1", 0);
+            assert(fd != -1);
+            assert(write(ready[1], "r", 1) == 1);
+            while (true) {
+                assert(tfs_ctx_lseek(ctx, fd, 0, TFS_SEEK_SET) == 0);
+                assert(tfs_ctx_read(ctx, fd, buffer, LEN) == LEN);
+            }
+        }
+        assert(read(ready[0], &token, 1) == 1);
+        struct timespec pause = {0, round * 250000};
+        nanosleep(&pause, NULL);
+        assert(kill(pid, SIGKILL) == 0);
+        assert(waitpid(pid, &status, 0) == pid);
+        assert(WIFSIGNALED(status));
+        close(ready[0]);
+        close(ready[1]);
+
+        fd = tfs_open("/f1", 0);
+        assert(fd != -1);
+        assert(tfs_write(fd, contents, LEN) == LEN);
+        assert(tfs_close(fd) != -1);
+        fd = tfs_open("/f1", TFS_O_TRUNC);
+        assert(fd != -1);
+        assert(tfs_write(fd, contents, LEN) == LEN);
+        assert(tfs_close(fd) != -1);
+    }
+
+    // a file unlinked by the owner while an attached instance has it open is
+    // only deleted once that handle is closed, and its blocks are not reused
+    // meanwhile
+    size_t free_inodes = count_free_inodes();
+    assert(pipe(ready) == 0 && pipe(rewritten) == 0);
+    make_contents(contents, 2);
+    make_contents(changed, 3);
+    pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        char buffer[LEN + 1];
+        ctx = tfs_ctx_attach(shm_name);
+        assert(ctx != NULL);
+        fd = tfs_ctx_open(ctx, "/f2", 0);
+        assert(fd != -1);
+        assert(write(ready[1], "r", 1) == 1);
+        assert(read(rewritten[0], &token, 1) == 1);
+        assert(tfs_ctx_read(ctx, fd, buffer, sizeof(buffer)) == LEN);
+        assert(memcmp(buffer, contents, LEN) == 0);
+        assert(tfs_ctx_close(ctx, fd) != -1);
+        assert(tfs_ctx_destroy(ctx) != -1);
+        _exit(0);
+    }
+    assert(read(ready[0], &token, 1) == 1);
+    assert(tfs_unlink("/f2") != -1);
+    assert(count_free_inodes() == free_inodes);
+    fd = tfs_open("/n", TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fd, changed, LEN) == LEN);
+    assert(tfs_close(fd) != -1);
+    assert(write(rewritten[1], "w", 1) == 1);
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    for (size_t i = 0; i < 2; i++) {
+        close(ready[i]);
+        close(rewritten[i]);
+    }
+    assert(tfs_unlink("/n") != -1);
+    assert(count_free_inodes() == free_inodes + 1);
+
+    // the segment goes away with its owner
+    assert(tfs_destroy() != -1);
+    assert(tfs_ctx_attach(shm_name) == NULL);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
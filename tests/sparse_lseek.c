@@ -0,0 +1,93 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK 1024
+
+uint8_t const file_contents[] = "AAA!";
+char const file_path[] = "/f1";
+
+int main() {
+    uint8_t buffer[4 * BLOCK];
+
+    // root directory plus three data blocks, files of up to eight blocks
+    tfs_params params = tfs_default_params();
+    params.max_block_count = 4;
+    params.max_file_blocks = 8;
+    assert(tfs_init(&params) != -1);
+
+    int fd = tfs_open(file_path, TFS_O_CREAT);
+    assert(fd != -1);
+
+    // write past the end, leaving a three block hole
+    off_t data_offset = 3 * BLOCK + 10;
+    off_t size = data_offset + (off_t)sizeof(file_contents);
+    assert(tfs_lseek(fd, data_offset, TFS_SEEK_SET) == data_offset);
+    assert(tfs_write(fd, file_contents, sizeof(file_contents)) ==
+           sizeof(file_contents));
+    assert(tfs_lseek(fd, 0, TFS_SEEK_CUR) == size);
+    assert(tfs_lseek(fd, 0, TFS_SEEK_END) == size);
+
+    // the hole reads as zeros
+    assert(tfs_lseek(fd, 0, TFS_SEEK_SET) == 0);
+    assert(tfs_read(fd, buffer, sizeof(buffer)) == size);
+    for (off_t i = 0; i < data_offset; ++i) {
+        assert(buffer[i] == 0);
+    }
+    assert(memcmp(buffer + data_offset, file_contents,
+                  sizeof(file_contents)) == 0);
+
+    // holes and data are found with block granularity
+    assert(tfs_lseek(fd, 0, TFS_SEEK_DATA) == 3 * BLOCK);
+    assert(tfs_lseek(fd, 0, TFS_SEEK_HOLE) == 0);
+    assert(tfs_lseek(fd, 3 * BLOCK, TFS_SEEK_HOLE) == size);
+    assert(tfs_lseek(fd, size, TFS_SEEK_DATA) == -1);
+
+    // fill the first block of the hole
+    assert(tfs_lseek(fd, 0, TFS_SEEK_SET) == 0);
+    assert(tfs_write(fd, file_contents, sizeof(file_contents)) ==
+           sizeof(file_contents));
+    assert(tfs_lseek(fd, 0, TFS_SEEK_HOLE) == BLOCK);
+    assert(tfs_lseek(fd, BLOCK, TFS_SEEK_DATA) == 3 * BLOCK);
+
+    // only the two written blocks were allocated: one more fits, then none
+    assert(tfs_lseek(fd, 5 * BLOCK, TFS_SEEK_SET) == 5 * BLOCK);
+    assert(tfs_write(fd, file_contents, sizeof(file_contents)) ==
+           sizeof(file_contents));
+    assert(tfs_lseek(fd, 6 * BLOCK, TFS_SEEK_SET) == 6 * BLOCK);
+    assert(tfs_write(fd, file_contents, sizeof(file_contents)) == -1);
+
+    // nothing can be written past the maximum file size
+    assert(tfs_lseek(fd, 8 * BLOCK, TFS_SEEK_SET) == 8 * BLOCK);
+    assert(tfs_write(fd, file_contents, sizeof(file_contents)) == 0);
+
+    // a negative offset is an error and keeps the current offset
+    assert(tfs_lseek(fd, -1, TFS_SEEK_SET) == -1);
+    assert(tfs_lseek(fd, 0, TFS_SEEK_CUR) == 8 * BLOCK);
+    // and positions that do not fit in an off_t
+    assert(tfs_lseek(fd, INT64_MAX, TFS_SEEK_CUR) == -1);
+    assert(tfs_lseek(fd, INT64_MAX, TFS_SEEK_END) == -1);
+    assert(tfs_lseek(fd, INT64_MIN, TFS_SEEK_CUR) == -1);
+    assert(tfs_lseek(fd, 0, TFS_SEEK_CUR) == 8 * BLOCK);
+
+    // reads past the end return nothing
+    assert(tfs_read(fd, buffer, sizeof(buffer)) == 0);
+
+    // truncating frees the blocks, so the hole can be filled elsewhere
+    assert(tfs_close(fd) != -1);
+    fd = tfs_open(file_path, TFS_O_TRUNC);
+    assert(fd != -1);
+    assert(tfs_lseek(fd, 0, TFS_SEEK_END) == 0);
+    assert(tfs_lseek(fd, 6 * BLOCK, TFS_SEEK_SET) == 6 * BLOCK);
+    assert(tfs_write(fd, file_contents, sizeof(file_contents)) ==
+           sizeof(file_contents));
+    assert(tfs_close(fd) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,144 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BLOCK 1024
+#define MEMORY_BLOCKS 8
+#define FILE_BLOCKS 4
+#define FILES 6
+
+static char spill_path[64];
+
+static void make_block(char *block, size_t file, size_t index) {
+    memset(block, (char)('A' + file * FILE_BLOCKS + index), BLOCK);
+}
+
+static void file_path(char *path, size_t file) {
+    snprintf(path, 16, "/f%zu", file);
+}
+
+int main() {
+    char block[BLOCK];
+    char buffer[BLOCK];
+    char path[16];
+    snprintf(spill_path, sizeof(spill_path), "/tmp/tfs_spill_blocks.%d",
+             (int)getpid());
+
+    tfs_params params = tfs_default_params();
+    params.max_block_count = MEMORY_BLOCKS;
+    params.max_file_blocks = FILE_BLOCKS;
+
+    // without tiering, the files do not fit (the root directory takes a block)
+    assert(tfs_init(&params) != -1);
+    tfs_spill_stats_t stats;
+    assert(tfs_spill_stats(NULL) == -1);
+    assert(tfs_spill_stats(&stats) != -1);
+    assert(stats.spilled == 0 && stats.evictions == 0 && stats.faults == 0);
+    for (size_t file = 0; file < 2; file++) {
+        file_path(path, file);
+        int fd = tfs_open(path, TFS_O_CREAT);
+        assert(fd != -1);
+        for (size_t index = 0; index < FILE_BLOCKS; index++) {
+            make_block(block, file, index);
+            ssize_t written = tfs_write(fd, block, BLOCK);
+            assert(written == (file == 0 || index < FILE_BLOCKS - 1 ? BLOCK
+                                                                     : -1));
+        }
+        assert(tfs_close(fd) != -1);
+    }
+    assert(tfs_destroy() != -1);
+
+    // a spill file needs a path, which must not exist yet
+    params.spill_block_count = FILES * FILE_BLOCKS;
+    assert(tfs_init(&params) == -1);
+    params.spill_path = "/";
+    assert(tfs_init(&params) == -1);
+
+    // a failure past the spill file closes it (the next descriptor is reused)
+    params.spill_path = spill_path;
+    params.max_inode_reserve = (size_t)1 << 40; // more than can be mapped
+    int next_fd = dup(0);
+    assert(next_fd != -1 && close(next_fd) == 0);
+    assert(tfs_init(&params) == -1);
+    assert(dup(0) == next_fd && close(next_fd) == 0);
+    assert(access(spill_path, F_OK) == -1);
+    params.max_inode_reserve = 0;
+
+    assert(tfs_init(&params) != -1);
+    assert(access(spill_path, F_OK) == -1); // only lives as long as the FS
+
+    // cold blocks are moved to the spill file to make room for the new ones
+    for (size_t file = 0; file < FILES; file++) {
+        file_path(path, file);
+        int fd = tfs_open(path, TFS_O_CREAT);
+        assert(fd != -1);
+        for (size_t index = 0; index < FILE_BLOCKS; index++) {
+            make_block(block, file, index);
+            assert(tfs_write(fd, block, BLOCK) == BLOCK);
+        }
+        assert(tfs_close(fd) != -1);
+    }
+    assert(tfs_spill_stats(&stats) != -1);
+    size_t in_memory = FILES * FILE_BLOCKS - stats.spilled;
+    assert(in_memory <= MEMORY_BLOCKS - 1);
+    assert(stats.evictions == stats.spilled && stats.faults == 0);
+
+    // spilled blocks are reported apart from the ones in memory
+    size_t spilled = 0;
+    for (size_t file = 0; file < FILES; file++) {
+        file_path(path, file);
+        tfs_stat_t stat;
+        assert(tfs_stat(path, &stat) != -1);
+        assert(stat.size == FILE_BLOCKS * BLOCK);
+        assert(stat.blocks + stat.spilled == FILE_BLOCKS);
+        spilled += stat.spilled;
+    }
+    assert(spilled == stats.spilled);
+
+    // and come back when read
+    for (size_t file = 0; file < FILES; file++) {
+        file_path(path, file);
+
+        int fd = tfs_open(path, 0);
+        assert(fd != -1);
+        for (size_t index = 0; index < FILE_BLOCKS; index++) {
+            make_block(block, file, index);
+            assert(tfs_read(fd, buffer, BLOCK) == BLOCK);
+            assert(memcmp(buffer, block, BLOCK) == 0);
+        }
+        assert(tfs_close(fd) != -1);
+    }
+    assert(tfs_spill_stats(&stats) != -1);
+    assert(stats.faults > 0);
+    assert(stats.spilled == stats.evictions - stats.faults);
+    assert(FILES * FILE_BLOCKS - stats.spilled == in_memory);
+
+    // and when overwritten in place
+    file_path(path, 0);
+    int fd = tfs_open(path, 0);
+    assert(fd != -1);
+    assert(tfs_lseek(fd, BLOCK / 2, TFS_SEEK_SET) == BLOCK / 2);
+    assert(tfs_write(fd, "spilled", 7) == 7);
+    assert(tfs_lseek(fd, 0, TFS_SEEK_SET) == 0);
+    assert(tfs_read(fd, buffer, BLOCK) == BLOCK);
+    make_block(block, 0, 0);
+    memcpy(block + BLOCK / 2, "spilled", 7);
+    assert(memcmp(buffer, block, BLOCK) == 0);
+    assert(tfs_close(fd) != -1);
+
+    // unlinking the files frees their slots
+    for (size_t file = 0; file < FILES; file++) {
+        file_path(path, file);
+        assert(tfs_unlink(path) != -1);
+    }
+    assert(tfs_spill_stats(&stats) != -1);
+    assert(stats.spilled == 0);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
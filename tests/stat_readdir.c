@@ -0,0 +1,86 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK 1024
+
+int main() {
+    static char contents[2 * BLOCK + 1];
+    memset(contents, 'x', sizeof(contents));
+
+    tfs_params params = tfs_default_params();
+    params.max_file_blocks = 3;
+    assert(tfs_init(&params) != -1);
+
+    tfs_stat_t stat;
+    assert(tfs_stat("/", &stat) != -1);
+    assert(stat.type == TFS_T_DIRECTORY);
+
+    int fd = tfs_open("/f1", TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fd, contents, sizeof(contents)) == sizeof(contents));
+    assert(tfs_close(fd) != -1);
+    assert(tfs_link("/f1", "/f2") != -1);
+    assert(tfs_sym_link("/f1", "/l1") != -1);
+
+    // metadata without opening the files
+    assert(tfs_stat("/f1", &stat) != -1);
+    assert(stat.type == TFS_T_FILE);
+    assert(stat.size == sizeof(contents));
+    assert(stat.links == 2);
+    assert(stat.blocks == 3);
+
+    assert(tfs_stat("/l1", &stat) != -1);
+    assert(stat.type == TFS_T_LINK);
+    assert(stat.size == strlen("/f1") + 1);
+    assert(stat.links == 1);
+
+    assert(tfs_stat("/missing", &stat) == -1);
+    assert(tfs_stat("f1", &stat) == -1);
+
+    // the listing is a snapshot, the directory can change while iterating it
+    tfs_dir_t *dir = tfs_opendir("/");
+    assert(dir != NULL);
+    assert(tfs_unlink("/f2") != -1);
+    fd = tfs_open("/f3", TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_close(fd) != -1);
+
+    char const *expected[] = {"f1", "f2", "l1"};
+    bool seen[3] = {false, false, false};
+    size_t count = 0;
+    tfs_dirent_t const *entry;
+    while ((entry = tfs_readdir(dir)) != NULL) {
+        for (size_t i = 0; i < 3; i++) {
+            if (strcmp(entry->name, expected[i]) == 0) {
+                assert(!seen[i]);
+                seen[i] = true;
+            }
+        }
+        count++;
+    }
+    assert(count == 3 && seen[0] && seen[1] && seen[2]);
+    assert(tfs_readdir(dir) == NULL);
+    assert(tfs_closedir(dir) != -1);
+
+    // a new listing sees the changes
+    dir = tfs_opendir("/");
+    assert(dir != NULL);
+    count = 0;
+    while ((entry = tfs_readdir(dir)) != NULL) {
+        assert(strcmp(entry->name, "f2") != 0);
+        count++;
+    }
+    assert(count == 3);
+    assert(tfs_closedir(dir) != -1);
+
+    assert(tfs_opendir("/f1") == NULL);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
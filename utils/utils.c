@@ -1,7 +1,306 @@
+#include "utils.h"
 #include "logging.h"
+#include <errno.h>
 #include <pthread.h>
 #include <stdio.h>
 
+// called with the time every lock acquisition waited for (or NULL)
+static lock_wait_hook_t lock_wait_hook;
+
+static uint64_t profile_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * Sets the function called with the time (in ns) each mutex_lock, rwl_rdlock
+ * and rwl_wrlock took, so that the users of these wrappers can account lock
+ * waits without them depending on their users (NULL removes it).
+ */
+void lock_wait_hook_set(lock_wait_hook_t hook) {
+    __atomic_store_n(&lock_wait_hook, hook, __ATOMIC_RELEASE);
+}
+
+/**
+ * Starts timing a lock acquisition, if there is a lock wait hook.
+ *
+ * Returns the hook (NULL if none), and stores the start time in start.
+ */
+static lock_wait_hook_t lock_wait_start(uint64_t *start) {
+    lock_wait_hook_t hook = __atomic_load_n(&lock_wait_hook, __ATOMIC_ACQUIRE);
+    *start = hook != NULL ? profile_now() : 0;
+    return hook;
+}
+
+/**
+ * Reports a lock acquisition timed with lock_wait_start to its hook.
+ */
+static void lock_wait_stop(lock_wait_hook_t hook, uint64_t start) {
+    if (hook != NULL) {
+        hook(profile_now() - start);
+    }
+}
+
+#ifdef LOCK_PROFILE
+#include <signal.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+// locks a thread can hold at once and still have their hold time measured
+#define LOCK_PROFILE_DEPTH (32)
+// sites printed by lock_profile_dump
+#define LOCK_PROFILE_TOP (10)
+
+/**
+ * Lock held by the calling thread, and the site that acquired it.
+ */
+typedef struct {
+    void const *lock;
+    lock_site_t *site;
+    uint64_t since;
+} held_lock_t;
+
+static _Thread_local held_lock_t held_locks[LOCK_PROFILE_DEPTH];
+static _Thread_local size_t held_count;
+
+// sites used so far (pushed without locks, never removed)
+static lock_site_t *lock_sites;
+static pthread_once_t lock_profile_once = PTHREAD_ONCE_INIT;
+
+static void lock_profile_exit(void) { lock_profile_dump(STDERR_FILENO); }
+
+static void lock_profile_signal(int sig) {
+    (void)sig;
+    lock_profile_dump(STDERR_FILENO);
+}
+
+/**
+ * Set up the dumps, on the first use of a lock site.
+ */
+static void lock_profile_start(void) {
+    atexit(lock_profile_exit);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = lock_profile_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR2, &action, NULL);
+}
+
+static void site_register(lock_site_t *site) {
+    if (__atomic_load_n(&site->registered, __ATOMIC_ACQUIRE) ||
+        __atomic_exchange_n(&site->registered, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+
+    pthread_once(&lock_profile_once, lock_profile_start);
+
+    lock_site_t *head = __atomic_load_n(&lock_sites, __ATOMIC_RELAXED);
+    do {
+        site->next = head;
+    } while (!__atomic_compare_exchange_n(&lock_sites, &head, site, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/**
+ * Account an acquisition (that started waiting at start, if contended) and
+ * start measuring for how long the lock is held.
+ */
+static void lock_acquired(void const *lock, lock_site_t *site, bool contended,
+                          uint64_t start) {
+    uint64_t now = profile_now();
+
+    site_register(site);
+    __atomic_fetch_add(&site->acquisitions, 1, __ATOMIC_RELAXED);
+    if (contended) {
+        uint64_t wait = now - start;
+        __atomic_fetch_add(&site->contended, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&site->wait_ns, wait, __ATOMIC_RELAXED);
+
+        uint64_t max = __atomic_load_n(&site->max_wait_ns, __ATOMIC_RELAXED);
+        while (wait > max &&
+               !__atomic_compare_exchange_n(&site->max_wait_ns, &max, wait,
+                                            true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+        }
+    }
+
+    if (held_count < LOCK_PROFILE_DEPTH) {
+        held_locks[held_count].lock = lock;
+        held_locks[held_count].site = site;
+        held_locks[held_count].since = now;
+        held_count++;
+    }
+}
+
+/**
+ * Account the time a lock (last acquired by this thread) was held.
+ *
+ * Returns the site that acquired it, or NULL if it was not tracked.
+ */
+static lock_site_t *lock_released(void const *lock) {
+    for (size_t i = held_count; i-- > 0;) {
+        if (held_locks[i].lock != lock) {
+            continue;
+        }
+
+        lock_site_t *site = held_locks[i].site;
+        __atomic_fetch_add(&site->hold_ns, profile_now() - held_locks[i].since,
+                           __ATOMIC_RELAXED);
+
+        held_count--;
+        memmove(&held_locks[i], &held_locks[i + 1],
+                (held_count - i) * sizeof(held_lock_t));
+        return site;
+    }
+
+    return NULL;
+}
+
+/**
+ * Start measuring the hold time of a lock again, after a condition wait.
+ */
+static void lock_reacquired(void const *lock, lock_site_t *site) {
+    if (site != NULL && held_count < LOCK_PROFILE_DEPTH) {
+        held_locks[held_count].lock = lock;
+        held_locks[held_count].site = site;
+        held_locks[held_count].since = profile_now();
+        held_count++;
+    }
+}
+
+/**
+ * Append text to the buffer (of size bytes, holding *len of them), padded with
+ * spaces up to width: after the text if left_align, before it otherwise.
+ * Whatever does not fit is dropped.
+ *
+ * Formats by hand, as snprintf is not async-signal-safe (see
+ * lock_profile_dump).
+ */
+static void dump_append(char *buffer, size_t size, size_t *len,
+                        char const *text, size_t width, bool left_align) {
+    size_t text_len = strlen(text);
+    size_t padding = text_len < width ? width - text_len : 0;
+
+    for (size_t i = 0; !left_align && i < padding && *len < size; i++) {
+        buffer[(*len)++] = ' ';
+    }
+    for (size_t i = 0; i < text_len && *len < size; i++) {
+        buffer[(*len)++] = text[i];
+    }
+    for (size_t i = 0; left_align && i < padding && *len < size; i++) {
+        buffer[(*len)++] = ' ';
+    }
+}
+
+/**
+ * Append a number in decimal to the buffer, right aligned to width (see
+ * dump_append).
+ */
+static void dump_append_u64(char *buffer, size_t size, size_t *len,
+                            uint64_t value, size_t width) {
+    char digits[24];
+    size_t at = sizeof(digits);
+    digits[--at] = '\0';
+    do {
+        digits[--at] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    dump_append(buffer, size, len, &digits[at], width, false);
+}
+
+/**
+ * Print the LOCK_PROFILE_TOP sites that waited the longest, one per line:
+ * site, kind, acquisitions, contended acquisitions, and the total wait, the
+ * longest wait and the total hold times in microseconds.
+ *
+ * Only uses async-signal-safe calls (it also runs from a signal handler): the
+ * lines are formatted by dump_append and printed with write.
+ */
+void lock_profile_dump(int fd) {
+    lock_site_t *top[LOCK_PROFILE_TOP];
+    size_t top_count = 0;
+
+    for (lock_site_t *site = __atomic_load_n(&lock_sites, __ATOMIC_ACQUIRE);
+         site != NULL; site = site->next) {
+        uint64_t wait = __atomic_load_n(&site->wait_ns, __ATOMIC_RELAXED);
+
+        // insertion into the (sorted) top sites
+        size_t i = top_count;
+        while (i > 0 &&
+               __atomic_load_n(&top[i - 1]->wait_ns, __ATOMIC_RELAXED) < wait) {
+            if (i < LOCK_PROFILE_TOP) {
+                top[i] = top[i - 1];
+            }
+            i--;
+        }
+        if (i < LOCK_PROFILE_TOP) {
+            top[i] = site;
+            if (top_count < LOCK_PROFILE_TOP) {
+                top_count++;
+            }
+        }
+    }
+
+    // (the last byte is kept for the newline)
+    char line[256];
+    size_t size = sizeof(line) - 1;
+    size_t len = 0;
+    char const *header[] = {"acquired", "contended", "wait_us", "max_wait_us",
+                            "hold_us"};
+    dump_append(line, size, &len, "lock site", 32, true);
+    dump_append(line, size, &len, " ", 0, true);
+    dump_append(line, size, &len, "kind", 6, true);
+    for (size_t i = 0; i < sizeof(header) / sizeof(header[0]); i++) {
+        dump_append(line, size, &len, " ", 0, true);
+        dump_append(line, size, &len, header[i], 12, false);
+    }
+    line[len++] = '\n';
+    if (write(fd, line, len) < 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < top_count; i++) {
+        lock_site_t *site = top[i];
+        uint64_t values[] = {
+            __atomic_load_n(&site->acquisitions, __ATOMIC_RELAXED),
+            __atomic_load_n(&site->contended, __ATOMIC_RELAXED),
+            __atomic_load_n(&site->wait_ns, __ATOMIC_RELAXED) / 1000,
+            __atomic_load_n(&site->max_wait_ns, __ATOMIC_RELAXED) / 1000,
+            __atomic_load_n(&site->hold_ns, __ATOMIC_RELAXED) / 1000,
+        };
+
+        char name[192];
+        size_t name_len = 0;
+        dump_append(name, sizeof(name) - 1, &name_len, site->file, 0, true);
+        dump_append(name, sizeof(name) - 1, &name_len, ":", 0, true);
+        dump_append_u64(name, sizeof(name) - 1, &name_len,
+                        (uint64_t)site->line, 0);
+        name[name_len] = '\0';
+
+        len = 0;
+        dump_append(line, size, &len, name, 32, true);
+        dump_append(line, size, &len, " ", 0, true);
+        dump_append(line, size, &len, site->kind, 6, true);
+        for (size_t j = 0; j < sizeof(values) / sizeof(values[0]); j++) {
+            dump_append(line, size, &len, " ", 0, true);
+            dump_append_u64(line, size, &len, values[j], 12);
+        }
+        line[len++] = '\n';
+        if (write(fd, line, len) < 0) {
+            return;
+        }
+    }
+}
+#else
+void lock_profile_dump(int fd) { (void)fd; }
+#endif
+
 /**
  * Initializes given mutex. Exit process if operation fails
  */
@@ -13,6 +312,24 @@ int mutex_init(pthread_mutex_t *mutex) {
     return 0;
 }
 
+/**
+ * Initializes given mutex, to be shared with other processes (placed in
+ * shared memory). It is robust: when a process dies holding it, the next one
+ * to lock it takes it over. Exit process if operation fails
+ */
+int mutex_init_shared(pthread_mutex_t *mutex) {
+    pthread_mutexattr_t attr;
+    if (pthread_mutexattr_init(&attr) != 0 ||
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) != 0 ||
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST) != 0 ||
+        pthread_mutex_init(mutex, &attr) != 0) {
+        PANIC("FATAL: Failed to initialize mutex");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutexattr_destroy(&attr);
+    return 0;
+}
+
 /**
  * Destroys given mutex. Exit process if operation fails
  */
@@ -24,14 +341,43 @@ int mutex_destroy(pthread_mutex_t *mutex) {
     return 0;
 }
 
+/**
+ * Takes over a robust mutex whose owner died holding it (see
+ * mutex_init_shared), given the result of locking it: what it protects is used
+ * as it was left.
+ */
+static int mutex_recover(pthread_mutex_t *mutex, int ret) {
+    if (ret == EOWNERDEAD) {
+        return pthread_mutex_consistent(mutex);
+    }
+    return ret;
+}
+
 /**
  * Locks given mutex. Exit process if operation fails
  */
-int mutex_lock(pthread_mutex_t *mutex) {
-    if (pthread_mutex_lock(mutex) != 0) {
+int mutex_lock_at(pthread_mutex_t *mutex, lock_site_t *site) {
+    uint64_t start;
+    lock_wait_hook_t hook = lock_wait_start(&start);
+#ifdef LOCK_PROFILE
+    int ret = mutex_recover(mutex, pthread_mutex_trylock(mutex));
+    bool contended = ret == EBUSY;
+    uint64_t wait_start = contended ? profile_now() : 0;
+    if (contended) {
+        ret = mutex_recover(mutex, pthread_mutex_lock(mutex));
+    }
+#else
+    (void)site;
+    int ret = mutex_recover(mutex, pthread_mutex_lock(mutex));
+#endif
+    if (ret != 0) {
         PANIC("FATAL: Failed to lock mutex");
         exit(EXIT_FAILURE);
     }
+#ifdef LOCK_PROFILE
+    lock_acquired(mutex, site, contended, wait_start);
+#endif
+    lock_wait_stop(hook, start);
     return 0;
 }
 
@@ -39,6 +385,9 @@ int mutex_lock(pthread_mutex_t *mutex) {
  * Unlocks given mutex. Exit process if operation fails
  */
 int mutex_unlock(pthread_mutex_t *mutex) {
+#ifdef LOCK_PROFILE
+    lock_released(mutex);
+#endif
     if (pthread_mutex_unlock(mutex) != 0) {
         PANIC("FATAL: Failed to unlock mutex");
         exit(EXIT_FAILURE);
@@ -57,6 +406,22 @@ int cond_init(pthread_cond_t *conditional) {
     return 0;
 }
 
+/**
+ * Initializes given conditional variable, to be shared with other processes
+ * (placed in shared memory). Exit process if operation fails
+ */
+int cond_init_shared(pthread_cond_t *conditional) {
+    pthread_condattr_t attr;
+    if (pthread_condattr_init(&attr) != 0 ||
+        pthread_condattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) != 0 ||
+        pthread_cond_init(conditional, &attr) != 0) {
+        PANIC("FATAL: Failed to initialize conditional variable");
+        exit(EXIT_FAILURE);
+    }
+    pthread_condattr_destroy(&attr);
+    return 0;
+}
+
 /**
  * Destroys given conditional variable. Exit process if operation fails
  */
@@ -72,13 +437,41 @@ int cond_destroy(pthread_cond_t *conditional) {
  * Waits on given conditional variable. Exit process if operation fails
  */
 int cond_wait(pthread_cond_t *conditional, pthread_mutex_t *mutex) {
-    if (pthread_cond_wait(conditional, mutex) != 0) {
+#ifdef LOCK_PROFILE
+    // the mutex is not held while waiting
+    lock_site_t *site = lock_released(mutex);
+#endif
+    if (mutex_recover(mutex, pthread_cond_wait(conditional, mutex)) != 0) {
         PANIC("FATAL: Failed to wait on conditional variable");
         exit(EXIT_FAILURE);
     }
+#ifdef LOCK_PROFILE
+    lock_reacquired(mutex, site);
+#endif
     return 0;
 }
 
+/**
+ * Waits on given conditional variable until a deadline. Returns 0 if woken
+ * up, ETIMEDOUT if the deadline passed. Exit process if operation fails
+ */
+int cond_timedwait(pthread_cond_t *conditional, pthread_mutex_t *mutex,
+                   struct timespec const *deadline) {
+#ifdef LOCK_PROFILE
+    lock_site_t *site = lock_released(mutex);
+#endif
+    int ret = pthread_cond_timedwait(conditional, mutex, deadline);
+    ret = mutex_recover(mutex, ret);
+    if (ret != 0 && ret != ETIMEDOUT) {
+        PANIC("FATAL: Failed to wait on conditional variable");
+        exit(EXIT_FAILURE);
+    }
+#ifdef LOCK_PROFILE
+    lock_reacquired(mutex, site);
+#endif
+    return ret;
+}
+
 /**
  * Signals given conditional variable. Exit process if operation fails
  */
@@ -99,4 +492,104 @@ int cond_broadcast(pthread_cond_t *conditional) {
         exit(EXIT_FAILURE);
     }
     return 0;
-}
\ No newline at end of file
+}
+
+/**
+ * Initializes given rwlock. Exit process if operation fails
+ */
+int rwl_init(pthread_rwlock_t *rwlock) {
+    if (pthread_rwlock_init(rwlock, NULL) != 0) {
+        PANIC("FATAL: Failed to initialize rwlock");
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
+
+/**
+ * Initializes given rwlock, to be shared with other processes (placed in
+ * shared memory). Exit process if operation fails
+ */
+int rwl_init_shared(pthread_rwlock_t *rwlock) {
+    pthread_rwlockattr_t attr;
+    if (pthread_rwlockattr_init(&attr) != 0 ||
+        pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) != 0 ||
+        pthread_rwlock_init(rwlock, &attr) != 0) {
+        PANIC("FATAL: Failed to initialize rwlock");
+        exit(EXIT_FAILURE);
+    }
+    pthread_rwlockattr_destroy(&attr);
+    return 0;
+}
+
+/**
+ * Destroys given rwlock. Exit process if operation fails
+ */
+int rwl_destroy(pthread_rwlock_t *rwlock) {
+    if (pthread_rwlock_destroy(rwlock) != 0) {
+        PANIC("FATAL: Failed to destroy rwlock");
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
+
+/**
+ * Locks given rwlock for reading. Exit process if operation fails
+ */
+int rwl_rdlock_at(pthread_rwlock_t *rwlock, lock_site_t *site) {
+    uint64_t start;
+    lock_wait_hook_t hook = lock_wait_start(&start);
+#ifdef LOCK_PROFILE
+    bool contended = pthread_rwlock_tryrdlock(rwlock) != 0;
+    uint64_t wait_start = contended ? profile_now() : 0;
+    if (contended && pthread_rwlock_rdlock(rwlock) != 0) {
+#else
+    (void)site;
+    if (pthread_rwlock_rdlock(rwlock) != 0) {
+#endif
+        PANIC("FATAL: Failed to lock rwlock for reading");
+        exit(EXIT_FAILURE);
+    }
+#ifdef LOCK_PROFILE
+    lock_acquired(rwlock, site, contended, wait_start);
+#endif
+    lock_wait_stop(hook, start);
+    return 0;
+}
+
+/**
+ * Locks given rwlock for writing. Exit process if operation fails
+ */
+int rwl_wrlock_at(pthread_rwlock_t *rwlock, lock_site_t *site) {
+    uint64_t start;
+    lock_wait_hook_t hook = lock_wait_start(&start);
+#ifdef LOCK_PROFILE
+    bool contended = pthread_rwlock_trywrlock(rwlock) != 0;
+    uint64_t wait_start = contended ? profile_now() : 0;
+    if (contended && pthread_rwlock_wrlock(rwlock) != 0) {
+#else
+    (void)site;
+    if (pthread_rwlock_wrlock(rwlock) != 0) {
+#endif
+        PANIC("FATAL: Failed to lock rwlock for writing");
+        exit(EXIT_FAILURE);
+    }
+#ifdef LOCK_PROFILE
+    lock_acquired(rwlock, site, contended, wait_start);
+#endif
+    lock_wait_stop(hook, start);
+    return 0;
+}
+
+/**
+ * Unlocks given rwlock. Exit process if operation fails
+ */
+int rwl_unlock(pthread_rwlock_t *rwlock) {
+#ifdef LOCK_PROFILE
+    lock_released(rwlock);
+#endif
+    if (pthread_rwlock_unlock(rwlock) != 0) {
+        PANIC("FATAL: Failed to unlock rwlock");
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
@@ -2,15 +2,81 @@
 #define __WRAPPER_H__
 
 #include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * Lock contention profiling (builds with -DLOCK_PROFILE, i.e. make
+ * LOCK_PROFILE=yes).
+ *
+ * Every call to mutex_lock, rwl_rdlock or rwl_wrlock is a lock site, named
+ * after its __FILE__ and __LINE__, that counts its acquisitions (and how many
+ * had to wait), the time spent waiting and the time the lock was then held
+ * for. The most contended sites are printed to stderr on exit, and whenever
+ * the process receives SIGUSR2 (see lock_profile_dump).
+ */
+typedef struct lock_site {
+    char const *file;
+    int line;
+    char const *kind;
+
+    // updated with atomic operations
+    uint64_t acquisitions;
+    uint64_t contended;
+    uint64_t wait_ns;
+    uint64_t max_wait_ns;
+    uint64_t hold_ns;
+
+    int registered;
+    struct lock_site *next;
+} lock_site_t;
+
+#ifdef LOCK_PROFILE
+// a statically allocated site per call site
+#define LOCK_SITE(site_kind)                                                   \
+    __extension__({                                                            \
+        static lock_site_t lock_site = {                                       \
+            .file = __FILE__, .line = __LINE__, .kind = site_kind};            \
+        &lock_site;                                                            \
+    })
+#else
+#define LOCK_SITE(site_kind) ((lock_site_t *)NULL)
+#endif
+
+#define mutex_lock(mutex) mutex_lock_at((mutex), LOCK_SITE("mutex"))
+#define rwl_rdlock(rwlock) rwl_rdlock_at((rwlock), LOCK_SITE("rdlock"))
+#define rwl_wrlock(rwlock) rwl_wrlock_at((rwlock), LOCK_SITE("wrlock"))
+
+/**
+ * Called with the time (in ns) a lock acquisition took (see
+ * lock_wait_hook_set).
+ */
+typedef void (*lock_wait_hook_t)(uint64_t wait_ns);
+
+void lock_wait_hook_set(lock_wait_hook_t hook);
 
 int mutex_init(pthread_mutex_t *mutex);
+int mutex_init_shared(pthread_mutex_t *mutex);
 int mutex_destroy(pthread_mutex_t *mutex);
-int mutex_lock(pthread_mutex_t *mutex);
+int mutex_lock_at(pthread_mutex_t *mutex, lock_site_t *site);
 int mutex_unlock(pthread_mutex_t *mutex);
 
+int rwl_init(pthread_rwlock_t *rwlock);
+int rwl_init_shared(pthread_rwlock_t *rwlock);
+int rwl_destroy(pthread_rwlock_t *rwlock);
+int rwl_rdlock_at(pthread_rwlock_t *rwlock, lock_site_t *site);
+int rwl_wrlock_at(pthread_rwlock_t *rwlock, lock_site_t *site);
+int rwl_unlock(pthread_rwlock_t *rwlock);
+
 int cond_init(pthread_cond_t *cond);
+int cond_init_shared(pthread_cond_t *cond);
 int cond_destroy(pthread_cond_t *cond);
 int cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
+int cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                   struct timespec const *deadline);
+int cond_signal(pthread_cond_t *cond);
 int cond_broadcast(pthread_cond_t *cond);
 
-#endif
\ No newline at end of file
+void lock_profile_dump(int fd);
+
+#endif